@@ -0,0 +1,723 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ============================== Benchmarks =============================
+ *
+ * `make bench` (or `./tsearch-bench [options]`) measures tsearch() on
+ * synthetic corpora, so that two versions of the program can be compared
+ * on the same input:
+ *
+ *   - a corpus of random words of the requested size is generated for
+ *     every hit density, with the word "needle" placed the requested
+ *     number of times per MiB (the same seed gives the same corpus);
+ *   - every engine is run with every thread count, with the page cache
+ *     warm (after an untimed run) and cold (the file is dropped from the
+ *     cache with posix_fadvise(POSIX_FADV_DONTNEED) before every run,
+ *     which needs no root);
+ *   - before every run, mincore() tells how much of the file is in the
+ *     page cache. A cold run with pages left is dropped again, up to
+ *     BENCH_DROP_TRIES times, then reported with a warning: the resident
+ *     column is the worst run of the case, the most resident of the cold
+ *     ones and the least resident of the warm ones, in percent;
+ *   - each case is repeated and reported as the median and the 95th
+ *     percentile of the wall time, and the matching throughput in GB/s
+ *     (10^9 bytes per second: p95_gbps is the throughput of the p95 run,
+ *     the slow tail).
+ *
+ * The results go to stdout as CSV or JSON, the logs of the searches are
+ * dropped. The indexes and the result cache are never used.
+ *
+ * `--roofline` answers instead why more threads don't make a search
+ * proportionally faster. It measures the memory bandwidth of the machine
+ * at every thread count, like STREAM: reading a buffer (a sum of its
+ * words) and copying it (memcpy, which is what reading a file from the
+ * page cache costs). Then it runs the first engine (word by default) on
+ * the first corpus, warm, at every thread count, and reports for each
+ * the throughput as a fraction of the single thread bandwidths, the
+ * speedup over one thread and the serial fraction that explains it
+ * (Karp-Flatt: (1/speedup - 1/p) / (1 - 1/p), the Amdahl serial fraction
+ * measured rather than assumed). A search close to the copy bandwidth of
+ * its thread count is bandwidth-bound: more threads or a faster kernel
+ * won't help, only less data will. Otherwise it's compute-bound in the
+ * kernel, or limited by whatever the serial fraction is spent on.
+ *
+ * Options:
+ *   --size=<MiB>           Size of the corpora (default 256).
+ *   --density=<list>       Hits per MiB, comma separated (default 0,100,10000).
+ *   --threads=<list>       Thread counts (default 1,2,4... up to the CPUs).
+ *   --engines=<list>       Among word, substring, overlapping, regex,
+ *                          fuzzy and wildcard (default all).
+ *   --cache=<list>         warm, cold or both (default warm,cold).
+ *   --runs=<n>             Timed runs of every case (default 5).
+ *   --seed=<n>             Seed of the corpora (default 1).
+ *   --dir=<dir>            Where the corpora are written ($TMPDIR or /tmp),
+ *                          they are removed at the end.
+ *   --json                 JSON instead of CSV.
+ *   --roofline             Bandwidth and scalability report, see above.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tsearch.h"
+
+#define BENCH_NEEDLE  "needle"
+#define BENCH_VOCAB   4096      /* Distinct filler words */
+#define BENCH_MAX_LIST 64
+#define BENCH_DROP_TRIES 3      /* Drops of a cold run before giving up */
+
+struct engine {
+        const char *name;
+        enum search_mode_t mode;
+        int overlapping;
+        int max_errors;
+        const char *pattern;
+};
+
+static const struct engine engines[] = {
+        { "word",        SEARCH_WORD,      0, 0, BENCH_NEEDLE },
+        { "substring",   SEARCH_SUBSTRING, 0, 0, BENCH_NEEDLE },
+        { "overlapping", SEARCH_SUBSTRING, 1, 0, BENCH_NEEDLE },
+        { "regex",       SEARCH_REGEX,     0, 0, "ne+dle" },
+        { "fuzzy",       SEARCH_FUZZY,     0, 1, BENCH_NEEDLE },
+        { "wildcard",    SEARCH_WILDCARD,  0, 0, "need*" },
+};
+#define NENGINES (int)(sizeof(engines) / sizeof(engines[0]))
+
+#define CACHE_WARM 1
+#define CACHE_COLD 2
+
+static uint64_t rng_state;
+
+/* xorshift64*: fast, and the same sequence on every machine */
+static uint64_t rng(void) {
+        rng_state ^= rng_state >> 12;
+        rng_state ^= rng_state << 25;
+        rng_state ^= rng_state >> 27;
+        return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Write size bytes of lowercase words separated by spaces and newlines,
+ * with about density needles per MiB, and return how many were placed. */
+static long generate(const char *path, long size, long density, uint64_t seed) {
+        static char vocab[BENCH_VOCAB][16];
+        char line[256];
+        long hits = 0, written = 0;
+
+        rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+        for (int i = 0; i < BENCH_VOCAB; i++) {
+                int len;
+                do {
+                        len = 2 + rng() % 11;
+                        for (int j = 0; j < len; j++)
+                                vocab[i][j] = 'a' + rng() % 26;
+                        vocab[i][len] = '\0';
+                } while (strstr(vocab[i], "need"));
+        }
+
+        FILE *fp = fopen(path, "w");
+        if (!fp) {
+                ERR("Failed to create '%s': %s", path, strerror(errno));
+                return -1;
+        }
+
+        /* Filler words are 7.5 bytes on average with their separator */
+        uint64_t threshold = (uint64_t)((double)density * 7.5 / (1 << 20) * (double)UINT64_MAX);
+        if (density > 0 && threshold == 0) threshold = 1;
+
+        while (written < size) {
+                size_t room = MIN(size - written, (long)sizeof(line));
+                size_t n = 0;
+                int last = 0;
+
+                while (n < 80) {
+                        int hit = rng() < threshold;
+                        const char *w = hit ? BENCH_NEEDLE : vocab[rng() % BENCH_VOCAB];
+                        size_t len = strlen(w);
+
+                        if (n + len + 1 > room) {
+                                last = 1;
+                                break;
+                        }
+                        memcpy(line + n, w, len);
+                        n += len;
+                        line[n++] = ' ';
+                        hits += hit;
+                }
+                /* The end of the file is padded rather than cut in a word */
+                if (last) {
+                        memset(line + n, ' ', room - n);
+                        n = room;
+                }
+                line[n - 1] = '\n';
+                if (fwrite(line, 1, n, fp) != n) break;
+                written += n;
+        }
+        if (fclose(fp) != 0 || written < size) {
+                ERR("Failed to write '%s'", path);
+                return -1;
+        }
+        return hits;
+}
+
+/* Drop the file from the page cache, its pages are clean once synced */
+static int drop_cache(const char *path) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return -1;
+        fdatasync(fd);
+        int ret = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+        return ret == 0 ? 0 : -1;
+}
+
+/* Percent of the file in the page cache, -1 if unknown. Mapping the
+ * file doesn't read it, only touching the pages would. */
+static double resident_percent(const char *path) {
+        struct stat st;
+        double ret = -1;
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return -1;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+                close(fd);
+                return -1;
+        }
+
+        long page = sysconf(_SC_PAGESIZE);
+        size_t pages = (st.st_size + page - 1) / page;
+        unsigned char *vec = malloc(pages);
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (vec && map != MAP_FAILED && mincore(map, st.st_size, vec) == 0) {
+                size_t resident = 0;
+                for (size_t i = 0; i < pages; i++)
+                        resident += vec[i] & 1;
+                ret = 100.0 * resident / pages;
+        }
+        if (map != MAP_FAILED) munmap(map, st.st_size);
+        free(vec);
+        return ret;
+}
+
+static int64_t now_ns(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_i64(const void *a, const void *b) {
+        int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+        return (x > y) - (x < y);
+}
+
+static int cmp_long(const void *a, const void *b) {
+        long x = *(const long *)a, y = *(const long *)b;
+        return (x > y) - (x < y);
+}
+
+/* Nearest rank percentile of the sorted samples */
+static int64_t percentile(const int64_t *sorted, int n, int p) {
+        int rank = (p * n + 99) / 100;
+        return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/* Parse a comma separated list of numbers, the count or -1 */
+static int parse_list(const char *list, long *values, int max) {
+        int n = 0;
+
+        while (*list) {
+                char *e;
+                errno = 0;
+                long v = strtol(list, &e, 10);
+                if (errno || e == list || (*e != ',' && *e != '\0') || v < 0 || n == max)
+                        return -1;
+                values[n++] = v;
+                list = *e ? e + 1 : e;
+        }
+        return n > 0 ? n : -1;
+}
+
+/* Bitmask of the engines in the list, 0 if invalid */
+static unsigned parse_engines(const char *list) {
+        unsigned mask = 0;
+
+        while (*list) {
+                size_t n = strcspn(list, ",");
+                int i;
+                for (i = 0; i < NENGINES; i++)
+                        if (strlen(engines[i].name) == n && strncmp(list, engines[i].name, n) == 0)
+                                break;
+                if (i == NENGINES) return 0;
+                mask |= 1u << i;
+                list += n;
+                if (*list == ',') list++;
+        }
+        return mask;
+}
+
+static int parse_cache(const char *list) {
+        int mask = 0;
+
+        while (*list) {
+                size_t n = strcspn(list, ",");
+                if (n == 4 && strncmp(list, "warm", n) == 0)
+                        mask |= CACHE_WARM;
+                else if (n == 4 && strncmp(list, "cold", n) == 0)
+                        mask |= CACHE_COLD;
+                else
+                        return 0;
+                list += n;
+                if (*list == ',') list++;
+        }
+        return mask;
+}
+
+struct bench_case {
+        const struct engine *engine;
+        long threads;
+        const char *cache;
+        long size;
+        long density;
+        long hits;          /* Needles placed in the corpus */
+        uint64_t count;     /* Found by the search */
+        int runs;
+        int64_t median_ns;
+        int64_t p95_ns;
+        double resident;    /* Percent in the page cache, worst run */
+};
+
+static void print_case(FILE *out, const struct bench_case *c, int json, int first) {
+        double median_gbps = c->median_ns ? (double)c->size / c->median_ns : 0;
+        double p95_gbps = c->p95_ns ? (double)c->size / c->p95_ns : 0;
+
+        if (json) {
+                fprintf(out, "%s  {\"engine\": \"%s\", \"pattern\": \"%s\", \"threads\": %ld, "
+                        "\"cache\": \"%s\", \"size\": %ld, \"density\": %ld, \"hits\": %ld, "
+                        "\"resident\": %.1f, \"count\": %lu, \"runs\": %d, \"median_ns\": %ld, "
+                        "\"p95_ns\": %ld, \"median_gbps\": %.3f, \"p95_gbps\": %.3f}",
+                        first ? "" : ",\n", c->engine->name, c->engine->pattern, c->threads,
+                        c->cache, c->size, c->density, c->hits, c->resident, c->count, c->runs,
+                        c->median_ns, c->p95_ns, median_gbps, p95_gbps);
+        } else {
+                fprintf(out, "%s,%s,%ld,%s,%ld,%ld,%ld,%.1f,%lu,%d,%ld,%ld,%.3f,%.3f\n",
+                        c->engine->name, c->engine->pattern, c->threads, c->cache,
+                        c->size, c->density, c->hits, c->resident, c->count, c->runs,
+                        c->median_ns, c->p95_ns, median_gbps, p95_gbps);
+        }
+        fflush(out);
+}
+
+/* Time the runs of a case, 0 on success */
+static int run_case(const char *path, struct bench_case *c, int cold) {
+        struct search_opts_t opts = {
+                .mode = c->engine->mode,
+                .overlapping = c->engine->overlapping,
+                .max_errors = c->engine->max_errors,
+        };
+        int64_t samples[c->runs];
+        char word[MAX_WORD_LENGTH];
+
+        snprintf(word, sizeof(word), "%s", c->engine->pattern);
+
+        /* Warm up: fills the page cache, and the allocator */
+        if (!cold) {
+                struct search_result_t *res = tsearch((char *)path, word, &opts, c->threads);
+                if (!res) return -1;
+                free(res);
+        }
+
+        c->resident = cold ? 0 : 100;
+        for (int i = 0; i < c->runs; i++) {
+                double resident = resident_percent(path);
+
+                for (int try = 0; cold && try < BENCH_DROP_TRIES && resident != 0; try++) {
+                        if (drop_cache(path) != 0) {
+                                ERR("Failed to drop '%s' from the page cache", path);
+                                return -1;
+                        }
+                        resident = resident_percent(path);
+                }
+                if (cold && resident > 0)
+                        ERR("%.1f%% of '%s' is still in the page cache after %d drops, "
+                            "the cold run is partly warm", resident, path, BENCH_DROP_TRIES);
+                if (resident >= 0)
+                        c->resident = cold ? MAX(c->resident, resident) : MIN(c->resident, resident);
+
+                int64_t start = now_ns();
+                struct search_result_t *res = tsearch((char *)path, word, &opts, c->threads);
+                samples[i] = now_ns() - start;
+                if (!res) return -1;
+                c->count = res->occurrences;
+                free(res);
+        }
+
+        qsort(samples, c->runs, sizeof(samples[0]), cmp_i64);
+        c->median_ns = percentile(samples, c->runs, 50);
+        c->p95_ns = percentile(samples, c->runs, 95);
+        return 0;
+}
+
+/* A slice of the STREAM-like buffers for one thread */
+struct stream_slice {
+        const uint64_t *src;
+        uint64_t *dst;          /* NULL: read only */
+        size_t words;
+        uint64_t sum;
+};
+
+static void *stream_thread(void *arg) {
+        struct stream_slice *s = arg;
+
+        if (s->dst) {
+                memcpy(s->dst, s->src, s->words * sizeof(uint64_t));
+                return NULL;
+        }
+        /* Independent sums, so the loads aren't serialized on one add */
+        uint64_t a = 0, b = 0, c = 0, d = 0;
+        for (size_t i = 0; i + 4 <= s->words; i += 4) {
+                a += s->src[i];
+                b += s->src[i + 1];
+                c += s->src[i + 2];
+                d += s->src[i + 3];
+        }
+        s->sum = a + b + c + d;
+        return NULL;
+}
+
+/* Best GB/s of runs passes over src (into dst, if given) by threads */
+static double stream_bandwidth(const uint64_t *src, uint64_t *dst, size_t words,
+                               int threads, int runs) {
+        struct stream_slice slices[256];
+        pthread_t ids[256];
+        int64_t best = 0;
+        static volatile uint64_t sink;
+
+        for (int r = 0; r < runs; r++) {
+                int started = 0;
+                int64_t start = now_ns();
+
+                for (int i = 0; i < threads; i++) {
+                        size_t from = words / threads * i;
+                        size_t to = i == threads - 1 ? words : words / threads * (i + 1);
+                        slices[i] = (struct stream_slice){
+                                .src = src + from, .dst = dst ? dst + from : NULL,
+                                .words = to - from,
+                        };
+                }
+                for (int i = 1; i < threads; i++) {
+                        if (pthread_create(&ids[i], NULL, stream_thread, &slices[i]) != 0) break;
+                        started++;
+                }
+                stream_thread(&slices[0]);
+                for (int i = 1; i <= started; i++)
+                        pthread_join(ids[i], NULL);
+
+                int64_t elapsed = now_ns() - start;
+                if (best == 0 || elapsed < best) best = elapsed;
+                for (int i = 0; i < threads; i++)
+                        sink += slices[i].sum;
+        }
+        /* A copy reads and writes every byte */
+        return (double)words * sizeof(uint64_t) * (dst ? 2 : 1) / best;
+}
+
+/* --roofline: bandwidth at every thread count against the search */
+static int roofline(FILE *out, int json, const char *path, long size, const struct engine *engine,
+                    const long *threads, int nthreads, int runs) {
+        size_t words = size / sizeof(uint64_t);
+        uint64_t *src = malloc(words * sizeof(uint64_t));
+        uint64_t *dst = malloc(words * sizeof(uint64_t));
+        double read1 = 0, copy1 = 0, base_ns = 0;
+        int ret = 0;
+
+        if (!src || !dst) {
+                ERR("Failed to allocate 2 x %ld bytes for the bandwidth test", size);
+                free(src);
+                free(dst);
+                return 1;
+        }
+        /* Touch every page before timing */
+        for (size_t i = 0; i < words; i++)
+                src[i] = i;
+        memset(dst, 0, words * sizeof(uint64_t));
+
+        if (json) fprintf(out, "[\n");
+        else fprintf(out, "engine,threads,median_gbps,speedup,serial_fraction,read_gbps,copy_gbps,"
+                     "of_read_1,of_copy_1,of_copy,bound\n");
+
+        for (int t = 0; t < nthreads; t++) {
+                struct bench_case c = {
+                        .engine = engine, .threads = threads[t], .cache = "warm",
+                        .size = size, .runs = runs,
+                };
+                double read = stream_bandwidth(src, NULL, words, threads[t], runs);
+                double copy = stream_bandwidth(src, dst, words, threads[t], runs);
+
+                if (run_case(path, &c, 0) != 0) {
+                        ERR("%s search failed on '%s'", engine->name, path);
+                        ret = 1;
+                        break;
+                }
+                if (t == 0) {
+                        read1 = read;
+                        copy1 = copy;
+                        base_ns = c.median_ns;
+                }
+
+                double gbps = (double)size / c.median_ns;
+                double speedup = base_ns / c.median_ns;
+                double p = threads[t];
+                /* Karp-Flatt, undefined for one thread */
+                double serial = p > 1 ? (1 / speedup - 1 / p) / (1 - 1 / p) : 0;
+                /* The copy is the roof of a read through the page cache */
+                const char *bound = gbps >= 0.7 * copy ? "bandwidth" : "compute";
+
+                if (json) {
+                        fprintf(out, "%s  {\"engine\": \"%s\", \"threads\": %ld, \"median_gbps\": %.3f, "
+                                "\"speedup\": %.3f, \"serial_fraction\": %.3f, \"read_gbps\": %.3f, "
+                                "\"copy_gbps\": %.3f, \"of_read_1\": %.3f, \"of_copy_1\": %.3f, "
+                                "\"of_copy\": %.3f, \"bound\": \"%s\"}",
+                                t ? ",\n" : "", engine->name, threads[t], gbps, speedup, serial,
+                                read, copy, gbps / read1, gbps / copy1, gbps / copy, bound);
+                } else {
+                        fprintf(out, "%s,%ld,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%s\n",
+                                engine->name, threads[t], gbps, speedup, serial, read, copy,
+                                gbps / read1, gbps / copy1, gbps / copy, bound);
+                }
+                fflush(out);
+        }
+        if (json) fprintf(out, "\n]\n");
+
+        free(src);
+        free(dst);
+        return ret;
+}
+
+static void usage(void) {
+        ERR("Usage: ./tsearch-bench [options]");
+        ERR("  --size=<MiB>           size of the corpora (default 256)");
+        ERR("  --density=<list>       needles per MiB (default 0,100,10000)");
+        ERR("  --threads=<list>       thread counts (default 1,2,4... up to the CPUs)");
+        ERR("  --engines=<list>       word, substring, overlapping, regex, fuzzy, wildcard");
+        ERR("  --cache=<list>         warm, cold (default both)");
+        ERR("  --runs=<n>             timed runs of every case (default 5)");
+        ERR("  --seed=<n>             seed of the corpora (default 1)");
+        ERR("  --dir=<dir>            where the corpora are written (default $TMPDIR or /tmp)");
+        ERR("  --json                 JSON instead of CSV");
+        ERR("  --roofline             memory bandwidth and scalability of the search instead");
+}
+
+int main(int argc, char **argv) {
+        static const struct option long_options[] = {
+                { "size", required_argument, NULL, 's' },
+                { "density", required_argument, NULL, 'd' },
+                { "threads", required_argument, NULL, 't' },
+                { "engines", required_argument, NULL, 'e' },
+                { "cache", required_argument, NULL, 'c' },
+                { "runs", required_argument, NULL, 'r' },
+                { "seed", required_argument, NULL, 'S' },
+                { "dir", required_argument, NULL, 'D' },
+                { "json", no_argument, NULL, 'j' },
+                { "roofline", no_argument, NULL, 'R' },
+                { NULL, 0, NULL, 0 }
+        };
+        long size_mib = 256, runs = 5, seed = 1;
+        long densities[BENCH_MAX_LIST] = { 0, 100, 10000 };
+        long threads[BENCH_MAX_LIST];
+        int ndensities = 3, nthreads = 0;
+        unsigned engine_mask = (1u << NENGINES) - 1;
+        int cache = CACHE_WARM | CACHE_COLD;
+        const char *dir = getenv("TMPDIR");
+        int json = 0, roofline_report = 0;
+        int opt;
+
+        if (!dir || !*dir) dir = "/tmp";
+
+        while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+                long v[1];
+
+                switch (opt) {
+                case 's':
+                case 'r':
+                case 'S':
+                        if (parse_list(optarg, v, 1) != 1 || (opt != 'S' && v[0] < 1)) {
+                                ERR("Invalid number '%s'", optarg);
+                                return 1;
+                        }
+                        if (opt == 's') size_mib = v[0];
+                        else if (opt == 'r') runs = v[0];
+                        else seed = v[0];
+                        break;
+                case 'd':
+                        ndensities = parse_list(optarg, densities, BENCH_MAX_LIST);
+                        if (ndensities < 0) {
+                                ERR("Invalid densities '%s'", optarg);
+                                return 1;
+                        }
+                        break;
+                case 't':
+                        nthreads = parse_list(optarg, threads, BENCH_MAX_LIST);
+                        for (int i = 0; i < nthreads; i++)
+                                if (threads[i] < 1 || threads[i] > 255) nthreads = -1;
+                        if (nthreads < 0) {
+                                ERR("Invalid thread counts '%s'", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'e':
+                        engine_mask = parse_engines(optarg);
+                        if (!engine_mask) {
+                                ERR("Unknown engines '%s'", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'c':
+                        cache = parse_cache(optarg);
+                        if (!cache) {
+                                ERR("Invalid cache states '%s'", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'D':
+                        dir = optarg;
+                        break;
+                case 'j':
+                        json = 1;
+                        break;
+                case 'R':
+                        roofline_report = 1;
+                        break;
+                default:
+                        usage();
+                        return 1;
+                }
+        }
+        if (optind != argc) {
+                usage();
+                return 1;
+        }
+
+        if (nthreads == 0) {
+                long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                for (long t = 1; nthreads < BENCH_MAX_LIST; t *= 2) {
+                        threads[nthreads++] = MIN(t, 255);
+                        if (t >= cpus || t >= 255) break;
+                }
+                if (threads[nthreads - 1] < MIN(cpus, 255))
+                        threads[nthreads++] = MIN(cpus, 255);
+        }
+
+        /* The results keep stdout, the logs of the searches go nowhere */
+        fflush(stdout);
+        FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+        if (!out || !freopen("/dev/null", "w", stdout)) {
+                ERR("Failed to redirect the logs");
+                return 1;
+        }
+
+        word_chars_init(NULL);
+
+        if (roofline_report) {
+                char path[4096];
+                long size = size_mib << 20;
+                int e = __builtin_ctz(engine_mask);
+
+                /* One row per thread count, in order, and the speedups are
+                 * relative to one thread */
+                qsort(threads, nthreads, sizeof(threads[0]), cmp_long);
+                int unique = 0;
+                for (int t = 0; t < nthreads; t++)
+                        if (unique == 0 || threads[t] != threads[unique - 1])
+                                threads[unique++] = threads[t];
+                nthreads = unique;
+                if (threads[0] != 1) {
+                        memmove(threads + 1, threads, MIN(nthreads, BENCH_MAX_LIST - 1) * sizeof(long));
+                        threads[0] = 1;
+                        nthreads = MIN(nthreads + 1, BENCH_MAX_LIST);
+                }
+                snprintf(path, sizeof(path), "%s/tsearch-bench-%d.txt", dir, (int)getpid());
+                if (generate(path, size, densities[0], seed) < 0)
+                        return 1;
+                int failed = roofline(out, json, path, size, &engines[e], threads, nthreads, runs);
+                unlink(path);
+                fclose(out);
+                return failed;
+        }
+
+        if (json) fprintf(out, "[\n");
+        else fprintf(out, "engine,pattern,threads,cache,size,density,hits,resident,count,runs,"
+                     "median_ns,p95_ns,median_gbps,p95_gbps\n");
+
+        int first = 1, failed = 0;
+        for (int d = 0; d < ndensities && !failed; d++) {
+                char path[4096];
+                long size = size_mib << 20;
+
+                snprintf(path, sizeof(path), "%s/tsearch-bench-%d-%ld.txt", dir, (int)getpid(),
+                         densities[d]);
+                long hits = generate(path, size, densities[d], seed);
+                if (hits < 0) {
+                        failed = 1;
+                        break;
+                }
+
+                for (int e = 0; e < NENGINES && !failed; e++) {
+                        if (!(engine_mask & (1u << e))) continue;
+
+                        for (int t = 0; t < nthreads && !failed; t++) {
+                                for (int cold = 0; cold <= 1; cold++) {
+                                        struct bench_case c = {
+                                                .engine = &engines[e], .threads = threads[t],
+                                                .cache = cold ? "cold" : "warm",
+                                                .size = size, .density = densities[d],
+                                                .hits = hits, .runs = runs,
+                                        };
+
+                                        if (!(cache & (cold ? CACHE_COLD : CACHE_WARM)))
+                                                continue;
+                                        if (run_case(path, &c, cold) != 0) {
+                                                ERR("%s search failed on '%s'", c.engine->name, path);
+                                                failed = 1;
+                                                break;
+                                        }
+                                        /* The corpus is built so that word searches
+                                         * find exactly the needles placed */
+                                        if (c.engine->mode == SEARCH_WORD && c.count != (uint64_t)hits) {
+                                                ERR("word search found %lu needles, %ld were placed",
+                                                    c.count, hits);
+                                                failed = 1;
+                                        }
+                                        print_case(out, &c, json, first);
+                                        first = 0;
+                                }
+                        }
+                }
+                unlink(path);
+        }
+        if (json) fprintf(out, "%s]\n", first ? "" : "\n");
+        fclose(out);
+        return failed;
+}
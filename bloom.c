@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ========================== Bloom filters ==============================
+ *
+ * The BLOOM_HASHES bits of a word come from one 64-bit hash split in two
+ * (double hashing), so they are the same in every block: a lookup ANDs
+ * the same few slices of every group. Each thread keeps the groups its
+ * chunk touches, a group cut by a chunk boundary is ORed at the merge.
+ *
+ * Layout of the file (native byte order):
+ *
+ *   struct bloom_header, padded to BLOOM_DATA
+ *   groups       ngroups times BLOOM_BITS uint64_t, the bit i of the
+ *                slice j is set if the filter of block 64 * group + i
+ *                has the bit j
+ *
+ * An update writes the groups first and the header last, a reader using
+ * the old header only looks at blocks whose bits are never cleared.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tsearch.h"
+#include "bloom.h"
+
+#define BLOOM_MAGIC   "TSBLM\0\0\0"
+#define BLOOM_VERSION 1
+#define BLOOM_GROUP   64
+#define BLOOM_DATA    4096            /* Offset of the first group */
+#define GROUP_BYTES   (BLOOM_BITS * sizeof(uint64_t))
+
+struct bloom_header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t header_size;
+        uint64_t dev;
+        uint64_t ino;
+        uint8_t  word_chars[256];
+        uint64_t block_size;
+        uint64_t bits;
+        uint64_t hashes;
+        uint64_t indexed;       /* Bytes of the file covered */
+        uint64_t nblocks;
+        uint64_t ngroups;
+        uint64_t guards[2];     /* See file_guards() */
+};
+
+struct bloom_part_t {
+        uint64_t first;         /* First group */
+        uint64_t ngroups;
+        uint64_t *slices;
+};
+
+struct bloom_t {
+        const uint8_t *map;
+        size_t size;
+        const struct bloom_header *hdr;
+        const uint64_t *groups;
+};
+
+static uint64_t hash_word(const char *s, size_t len) {
+        uint64_t h = 0xcbf29ce484222325ULL;     /* FNV-1a */
+
+        for (size_t i = 0; i < len; i++) {
+                h ^= (uint8_t)s[i];
+                h *= 0x100000001b3ULL;
+        }
+        return h;
+}
+
+/* The filter bits of a word */
+static void word_bits(const char *word, size_t len, uint32_t bits[BLOOM_HASHES]) {
+        uint64_t h = hash_word(word, len);
+        uint32_t h1 = h, h2 = (h >> 32) | 1;
+
+        for (int i = 0; i < BLOOM_HASHES; i++)
+                bits[i] = (h1 + i * h2) % BLOOM_BITS;
+}
+
+struct bloom_part_t *bloom_part_new(void) {
+        return calloc(1, sizeof(struct bloom_part_t));
+}
+
+void bloom_part_free(struct bloom_part_t *part) {
+        if (!part) return;
+        free(part->slices);
+        free(part);
+}
+
+int bloom_part_add(struct bloom_part_t *part, const char *word, size_t len,
+                   uint64_t offset) {
+        uint64_t block = offset / BLOOM_BLOCK_SIZE;
+        uint64_t group = block / BLOOM_GROUP;
+        uint32_t bits[BLOOM_HASHES];
+
+        if (part->ngroups == 0)
+                part->first = group;
+
+        /* Offsets only grow within a chunk */
+        if (group >= part->first + part->ngroups) {
+                uint64_t n = group - part->first + 1;
+                uint64_t *slices = realloc(part->slices, n * GROUP_BYTES);
+                if (!slices) return -1;
+                memset(slices + part->ngroups * BLOOM_BITS, 0,
+                       (n - part->ngroups) * GROUP_BYTES);
+                part->slices = slices;
+                part->ngroups = n;
+        }
+
+        uint64_t *g = part->slices + (group - part->first) * BLOOM_BITS;
+        word_bits(word, len, bits);
+        for (int i = 0; i < BLOOM_HASHES; i++)
+                g[bits[i]] |= 1ULL << (block % BLOOM_GROUP);
+        return 0;
+}
+
+static int check_layout(const struct bloom_header *hdr, size_t size) {
+        return hdr->header_size == sizeof(*hdr) &&
+               hdr->block_size == BLOOM_BLOCK_SIZE && hdr->bits == BLOOM_BITS &&
+               hdr->hashes == BLOOM_HASHES &&
+               hdr->nblocks == (hdr->indexed + BLOOM_BLOCK_SIZE - 1) / BLOOM_BLOCK_SIZE &&
+               hdr->ngroups == (hdr->nblocks + BLOOM_GROUP - 1) / BLOOM_GROUP &&
+               size >= BLOOM_DATA + hdr->ngroups * GROUP_BYTES ? 0 : -1;
+}
+
+struct bloom_t *bloom_open(const char *path, const char *filename,
+                           const struct file_id_t *source, int *ret) {
+        struct bloom_t *b = NULL;
+        uint64_t guards[2];
+        struct stat st;
+        void *map;
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                *ret = INDEX_MISSING;
+                return NULL;
+        }
+
+        *ret = INDEX_CORRUPT;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < BLOOM_DATA) {
+                close(fd);
+                return NULL;
+        }
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+                return NULL;
+
+        const struct bloom_header *hdr = map;
+        if (memcmp(hdr->magic, BLOOM_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != BLOOM_VERSION || check_layout(hdr, st.st_size) != 0)
+                goto fail;
+
+        *ret = INDEX_STALE;
+        if (hdr->dev != source->dev || hdr->ino != source->ino ||
+            hdr->indexed > source->size ||
+            memcmp(hdr->word_chars, word_chars, sizeof(hdr->word_chars)) != 0)
+                goto fail;
+
+        /* Still the same bytes, only (maybe) more of them */
+        if (file_guards(filename, hdr->indexed, guards) != 0 ||
+            memcmp(guards, hdr->guards, sizeof(guards)) != 0)
+                goto fail;
+
+        b = malloc(sizeof(*b));
+        if (!b) goto fail;
+
+        b->map = map;
+        b->size = st.st_size;
+        b->hdr = hdr;
+        b->groups = (const uint64_t *)(b->map + BLOOM_DATA);
+        *ret = INDEX_OK;
+        return b;
+
+fail:
+        munmap(map, st.st_size);
+        return NULL;
+}
+
+void bloom_close(struct bloom_t *b) {
+        if (!b) return;
+        munmap((void *)b->map, b->size);
+        free(b);
+}
+
+uint64_t bloom_indexed(const struct bloom_t *b) {
+        return b->hdr->indexed;
+}
+
+uint64_t bloom_resume(const struct bloom_t *b) {
+        uint64_t indexed = b->hdr->indexed;
+
+        /* A word touching the end of what was indexed can't start earlier
+         * than this, longer words are never searched */
+        uint64_t last = indexed > MAX_WORD_LENGTH ? indexed - MAX_WORD_LENGTH : 0;
+        return last / BLOOM_BLOCK_SIZE * BLOOM_BLOCK_SIZE;
+}
+
+uint64_t bloom_candidates(const struct bloom_t *b, const char *word, size_t len,
+                          uint8_t *cand, uint64_t file_size) {
+        uint64_t nblocks = (file_size + BLOOM_BLOCK_SIZE - 1) / BLOOM_BLOCK_SIZE;
+        uint32_t bits[BLOOM_HASHES];
+        uint64_t count = 0;
+
+        /* Once the file grew, the last words indexed may have grown too */
+        uint64_t trusted = b->hdr->nblocks;
+        if (file_size > b->hdr->indexed)
+                trusted = bloom_resume(b) / BLOOM_BLOCK_SIZE;
+
+        word_bits(word, len, bits);
+        for (uint64_t blk = 0; blk < nblocks; blk++) {
+                if (blk >= trusted) {
+                        cand[blk] = 1;
+                } else {
+                        const uint64_t *g = b->groups + blk / BLOOM_GROUP * BLOOM_BITS;
+                        uint64_t mask = 1ULL << (blk % BLOOM_GROUP);
+                        int maybe = 1;
+
+                        for (int i = 0; i < BLOOM_HASHES; i++)
+                                maybe &= (g[bits[i]] & mask) != 0;
+                        cand[blk] = maybe;
+                }
+                count += cand[blk];
+        }
+        return count;
+}
+
+int bloom_write(const char *path, const char *filename, const struct bloom_t *old,
+                struct bloom_part_t **parts, int nparts,
+                const struct file_id_t *source, uint64_t from) {
+        uint64_t nblocks = (source->size + BLOOM_BLOCK_SIZE - 1) / BLOOM_BLOCK_SIZE;
+        uint64_t ngroups = (nblocks + BLOOM_GROUP - 1) / BLOOM_GROUP;
+        uint64_t from_block = from / BLOOM_BLOCK_SIZE;
+        uint64_t *buf = malloc(GROUP_BYTES);
+        char tmp[4096];
+        int fd, ok = 1;
+
+        if (!buf) return -1;
+
+        snprintf(tmp, sizeof(tmp), "%s.tmp.%d", path, (int)getpid());
+        fd = old ? open(path, O_RDWR) : open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+                free(buf);
+                return -1;
+        }
+
+        /* Only the groups from the first block scanned again change */
+        for (uint64_t g = from_block / BLOOM_GROUP; ok && g < ngroups; g++) {
+                memset(buf, 0, GROUP_BYTES);
+
+                if (old && g < old->hdr->ngroups) {
+                        uint64_t kept = from_block - g * BLOOM_GROUP;
+                        uint64_t keep = kept >= BLOOM_GROUP ? ~0ULL : (1ULL << kept) - 1;
+                        const uint64_t *prev = old->groups + g * BLOOM_BITS;
+
+                        for (uint64_t i = 0; i < BLOOM_BITS; i++)
+                                buf[i] = prev[i] & keep;
+                }
+
+                for (int p = 0; p < nparts; p++) {
+                        const struct bloom_part_t *part = parts[p];
+
+                        if (g < part->first || g >= part->first + part->ngroups)
+                                continue;
+                        const uint64_t *s = part->slices + (g - part->first) * BLOOM_BITS;
+                        for (uint64_t i = 0; i < BLOOM_BITS; i++)
+                                buf[i] |= s[i];
+                }
+
+                ok = pwrite(fd, buf, GROUP_BYTES, BLOOM_DATA + g * GROUP_BYTES) ==
+                     (ssize_t)GROUP_BYTES;
+        }
+        free(buf);
+
+        struct bloom_header hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, BLOOM_MAGIC, sizeof(hdr.magic));
+        hdr.version = BLOOM_VERSION;
+        hdr.header_size = sizeof(hdr);
+        hdr.dev = source->dev;
+        hdr.ino = source->ino;
+        memcpy(hdr.word_chars, word_chars, sizeof(hdr.word_chars));
+        hdr.block_size = BLOOM_BLOCK_SIZE;
+        hdr.bits = BLOOM_BITS;
+        hdr.hashes = BLOOM_HASHES;
+        hdr.indexed = source->size;
+        hdr.nblocks = nblocks;
+        hdr.ngroups = ngroups;
+
+        ok = ok && file_guards(filename, hdr.indexed, hdr.guards) == 0;
+
+        /* The header makes the new groups visible */
+        ok = ok && fsync(fd) == 0;
+        ok = ok && ftruncate(fd, BLOOM_DATA + ngroups * GROUP_BYTES) == 0;
+        ok = ok && pwrite(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr);
+        ok = ok && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+
+        if (!old && (!ok || rename(tmp, path) != 0)) {
+                unlink(tmp);
+                return -1;
+        }
+        return ok ? 0 : -1;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ========================== Bloom filters ==============================
+ *
+ * A cheap sidecar for big append-only logs: one Bloom filter over the
+ * words of each block of BLOOM_BLOCK_SIZE bytes. A word search only reads
+ * the blocks whose filter says the word may be there (a word belongs to
+ * the block where it starts), plus the tail of the file appended since the
+ * filters were built.
+ *
+ * The filters are stored bit-sliced by groups of 64 blocks: for every bit
+ * of the filter, a 64-bit mask of the blocks of the group having it. A
+ * lookup reads BLOOM_HASHES words per group, and growing the file only
+ * rewrites the last group and appends the new ones.
+ *
+ * As the file grows its mtime and size change, so the sidecar is tied to
+ * the device and inode of the file, to the size it covers and to a hash
+ * of the first and last bytes it covers; rewriting the file in place
+ * without touching those is not detected.
+ */
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tsearch.h"
+
+#ifndef BLOOM_BLOCK_SIZE
+#define BLOOM_BLOCK_SIZE (1 << 20)
+#endif
+#define BLOOM_BITS   (1 << 16)      /* Of each filter, about 8 KB per MB of file */
+#define BLOOM_HASHES 4
+
+struct bloom_part_t;
+struct bloom_t;
+
+/* Filters of the blocks seen by a single thread */
+struct bloom_part_t *bloom_part_new(void);
+void bloom_part_free(struct bloom_part_t *part);
+int bloom_part_add(struct bloom_part_t *part, const char *word, size_t len,
+                   uint64_t offset);
+
+/* Map the sidecar at path if it's usable for filename (identified by
+ * source), otherwise returns NULL and the reason (INDEX_*) in ret */
+struct bloom_t *bloom_open(const char *path, const char *filename,
+                           const struct file_id_t *source, int *ret);
+void bloom_close(struct bloom_t *b);
+
+/* Bytes of the file covered by the filters */
+uint64_t bloom_indexed(const struct bloom_t *b);
+
+/* Where an update has to scan from: the last words indexed may have
+ * grown since, so their block is indexed again. */
+uint64_t bloom_resume(const struct bloom_t *b);
+
+/* Set cand[b] for the blocks of the file (of file_size bytes) where the
+ * word may start, the ones not covered by the filters always are.
+ * Returns their number. */
+uint64_t bloom_candidates(const struct bloom_t *b, const char *word, size_t len,
+                          uint8_t *cand, uint64_t file_size);
+
+/* Write the filters of the parts, which cover filename from offset `from`
+ * up to source->size. With old (opened on the same path) the blocks before
+ * `from` are kept and the file is updated in place, otherwise it's
+ * written from scratch and `from` must be 0. */
+int bloom_write(const char *path, const char *filename, const struct bloom_t *old,
+                struct bloom_part_t **parts, int nparts,
+                const struct file_id_t *source, uint64_t from);
+
+#endif /* BLOOM_H */
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+
+#include "tsearch.h"
+#include "cache.h"
+
+#define CACHE_MAGIC   "TSCACHE\0"
+#define CACHE_VERSION 1
+#define CACHE_NAME_LEN 16       /* Hex digits of the hash */
+
+struct cache_entry {
+        char     magic[8];
+        uint32_t version;
+        uint32_t key_size;
+        struct cache_key_t key;
+        uint64_t occurrences;
+};
+
+void cache_key_init(struct cache_key_t *key, const struct file_id_t *source,
+                    const char *word, const struct search_opts_t *opts) {
+        /* Zeroed as a whole, padding included: keys are compared bytewise */
+        memset(key, 0, sizeof(*key));
+        key->source = *source;
+        key->mode = opts->mode;
+        key->overlapping = opts->overlapping;
+        key->max_errors = opts->max_errors;
+        key->word_len = strnlen(word, MAX_WORD_LENGTH - 1);
+        memcpy(key->word, word, key->word_len);
+        memcpy(key->word_chars, word_chars, sizeof(key->word_chars));
+}
+
+static void entry_path(const char *dir, const struct cache_key_t *key, char *buf, size_t len) {
+        const uint8_t *p = (const uint8_t *)key;
+        uint64_t h = 0xcbf29ce484222325ULL;     /* FNV-1a */
+
+        for (size_t i = 0; i < sizeof(*key); i++) {
+                h ^= p[i];
+                h *= 0x100000001b3ULL;
+        }
+        snprintf(buf, len, "%s/%016lx", dir, h);
+}
+
+int cache_lookup(const char *dir, const struct cache_key_t *key, uint64_t *occurrences) {
+        struct cache_entry entry;
+        char path[4096];
+
+        entry_path(dir, key, path, sizeof(path));
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return -1;
+        ssize_t n = read(fd, &entry, sizeof(entry));
+        close(fd);
+
+        if (n != sizeof(entry) || memcmp(entry.magic, CACHE_MAGIC, sizeof(entry.magic)) != 0 ||
+            entry.version != CACHE_VERSION || entry.key_size != sizeof(entry.key) ||
+            memcmp(&entry.key, key, sizeof(*key)) != 0)
+                return -1;
+
+        /* Most recently used */
+        utimensat(AT_FDCWD, path, NULL, 0);
+        *occurrences = entry.occurrences;
+        return 0;
+}
+
+/* Create dir and its missing parents */
+static int make_dirs(const char *dir) {
+        char path[4096];
+
+        snprintf(path, sizeof(path), "%s", dir);
+        for (char *p = path + 1; *p; p++) {
+                if (*p != '/') continue;
+                *p = '\0';
+                if (mkdir(path, 0755) != 0 && errno != EEXIST) return -1;
+                *p = '/';
+        }
+        return mkdir(path, 0755) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+struct lru_entry {
+        char name[CACHE_NAME_LEN + 1];
+        struct timespec used;
+};
+
+static int cmp_used(const void *a, const void *b) {
+        const struct lru_entry *x = a, *y = b;
+
+        if (x->used.tv_sec != y->used.tv_sec) return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+        return (x->used.tv_nsec > y->used.tv_nsec) - (x->used.tv_nsec < y->used.tv_nsec);
+}
+
+static int is_entry_name(const char *name) {
+        if (strlen(name) != CACHE_NAME_LEN) return 0;
+        return strspn(name, "0123456789abcdef") == CACHE_NAME_LEN;
+}
+
+/* Count a new entry, and past max_entries remove the least recently used
+ * ones down to CACHE_LOW_WATER of it. The lock file holds how many entries
+ * there are at most: the directory is only listed when it may be too
+ * many, not at every store. */
+static void evict(const char *dir, long max_entries) {
+        struct lru_entry *entries = NULL;
+        size_t n = 0, cap = 0;
+        uint64_t count;
+        char path[4096];
+
+        snprintf(path, sizeof(path), "%s/lock", dir);
+        int lock = open(path, O_RDWR | O_CREAT, 0644);
+        if (lock < 0) return;
+        /* Somebody else is already making room, and counts our entry
+         * if it lists it */
+        if (flock(lock, LOCK_EX | LOCK_NB) != 0) {
+                close(lock);
+                return;
+        }
+
+        /* A new lock file has no count: list the directory */
+        if (pread(lock, &count, sizeof(count), 0) == sizeof(count) &&
+            ++count <= (uint64_t)max_entries) {
+                if (pwrite(lock, &count, sizeof(count), 0) != sizeof(count))
+                        ERR("Failed to count the entries of the cache '%s'", dir);
+                goto out;
+        }
+
+        DIR *d = opendir(dir);
+        if (!d) goto out;
+
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+                struct stat st;
+
+                if (!is_entry_name(de->d_name) ||
+                    fstatat(dirfd(d), de->d_name, &st, 0) != 0)
+                        continue;
+                if (n == cap) {
+                        cap = cap ? cap * 2 : 256;
+                        struct lru_entry *p = realloc(entries, cap * sizeof(*entries));
+                        if (!p) break;
+                        entries = p;
+                }
+                memcpy(entries[n].name, de->d_name, CACHE_NAME_LEN + 1);
+                entries[n].used = st.st_mtim;
+                n++;
+        }
+        closedir(d);
+
+        if (n > (size_t)max_entries) {
+                size_t keep = CACHE_LOW_WATER(max_entries);
+
+                qsort(entries, n, sizeof(*entries), cmp_used);
+                for (size_t i = 0; i < n - keep; i++) {
+                        snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+                        unlink(path);
+                }
+                n = keep;
+        }
+        count = n;
+        if (pwrite(lock, &count, sizeof(count), 0) != sizeof(count))
+                ERR("Failed to count the entries of the cache '%s'", dir);
+
+out:
+        free(entries);
+        close(lock);
+}
+
+int cache_store(const char *dir, const struct cache_key_t *key, uint64_t occurrences,
+                long max_entries) {
+        struct cache_entry entry;
+        char path[4096];
+
+        if (make_dirs(dir) != 0) return -1;
+
+        memset(&entry, 0, sizeof(entry));
+        memcpy(entry.magic, CACHE_MAGIC, sizeof(entry.magic));
+        entry.version = CACHE_VERSION;
+        entry.key_size = sizeof(entry.key);
+        entry.key = *key;
+        entry.occurrences = occurrences;
+
+        entry_path(dir, key, path, sizeof(path));
+        struct iovec iov = { &entry, sizeof(entry) };
+        if (replace_file(path, &iov, 1) != 0) return -1;
+
+        evict(dir, max_entries);
+        return 0;
+}
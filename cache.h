@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ============================ Result cache =============================
+ *
+ * `--cache`: the result of a search is kept on disk, keyed by the identity
+ * of the file (device, inode, size, mtime) and everything that changes the
+ * count (word, mode, options, word characters), so asking again the same
+ * question about a file which didn't change doesn't read it.
+ *
+ * Every result is a small file of the cache directory named after the
+ * hash of its key, which it also holds in full. Entries are written to a
+ * temporary file and renamed, so any number of processes can read and
+ * write the cache at the same time without locks. A hit updates the
+ * mtime of its entry; when there are more entries than allowed, the least
+ * recently used ones are removed by one process at a time (under a lock
+ * on "<dir>/lock"), down to CACHE_LOW_WATER so that the next ones are a
+ * while away. The lock file also counts the entries, an upper bound, so
+ * that a store only lists the directory when it may be full.
+ */
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+#include "tsearch.h"
+
+#define CACHE_MAX_ENTRIES 4096
+#define CACHE_LOW_WATER(max) ((size_t)(max) - (size_t)(max) / 8)
+
+/* Everything the result of a search depends on */
+struct cache_key_t {
+        struct file_id_t source;
+        int32_t  mode;
+        int32_t  overlapping;
+        int32_t  max_errors;
+        uint32_t word_len;
+        char     word[MAX_WORD_LENGTH];
+        uint8_t  word_chars[256];
+};
+
+void cache_key_init(struct cache_key_t *key, const struct file_id_t *source,
+                    const char *word, const struct search_opts_t *opts);
+
+/* The occurrences stored for the key, 0 on a hit */
+int cache_lookup(const char *dir, const struct cache_key_t *key, uint64_t *occurrences);
+
+/* Store the result, then evict the least recently used entries past
+ * max_entries */
+int cache_store(const char *dir, const struct cache_key_t *key, uint64_t occurrences,
+                long max_entries);
+
+#endif /* CACHE_H */
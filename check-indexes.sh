@@ -0,0 +1,176 @@
+#!/bin/sh
+#
+# Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# Whatever answers a search (an index, the cache, the server) has to find
+# what a scan of the whole file finds: `make check` runs this with the
+# tsearch it built, `./check-indexes.sh [<tsearch>]`. Every search is run
+# once with --no-index and once the way tested, and the log has to show
+# the way tested was taken.
+
+set -f          # The words are patterns, not file names
+
+TSEARCH=${1:-./tsearch}
+THREADS=3
+dir=$(mktemp -d /tmp/tsearch-check-XXXXXX) || exit 1
+file=$dir/text
+server=
+via=            # Options of the searches tested only, not of the scans
+failures=0
+
+trap '[ -n "$server" ] && kill "$server" 2>/dev/null; rm -rf "$dir"' EXIT
+
+# Append <lines> lines of words drawn with <seed>: words within words,
+# self-overlapping ones ("abab" in "ababab"), a rare one for the FM-index
+# to locate ("xyxyx" in "xyxyxyx") and regex matches
+text() {
+        awk -v seed="$1" -v lines="$2" 'BEGIN {
+                n = split("ERROR ERR42 abab ababab aaaa foo_bar foo bar x user_id=17 ab ba", w, " ")
+                srand(seed)
+                for (i = 0; i < lines; i++) {
+                        line = w[int(rand() * n) + 1]
+                        for (k = int(rand() * 8); k > 0; k--)
+                                line = line " " w[int(rand() * n) + 1]
+                        if (rand() < 0.01)
+                                line = line " xyxyxyx"
+                        print line
+                }
+        }' >> "$file"
+}
+
+drop_indexes() {
+        set +f
+        rm -f "$file".ts*
+        set -f
+}
+
+# The occurrences printed by a search, its log in $dir/log
+count() {
+        "$TSEARCH" --json "$@" 2>"$dir/log" | sed -n 's/.*"occurrences": \([0-9]*\).*/\1/p'
+}
+
+# check <log> <options...>: the search of $word has to log <log> and count
+# as many occurrences as the scan
+check() {
+        what=$1
+        shift
+        want=$(count --no-index "$@" "$file" "$word" $THREADS)
+        got=$(count $via "$@" "$file" "$word" $THREADS)
+        if [ -z "$want" ] || [ "$got" != "$want" ]; then
+                echo "ERR: $via $* '$word': ${got:-no answer} instead of ${want:-no answer}" >&2
+                failures=$((failures + 1))
+        elif ! grep -q "$what" "$dir/log"; then
+                echo "ERR: $via $* '$word': not answered by '$what'" >&2
+                failures=$((failures + 1))
+        fi
+}
+
+WORDS="ERROR abab ababab foo xyxyxyx missing"
+SUBSTRINGS="abab aaa RRO ERR4"
+REGEXES="ERR[0-9]{2} abab(ab)*a user_id=[0-9]+"
+
+text 1 20000
+
+# Word index: built, then appended to until its segments are compacted
+"$TSEARCH" --build-index "$file" $THREADS >/dev/null || exit 1
+for word in $WORDS; do check "Answered from index"; done
+i=1
+while [ $i -lt 8 ]; do
+        text $((i + 2)) 500
+        "$TSEARCH" --update-index "$file" $THREADS >/dev/null || exit 1
+        for word in $WORDS; do check "Answered from index"; done
+        i=$((i + 1))
+done
+i=0
+while [ -e "$file.tsidx.1" ] && [ $i -lt 100 ]; do
+        sleep 0.1
+        i=$((i + 1))
+done
+[ -e "$file.tsidx.1" ] && echo "ERR: the segments of the word index weren't compacted" >&2 &&
+        failures=$((failures + 1))
+for word in $WORDS; do check "Answered from index"; done
+drop_indexes
+
+# Trigram index, for words, substrings and the literal of regexes
+"$TSEARCH" --build-index=trigrams "$file" $THREADS >/dev/null || exit 1
+for word in $WORDS; do check "Trigram index"; done
+word=x
+check "Found"
+for word in $SUBSTRINGS; do
+        check "Trigram index" --substring
+        check "Trigram index" --substring --overlapping
+done
+word=aa
+check "Found" --substring
+for word in $REGEXES; do check "Trigram index" --regex; done
+drop_indexes
+
+# Bloom filters, also with text appended after they were built
+"$TSEARCH" --build-index=bloom "$file" $THREADS >/dev/null || exit 1
+for word in $WORDS; do check "Bloom filters"; done
+text 20 500
+for word in $WORDS; do check "Bloom filters"; done
+"$TSEARCH" --build-index=bloom "$file" $THREADS >/dev/null || exit 1
+for word in $WORDS; do check "Bloom filters"; done
+drop_indexes
+
+# FM-index: the non-overlapping matches of a self-overlapping word are
+# located, unless there are too many of them
+"$TSEARCH" --build-index=fm "$file" $THREADS >/dev/null || exit 1
+for word in $SUBSTRINGS xyxyx; do check "Answered from index" --substring --overlapping; done
+for word in RRO ERR4 xyxyx; do check "Answered from index" --substring; done
+for word in abab aaa; do check "Too many matches to locate" --substring; done
+drop_indexes
+
+# Cache: stored by the first search, answered by the next ones until the
+# file changes
+via=--cache=$dir/cache
+for word in $WORDS; do
+        check "."
+        check "Answered from cache"
+done
+text 21 100
+for word in $WORDS; do check "Found"; done
+grep -q "Answered from cache" "$dir/log" &&
+        { echo "ERR: the cache answered for a file which changed" >&2; failures=$((failures + 1)); }
+
+# Server, with the word index of the file and without
+"$TSEARCH" --build-index "$file" $THREADS >/dev/null || exit 1
+"$TSEARCH" --serve="$dir/socket" 2 >"$dir/server.log" 2>&1 &
+server=$!
+i=0
+while [ ! -S "$dir/socket" ] && [ $i -lt 100 ]; do
+        sleep 0.1
+        i=$((i + 1))
+done
+via=--client=$dir/socket
+for word in $WORDS; do check "Found"; done
+for word in $SUBSTRINGS; do check "Found" --substring; done
+for word in $REGEXES; do check "Found" --regex; done
+via=--client=$dir/socket" --no-index"
+for word in $WORDS; do check "Found"; done
+kill "$server"
+wait "$server"
+server=
+# Its log is only flushed when it exits
+grep -q "Answered from index" "$dir/server.log" ||
+        { echo "ERR: the server didn't use the word index" >&2; failures=$((failures + 1)); }
+
+if [ $failures -ne 0 ]; then
+        echo "ERR: $failures searches differ from the scan of the whole file" >&2
+        exit 1
+fi
+echo "LOG: the indexes, the cache and the server agree with the scan of the whole file" >&2
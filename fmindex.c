@@ -0,0 +1,562 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ============================== FM-index ===============================
+ *
+ * The suffix array of the text, followed by a sentinel smaller than any
+ * byte, is sorted by induced sorting (SA-IS, Nong, Zhang and Chan 2009)
+ * in linear time. Its rows are then cut in blocks and the threads derive
+ * the transform, the counts and the samples of their blocks in parallel.
+ *
+ * Layout of the file (native byte order, sections 8-byte aligned):
+ *
+ *   struct fm_header
+ *   bwt          rows bytes, the sentinel's row (primary) holds a 0
+ *   checkpoints  uint32_t[256] per FM_OCC_RATE rows: the count of every
+ *                byte in the rows before, the sentinel excluded
+ *   marks        a bit per row, set if its suffix starts at a multiple
+ *                of FM_SA_RATE
+ *   rank         uint32_t per 64-bit word of marks, the bits set before
+ *   samples      uint32_t, the start of the suffix of each marked row
+ *
+ * occ(c, i), the count of c in the rows before i, is read from the
+ * nearest checkpoint and at most FM_OCC_RATE / 2 bytes of the transform.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "tsearch.h"
+#include "fmindex.h"
+
+#define FM_MAGIC   "TSFM\0\0\0\0"
+#define FM_VERSION 1
+
+/* Locating costs about FM_SA_RATE steps per match: past one match every
+ * this many bytes, scanning the file is cheaper */
+#define FM_LOCATE_RATIO 4096
+
+#if FM_OCC_RATE % 64 != 0
+#error "FM_OCC_RATE must be a multiple of 64"
+#endif
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+struct fm_header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t header_size;
+        struct file_id_t source;
+        uint64_t file_size;
+        uint64_t rows;          /* Bytes of the text, plus the sentinel */
+        uint64_t primary;       /* Row of the whole text */
+        uint64_t occ_rate;
+        uint64_t sa_rate;
+        uint64_t C[257];        /* First row of the suffixes starting with each byte */
+        uint64_t bwt;           /* Offsets and sizes of the sections */
+        uint64_t checkpoints;
+        uint64_t ncheckpoints;
+        uint64_t marks;
+        uint64_t nmarks;
+        uint64_t rank;
+        uint64_t samples;
+        uint64_t nsamples;
+};
+
+struct fm_index_t {
+        const uint8_t *map;
+        size_t size;
+        const struct fm_header *hdr;
+        const uint8_t *bwt;
+        const uint32_t (*cp)[256];
+        const uint64_t *marks;
+        const uint32_t *rank;
+        const uint32_t *samples;
+};
+
+/* ============================ Suffix sorting =========================== */
+
+/* Character i of the string being sorted: at the top level the bytes of
+ * the text shifted by one and the sentinel 0, below it the names of the
+ * reduced string */
+#define CHR(i)      (level == 0 ? ((i) == n - 1 ? 0 : (int32_t)text[i] + 1) : s[i])
+/* Type of suffix i: S (1) if it's smaller than suffix i + 1, else L */
+#define TGET(i)     ((t[(i) >> 3] >> ((i) & 7)) & 1)
+#define TSET(i)     (t[(i) >> 3] |= 1 << ((i) & 7))
+#define IS_LMS(i)   ((i) > 0 && TGET(i) && !TGET((i) - 1))
+
+static void get_buckets(const uint8_t *text, const int32_t *s, int32_t n, int level,
+                        int32_t *bkt, int32_t K, int end) {
+        int32_t sum = 0;
+
+        memset(bkt, 0, (K + 1) * sizeof(int32_t));
+        for (int32_t i = 0; i < n; i++)
+                bkt[CHR(i)]++;
+        for (int32_t i = 0; i <= K; i++) {
+                sum += bkt[i];
+                bkt[i] = end ? sum : sum - bkt[i];
+        }
+}
+
+/* Sort the L suffixes from the ones in sa, then the S suffixes */
+static void induce(const uint8_t *text, const int32_t *s, const uint8_t *t, int32_t *sa,
+                   int32_t *bkt, int32_t n, int32_t K, int level) {
+        get_buckets(text, s, n, level, bkt, K, 0);
+        for (int32_t i = 0; i < n; i++) {
+                int32_t j = sa[i] - 1;
+                if (sa[i] > 0 && !TGET(j))
+                        sa[bkt[CHR(j)]++] = j;
+        }
+
+        get_buckets(text, s, n, level, bkt, K, 1);
+        for (int32_t i = n - 1; i >= 0; i--) {
+                int32_t j = sa[i] - 1;
+                if (sa[i] > 0 && TGET(j))
+                        sa[--bkt[CHR(j)]] = j;
+        }
+}
+
+/* Sort the n suffixes of the string (text at level 0, s below, ending
+ * with its unique smallest character) over the alphabet [0, K] */
+static int sais(const uint8_t *text, const int32_t *s, int32_t *sa, int32_t n,
+                int32_t K, int level) {
+        int32_t n1 = 0, name = 0, prev = -1;
+        int ret = -1;
+
+        if (n == 1) {
+                sa[0] = 0;
+                return 0;
+        }
+
+        uint8_t *t = calloc((n + 7) / 8, 1);
+        int32_t *bkt = malloc((K + 1) * sizeof(int32_t));
+        if (!t || !bkt) goto out;
+
+        TSET(n - 1);
+        for (int32_t i = n - 3; i >= 0; i--) {
+                int32_t c0 = CHR(i), c1 = CHR(i + 1);
+                if (c0 < c1 || (c0 == c1 && TGET(i + 1)))
+                        TSET(i);
+        }
+
+        /* Sort the LMS substrings: put the LMS suffixes at the end of
+         * their buckets and induce */
+        get_buckets(text, s, n, level, bkt, K, 1);
+        for (int32_t i = 0; i < n; i++)
+                sa[i] = -1;
+        for (int32_t i = 1; i < n; i++)
+                if (IS_LMS(i)) sa[--bkt[CHR(i)]] = i;
+        induce(text, s, t, sa, bkt, n, K, level);
+
+        /* Name them by rank, equal substrings get the same name */
+        for (int32_t i = 0; i < n; i++)
+                if (IS_LMS(sa[i])) sa[n1++] = sa[i];
+        for (int32_t i = n1; i < n; i++)
+                sa[i] = -1;
+        for (int32_t i = 0; i < n1; i++) {
+                int32_t pos = sa[i];
+                int diff = 0;
+
+                for (int32_t d = 0;; d++) {
+                        if (prev == -1 || CHR(pos + d) != CHR(prev + d) ||
+                            TGET(pos + d) != TGET(prev + d)) {
+                                diff = 1;
+                                break;
+                        }
+                        if (d > 0 && (IS_LMS(pos + d) || IS_LMS(prev + d)))
+                                break;
+                }
+                if (diff) {
+                        name++;
+                        prev = pos;
+                }
+                sa[n1 + pos / 2] = name - 1;
+        }
+        for (int32_t i = n - 1, j = n - 1; i >= n1; i--)
+                if (sa[i] >= 0) sa[j--] = sa[i];
+
+        /* Sort the reduced string, recursing while names repeat */
+        int32_t *s1 = sa + n - n1, *sa1 = sa;
+        if (name < n1) {
+                if (sais(NULL, s1, sa1, n1, name - 1, level + 1) != 0)
+                        goto out;
+        } else {
+                for (int32_t i = 0; i < n1; i++)
+                        sa1[s1[i]] = i;
+        }
+
+        /* Put the sorted LMS suffixes back in their buckets and induce
+         * the whole suffix array from them */
+        get_buckets(text, s, n, level, bkt, K, 1);
+        for (int32_t i = 1, j = 0; i < n; i++)
+                if (IS_LMS(i)) s1[j++] = i;
+        for (int32_t i = 0; i < n1; i++)
+                sa1[i] = s1[sa1[i]];
+        for (int32_t i = n1; i < n; i++)
+                sa[i] = -1;
+        for (int32_t i = n1 - 1; i >= 0; i--) {
+                int32_t j = sa[i];
+                sa[i] = -1;
+                sa[--bkt[CHR(j)]] = j;
+        }
+        induce(text, s, t, sa, bkt, n, K, level);
+        ret = 0;
+
+out:
+        free(t);
+        free(bkt);
+        return ret;
+}
+
+/* =============================== Building ============================== */
+
+/* Blocks of rows [from, to) given to a thread */
+struct fm_job_t {
+        const uint8_t *text;
+        const int32_t *sa;
+        uint64_t rows;
+        uint8_t *bwt;
+        uint32_t (*cp)[256];
+        uint64_t *marks;
+        const uint32_t *rank;
+        uint32_t *samples;
+        uint64_t from, to;
+        int phase;
+};
+
+static void *build_blocks(void *arg) {
+        struct fm_job_t *job = arg;
+
+        for (uint64_t i = job->from; i < job->to; i++) {
+                int32_t pos = job->sa[i];
+
+                if (job->phase == 0) {
+                        /* The transform, the counts of each block (summed
+                         * up afterwards) and the marks */
+                        uint8_t c = pos > 0 ? job->text[pos - 1] : 0;
+                        job->bwt[i] = c;
+                        if (pos > 0)
+                                job->cp[i / FM_OCC_RATE + 1][c]++;
+                        if (pos % FM_SA_RATE == 0)
+                                job->marks[i / 64] |= (uint64_t)1 << (i % 64);
+                } else if (pos % FM_SA_RATE == 0) {
+                        uint64_t below = job->marks[i / 64] & (((uint64_t)1 << (i % 64)) - 1);
+                        job->samples[job->rank[i / 64] + __builtin_popcountll(below)] = pos;
+                }
+        }
+        return NULL;
+}
+
+/* Run a phase over all the rows, the threads taking whole blocks */
+static void run_phase(struct fm_job_t *proto, int phase, uint8_t threads) {
+        struct fm_job_t jobs[256];
+        pthread_t tids[256];
+        uint64_t nblocks = (proto->rows + FM_OCC_RATE - 1) / FM_OCC_RATE;
+
+        if (threads == 0) threads = 1;
+        for (int i = 0; i < threads; i++) {
+                jobs[i] = *proto;
+                jobs[i].phase = phase;
+                jobs[i].from = MIN(nblocks * i / threads * FM_OCC_RATE, proto->rows);
+                jobs[i].to = MIN(nblocks * (i + 1) / threads * FM_OCC_RATE, proto->rows);
+                if (pthread_create(&tids[i], NULL, build_blocks, &jobs[i]) != 0) {
+                        build_blocks(&jobs[i]);
+                        tids[i] = 0;
+                }
+        }
+        for (int i = 0; i < threads; i++)
+                if (tids[i]) pthread_join(tids[i], NULL);
+}
+
+int fm_write(const char *path, const uint8_t *text, uint64_t len,
+             const struct file_id_t *source, uint8_t threads) {
+        struct fm_header hdr;
+        struct fm_job_t job;
+        int ret = -1;
+
+        if (len > FM_MAX_SIZE) {
+                ERR("Files over %lu bytes can't have an FM-index", FM_MAX_SIZE);
+                return -1;
+        }
+
+        uint64_t rows = len + 1;
+        uint64_t ncp = (rows + FM_OCC_RATE - 1) / FM_OCC_RATE + 1;
+        uint64_t nmarks = (rows + 63) / 64;
+
+        memset(&job, 0, sizeof(job));
+        job.text = text;
+        job.rows = rows;
+        int32_t *sa = malloc(rows * sizeof(int32_t));
+        job.bwt = malloc(rows);
+        job.cp = calloc(ncp, sizeof(*job.cp));
+        job.marks = calloc(nmarks, sizeof(uint64_t));
+        uint32_t *rank = malloc(nmarks * sizeof(uint32_t));
+        job.samples = NULL;
+        if (!sa || !job.bwt || !job.cp || !job.marks || !rank) {
+                ERR("Memory allocation failed for the FM-index");
+                goto out;
+        }
+
+        if (sais(text, NULL, sa, rows, 256, 0) != 0) {
+                ERR("Memory allocation failed for the suffix array");
+                goto out;
+        }
+        job.sa = sa;
+
+        run_phase(&job, 0, threads);
+
+        memset(&hdr, 0, sizeof(hdr));
+        for (uint64_t k = 1; k < ncp; k++)
+                for (int c = 0; c < 256; c++)
+                        job.cp[k][c] += job.cp[k - 1][c];
+        hdr.C[0] = 1;
+        for (int c = 0; c < 256; c++)
+                hdr.C[c + 1] = hdr.C[c] + job.cp[ncp - 1][c];
+
+        uint64_t nsamples = 0;
+        for (uint64_t w = 0; w < nmarks; w++) {
+                rank[w] = nsamples;
+                nsamples += __builtin_popcountll(job.marks[w]);
+        }
+        job.rank = rank;
+        job.samples = malloc((nsamples ? nsamples : 1) * sizeof(uint32_t));
+        if (!job.samples) {
+                ERR("Memory allocation failed for the FM-index");
+                goto out;
+        }
+        run_phase(&job, 1, threads);
+
+        memcpy(hdr.magic, FM_MAGIC, sizeof(hdr.magic));
+        hdr.version = FM_VERSION;
+        hdr.header_size = sizeof(hdr);
+        hdr.source = *source;
+        hdr.rows = rows;
+        for (uint64_t i = 0; i < rows; i++)
+                if (sa[i] == 0) hdr.primary = i;
+        hdr.occ_rate = FM_OCC_RATE;
+        hdr.sa_rate = FM_SA_RATE;
+        hdr.bwt = sizeof(hdr);
+        hdr.checkpoints = ALIGN8(hdr.bwt + rows);
+        hdr.ncheckpoints = ncp;
+        hdr.marks = ALIGN8(hdr.checkpoints + ncp * sizeof(*job.cp));
+        hdr.nmarks = nmarks;
+        hdr.rank = hdr.marks + nmarks * sizeof(uint64_t);
+        hdr.samples = hdr.rank + nmarks * sizeof(uint32_t);
+        hdr.nsamples = nsamples;
+        hdr.file_size = hdr.samples + nsamples * sizeof(uint32_t);
+
+        static const uint8_t pad[8];
+        struct iovec iov[] = {
+                { &hdr, sizeof(hdr) },
+                { job.bwt, rows },
+                { (void *)pad, hdr.checkpoints - (hdr.bwt + rows) },
+                { job.cp, ncp * sizeof(*job.cp) },
+                { (void *)pad, hdr.marks - (hdr.checkpoints + ncp * sizeof(*job.cp)) },
+                { job.marks, nmarks * sizeof(uint64_t) },
+                { rank, nmarks * sizeof(uint32_t) },
+                { job.samples, nsamples * sizeof(uint32_t) },
+        };
+        ret = replace_file(path, iov, sizeof(iov) / sizeof(iov[0]));
+
+out:
+        free(sa);
+        free(job.bwt);
+        free(job.cp);
+        free(job.marks);
+        free(rank);
+        free(job.samples);
+        return ret;
+}
+
+/* =============================== Queries =============================== */
+
+struct fm_index_t *fm_open(const char *path, const struct file_id_t *source, int *ret) {
+        struct fm_index_t *idx = NULL;
+        struct stat st;
+        void *map;
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                *ret = INDEX_MISSING;
+                return NULL;
+        }
+
+        *ret = INDEX_CORRUPT;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct fm_header)) {
+                close(fd);
+                return NULL;
+        }
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+                return NULL;
+
+        const struct fm_header *hdr = map;
+        if (memcmp(hdr->magic, FM_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != FM_VERSION || hdr->header_size != sizeof(*hdr) ||
+            hdr->occ_rate != FM_OCC_RATE || hdr->sa_rate != FM_SA_RATE ||
+            hdr->file_size != (uint64_t)st.st_size ||
+            hdr->rows == 0 || hdr->rows > FM_MAX_SIZE + 1 || hdr->primary >= hdr->rows ||
+            hdr->C[0] != 1 || hdr->C[256] != hdr->rows || hdr->bwt != sizeof(*hdr) ||
+            hdr->checkpoints != ALIGN8(hdr->bwt + hdr->rows) ||
+            hdr->ncheckpoints != (hdr->rows + FM_OCC_RATE - 1) / FM_OCC_RATE + 1 ||
+            hdr->marks != ALIGN8(hdr->checkpoints + hdr->ncheckpoints * 256 * sizeof(uint32_t)) ||
+            hdr->nmarks != (hdr->rows + 63) / 64 ||
+            hdr->rank != hdr->marks + hdr->nmarks * sizeof(uint64_t) ||
+            hdr->samples != hdr->rank + hdr->nmarks * sizeof(uint32_t) ||
+            hdr->file_size != hdr->samples + hdr->nsamples * sizeof(uint32_t))
+                goto fail;
+
+        for (int c = 0; c < 256; c++)
+                if (hdr->C[c] > hdr->C[c + 1]) goto fail;
+
+        if (memcmp(&hdr->source, source, sizeof(*source)) != 0) {
+                *ret = INDEX_STALE;
+                goto fail;
+        }
+
+        idx = malloc(sizeof(*idx));
+        if (!idx) goto fail;
+
+        idx->map = map;
+        idx->size = st.st_size;
+        idx->hdr = hdr;
+        idx->bwt = idx->map + hdr->bwt;
+        idx->cp = (const uint32_t (*)[256])(idx->map + hdr->checkpoints);
+        idx->marks = (const uint64_t *)(idx->map + hdr->marks);
+        idx->rank = (const uint32_t *)(idx->map + hdr->rank);
+        idx->samples = (const uint32_t *)(idx->map + hdr->samples);
+        *ret = INDEX_OK;
+        return idx;
+
+fail:
+        munmap(map, st.st_size);
+        return NULL;
+}
+
+void fm_close(struct fm_index_t *idx) {
+        if (!idx) return;
+        munmap((void *)idx->map, idx->size);
+        free(idx);
+}
+
+static uint64_t count_byte(const uint8_t *p, size_t n, uint8_t c) {
+        uint64_t count = 0;
+        size_t i = 0;
+
+#if defined(__SSE2__)
+        __m128i pattern = _mm_set1_epi8(c);
+        for (; i + 16 <= n; i += 16) {
+                __m128i chunk = _mm_loadu_si128((const __m128i *)(p + i));
+                count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern)));
+        }
+#endif
+        for (; i < n; i++)
+                count += p[i] == c;
+        return count;
+}
+
+/* Count of c in the rows before row i, from the nearest checkpoint */
+static uint64_t occ(const struct fm_index_t *idx, uint8_t c, uint64_t i) {
+        uint64_t rows = idx->hdr->rows, primary = idx->hdr->primary;
+        uint64_t from = i / FM_OCC_RATE * FM_OCC_RATE, to = from + FM_OCC_RATE;
+
+        if (i - from <= FM_OCC_RATE / 2 || to > rows) {
+                uint64_t n = idx->cp[from / FM_OCC_RATE][c] + count_byte(idx->bwt + from, i - from, c);
+                return n - (c == 0 && primary >= from && primary < i);
+        }
+        uint64_t n = idx->cp[to / FM_OCC_RATE][c] - count_byte(idx->bwt + i, to - i, c);
+        return n + (c == 0 && primary >= i && primary < to);
+}
+
+/* Text position of the suffix at row, or UINT64_MAX if the index is
+ * inconsistent */
+static uint64_t locate(const struct fm_index_t *idx, uint64_t row) {
+        for (uint64_t steps = 0; steps < FM_SA_RATE && row < idx->hdr->rows; steps++) {
+                uint64_t w = row / 64, bit = (uint64_t)1 << (row % 64);
+
+                if (idx->marks[w] & bit) {
+                        uint64_t r = idx->rank[w] + __builtin_popcountll(idx->marks[w] & (bit - 1));
+                        return r < idx->hdr->nsamples ? idx->samples[r] + steps : UINT64_MAX;
+                }
+                uint8_t c = idx->bwt[row];
+                row = idx->hdr->C[c] + occ(idx, c, row);
+        }
+        return UINT64_MAX;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+        uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+        return x < y ? -1 : x > y;
+}
+
+int fm_count(const struct fm_index_t *idx, const char *word, size_t len,
+             int overlapping, uint64_t *count) {
+        const uint8_t *u = (const uint8_t *)word;
+        uint64_t lo = 0, hi = idx->hdr->rows;
+
+        /* Backward search: the rows of the suffixes starting with the
+         * longer and longer ends of the word */
+        for (size_t j = len; j > 0 && lo < hi; j--) {
+                uint8_t c = u[j - 1];
+                lo = idx->hdr->C[c] + occ(idx, c, lo);
+                hi = idx->hdr->C[c] + occ(idx, c, hi);
+        }
+        *count = lo < hi ? hi - lo : 0;
+        if (*count == 0 || overlapping)
+                return 0;
+
+        /* Matches of a word can only overlap if it starts like it ends */
+        size_t p = 1;
+        while (p < len && memcmp(word, word + p, len - p) != 0) p++;
+        if (p == len)
+                return 0;
+
+        if (*count > idx->hdr->rows / FM_LOCATE_RATIO + 1024)
+                return -1;
+
+        uint64_t *pos = malloc(*count * sizeof(uint64_t));
+        if (!pos) return -1;
+        for (uint64_t r = lo; r < hi; r++) {
+                pos[r - lo] = locate(idx, r);
+                if (pos[r - lo] == UINT64_MAX) {
+                        free(pos);
+                        return -1;
+                }
+        }
+        qsort(pos, *count, sizeof(uint64_t), cmp_u64);
+
+        /* Left to right, a match can't start inside the previous one */
+        uint64_t n = 0, next = 0;
+        for (uint64_t i = 0; i < *count; i++) {
+                if (pos[i] < next) continue;
+                n++;
+                next = pos[i] + len;
+        }
+        free(pos);
+        *count = n;
+        return 0;
+}
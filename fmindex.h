@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ============================== FM-index ===============================
+ *
+ * For corpora that don't change: the Burrows-Wheeler transform of the
+ * file, built from its suffix array, counts the occurrences of any
+ * substring with one backward search step per byte of it, whatever the
+ * size of the file, and the file itself is never read.
+ *
+ * A backward search counts overlapping occurrences. The non-overlapping
+ * count of `--substring` only differs for words overlapping themselves
+ * ("aa", "abab"...); their occurrences are then located through a sample
+ * of the suffix array and counted left to right like a scan would, as
+ * long as there are not so many that scanning is cheaper.
+ *
+ * The index takes a bit more than twice the size of the file and is tied
+ * to the identity of the file it was built from.
+ */
+#ifndef FMINDEX_H
+#define FMINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tsearch.h"
+
+#ifndef FM_OCC_RATE
+#define FM_OCC_RATE 1024    /* Rows between two checkpoints of the counts */
+#endif
+#define FM_SA_RATE  32      /* Text positions between two suffix array samples */
+#define FM_MAX_SIZE (((uint64_t)1 << 31) - 2)
+
+struct fm_index_t;
+
+/* Build the index of text[0, len) and write it to path, threads share
+ * the work after the suffix array is sorted */
+int fm_write(const char *path, const uint8_t *text, uint64_t len,
+             const struct file_id_t *source, uint8_t threads);
+
+/* Map the index at path if it's usable for the file identified by source,
+ * otherwise returns NULL and the reason (INDEX_*) in ret */
+struct fm_index_t *fm_open(const char *path, const struct file_id_t *source, int *ret);
+void fm_close(struct fm_index_t *idx);
+
+/* Occurrences of the bytes in the file, like a SEARCH_SUBSTRING scan
+ * would count them. Returns -1 if the non-overlapping count would need
+ * to locate too many of them. */
+int fm_count(const struct fm_index_t *idx, const char *word, size_t len,
+             int overlapping, uint64_t *count);
+
+#endif /* FMINDEX_H */
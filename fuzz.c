@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ======================= Differential fuzzing ==========================
+ *
+ * A faster kernel is only worth it if the counts don't depend on how the
+ * file was cut: this checks tsearch() at several thread counts against a
+ * reference count of the whole text at once: a naive loop for word and
+ * substring searches, the POSIX regexec() of the C library for regex
+ * searches (leftmost-longest as well, one match after the other) and the
+ * kernel run on the whole buffer (see tsearch_matcher_new()) for fuzzy
+ * and wildcard searches.
+ *
+ * The texts are made of few distinct bytes so that partial matches are
+ * everywhere, and copies of the word are placed across the chunk
+ * boundaries of the thread counts tried and across the blocks that
+ * search_chunk() reads. Building with a small -DBUFFER_SIZE (see the
+ * `check` target of the Makefile) multiplies the block boundaries.
+ *
+ * Two ways to run it:
+ *
+ *   - `make check` builds it for a few buffer sizes and runs the
+ *     randomized test: `./tsearch-fuzz-<n> [--iterations=<n>] [--seed=<n>]`
+ *     stops at the first difference, with what is needed to reproduce it,
+ *     and keeps the input file;
+ *   - with -DTSEARCH_LIBFUZZER and -fsanitize=fuzzer (`make fuzz`, needs
+ *     clang) it's a libFuzzer target: the first bytes of the input choose
+ *     the mode, the thread count and the word, the rest is the text, and
+ *     a difference aborts.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <regex.h>
+
+#include "tsearch.h"
+#include "fuzzy.h"
+
+/* The engines compared, with what their words are made of */
+enum fuzz_mode {
+        FUZZ_WORD,
+        FUZZ_SUBSTRING,
+        FUZZ_OVERLAPPING,
+        FUZZ_REGEX,
+        FUZZ_FUZZY,
+        FUZZ_WILDCARD,
+        FUZZ_NMODES
+};
+
+static const char *mode_names[FUZZ_NMODES] = {
+        "word", "substring", "overlapping", "regex", "fuzzy", "wildcard",
+};
+
+struct fuzz_case {
+        enum fuzz_mode mode;
+        int max_errors;
+        char word[MAX_WORD_LENGTH];
+        const char *text;
+        size_t len;
+};
+
+static char path[] = "/tmp/tsearch-fuzz-XXXXXX";
+
+static struct search_opts_t case_opts(const struct fuzz_case *c) {
+        static const enum search_mode_t modes[FUZZ_NMODES] = {
+                SEARCH_WORD, SEARCH_SUBSTRING, SEARCH_SUBSTRING,
+                SEARCH_REGEX, SEARCH_FUZZY, SEARCH_WILDCARD,
+        };
+        struct search_opts_t opts = {
+                .mode = modes[c->mode],
+                .overlapping = c->mode == FUZZ_OVERLAPPING,
+                .max_errors = c->max_errors,
+        };
+        return opts;
+}
+
+/* The count of the whole text at once, -1 if the word isn't valid for
+ * the mode (a regex that doesn't compile...) */
+static int64_t reference_count(const struct fuzz_case *c) {
+        const char *t = c->text, *w = c->word;
+        size_t n = c->len, m = strlen(w);
+        int64_t count = 0;
+
+        switch (c->mode) {
+        case FUZZ_WORD:
+                for (size_t i = 0; i + m <= n; i++) {
+                        if (memcmp(t + i, w, m) == 0 &&
+                            (i == 0 || !IS_WORD_CHAR(t[i - 1])) &&
+                            (i + m == n || !IS_WORD_CHAR(t[i + m])))
+                                count++;
+                }
+                return count;
+        case FUZZ_SUBSTRING:
+        case FUZZ_OVERLAPPING:
+                for (size_t i = 0; i + m <= n; i++) {
+                        if (memcmp(t + i, w, m) != 0) continue;
+                        count++;
+                        if (c->mode == FUZZ_SUBSTRING) i += m - 1;
+                }
+                return count;
+        case FUZZ_REGEX: {
+                struct search_opts_t opts = case_opts(c);
+                struct tsearch_matcher_t *matcher = tsearch_matcher_new(w, &opts);
+                regex_t re;
+                regmatch_t match;
+
+                /* Only the patterns tsearch accepts */
+                if (!matcher) return -1;
+                tsearch_matcher_free(matcher);
+                if (regcomp(&re, w, REG_EXTENDED | REG_NEWLINE) != 0) return -1;
+                /* The text isn't NUL terminated: REG_STARTEND, and ^ still
+                 * sees the byte before rm_so */
+                for (size_t i = 0; i < n; count++) {
+                        match.rm_so = i;
+                        match.rm_eo = n;
+                        if (regexec(&re, t, 1, &match, REG_STARTEND) != 0) break;
+                        i = match.rm_eo > match.rm_so ? match.rm_eo : match.rm_eo + 1;
+                }
+                regfree(&re);
+                return count;
+        }
+        default: {
+                struct search_opts_t opts = case_opts(c);
+                struct tsearch_matcher_t *matcher = tsearch_matcher_new(w, &opts);
+                if (!matcher) return -1;
+                count = tsearch_matcher_count(matcher, t, n);
+                tsearch_matcher_free(matcher);
+                return count;
+        }
+        }
+}
+
+static int write_text(const char *text, size_t len) {
+        FILE *fp = fopen(path, "w");
+        if (!fp) return -1;
+        size_t n = fwrite(text, 1, len, fp);
+        if (fclose(fp) != 0 || n != len) return -1;
+        return 0;
+}
+
+/* Compare every thread count with the reference. Returns the first thread
+ * count giving another count, 0 if they all agree, -1 if the case can't
+ * be run. */
+static int check_case(const struct fuzz_case *c, const int *threads, int nthreads,
+                      int64_t *expected, int64_t *got) {
+        struct search_opts_t opts = case_opts(c);
+
+        *expected = reference_count(c);
+        if (*expected < 0) return -1;
+        if (write_text(c->text, c->len) != 0) {
+                ERR("Failed to write '%s': %s", path, strerror(errno));
+                return -1;
+        }
+
+        for (int i = 0; i < nthreads; i++) {
+                char word[MAX_WORD_LENGTH];
+
+                memcpy(word, c->word, sizeof(word));
+                struct search_result_t *res = tsearch(path, word, &opts, threads[i]);
+                *got = res ? (int64_t)res->occurrences : -1;
+                free(res);
+                if (*got != *expected) return threads[i];
+        }
+        return 0;
+}
+
+static void setup(void) {
+        int fd = mkstemp(path);
+        if (fd < 0) {
+                ERR("Failed to create a temporary file: %s", strerror(errno));
+                exit(1);
+        }
+        close(fd);
+        word_chars_init(NULL);
+        /* Only the differences are of interest */
+        if (!freopen("/dev/null", "w", stdout)) exit(1);
+}
+
+#ifdef TSEARCH_LIBFUZZER
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+        (void)argc;
+        (void)argv;
+        setup();
+        return 0;
+}
+
+/* data: mode, thread count, word length, the word, then the text */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+        struct fuzz_case c = { .mode = FUZZ_WORD };
+
+        if (size < 3) return 0;
+        c.mode = data[0] % FUZZ_NMODES;
+        c.max_errors = data[0] / FUZZ_NMODES % 3;
+        int threads[2] = { 1, 1 + data[1] % 255 };
+        size_t m = MIN((size_t)data[2] % MAX_WORD_LENGTH, size - 3);
+        if (m == 0) return 0;
+
+        memcpy(c.word, data + 3, m);
+        c.word[m] = '\0';
+        if (strlen(c.word) != m) return 0;      /* No NUL in words */
+        if (c.mode == FUZZ_FUZZY && (m > FUZZY_MAX_WORD || (size_t)c.max_errors >= m))
+                return 0;
+        c.text = (const char *)data + 3 + m;
+        c.len = size - 3 - m;
+
+        int64_t expected, got;
+        if (check_case(&c, threads, 2, &expected, &got) > 0) {
+                fprintf(stderr, "%s search of '%s': %ld expected, %ld with %d threads\n",
+                        mode_names[c.mode], c.word, (long)expected, (long)got, threads[1]);
+                abort();
+        }
+        return 0;
+}
+
+#else
+
+static uint64_t rng_state;
+
+/* xorshift64* */
+static uint64_t rng(void) {
+        rng_state ^= rng_state >> 12;
+        rng_state ^= rng_state << 25;
+        rng_state ^= rng_state >> 27;
+        return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void random_string(char *s, int len, const char *alphabet) {
+        size_t n = strlen(alphabet);
+        for (int i = 0; i < len; i++)
+                s[i] = alphabet[rng() % n];
+        s[len] = '\0';
+}
+
+/* A pattern of the mode, from pieces over the same few bytes as the text */
+static void random_word(struct fuzz_case *c) {
+        static const char *regex_pieces[] = {
+                "a", "b", "ab", "[ab]", "a+", "(a|b)", ".", "b{2}", "^a", "b$", "b*", "a?",
+        };
+        static const char *wildcard_pieces[] = { "a", "b", "ab", "*", "?", "[ab]", "[!a]" };
+        int len = rng() % 8 == 0 ? 1 + rng() % (MAX_WORD_LENGTH - 1) : 1 + rng() % 6;
+
+        switch (c->mode) {
+        case FUZZ_REGEX:
+        case FUZZ_WILDCARD: {
+                const char **pieces = c->mode == FUZZ_REGEX ? regex_pieces : wildcard_pieces;
+                int npieces = c->mode == FUZZ_REGEX ? 12 : 7;
+                int n = 1 + rng() % 4;
+
+                /* The first piece of a regex can't be empty: the engine
+                 * refuses patterns matching the empty string */
+                strcpy(c->word, pieces[rng() % (npieces - 2)]);
+                for (int i = 1; i < n; i++)
+                        strcat(c->word, pieces[rng() % npieces]);
+                return;
+        }
+        case FUZZ_FUZZY:
+                len = 2 + rng() % 7;
+                c->max_errors = rng() % MIN(len, 3);
+                random_string(c->word, len, "ab");
+                return;
+        default:
+                /* Mostly words, sometimes with a non-word byte inside */
+                random_string(c->word, len, rng() % 4 ? "ab" : "ab ");
+                return;
+        }
+}
+
+/* Place copies of the literal bytes of the word around the offsets where
+ * the threads' chunks and search_chunk()'s blocks start */
+static void place_words(char *text, size_t len, const char *word,
+                        const int *threads, int nthreads) {
+        size_t m = strlen(word);
+        size_t block = BUFFER_SIZE + 2 * MAX_WORD_LENGTH;
+
+        if (m == 0 || m >= len) return;
+        for (int i = 0; i < nthreads; i++) {
+                size_t chunk = len / threads[i];
+                for (int k = 1; k < threads[i] && chunk > 0; k++) {
+                        size_t at = k * chunk;
+                        for (size_t b = at; b < MIN(at + chunk, len); b += block) {
+                                size_t back = rng() % (m + 1);
+                                size_t pos = b > back ? b - back : 0;
+                                if (pos + m <= len)
+                                        memcpy(text + pos, word, m);
+                        }
+                }
+        }
+}
+
+/* One random case, 0 if every thread count agrees */
+static int random_case(long iteration, char *text, size_t max_len) {
+        static const char *alphabets[] = { "ab ", "ab \n", "aab", "ab_ .\n" };
+        struct fuzz_case c = { .mode = rng() % FUZZ_NMODES };
+        int threads[6] = { 1 };
+        int nthreads = 1;
+
+        random_word(&c);
+        c.len = rng() % 4 == 0 ? rng() % 64 : rng() % max_len;
+        random_string(text, c.len, alphabets[rng() % 4]);
+        c.text = text;
+
+        while (nthreads < 5)
+                threads[nthreads++] = 2 + rng() % 15;
+        threads[nthreads++] = rng() % 16 == 0 ? 255 : 16 + rng() % 48;
+        /* Patterns aren't text to copy, their matches are dense enough */
+        if (c.mode != FUZZ_REGEX && c.mode != FUZZ_WILDCARD)
+                place_words(text, c.len, c.word, threads, nthreads);
+
+        int64_t expected, got;
+        int bad = check_case(&c, threads, nthreads, &expected, &got);
+        if (bad <= 0) return 0;
+
+        ERR("Iteration %ld: %s search of '%s' (max errors %d) in %zu bytes: "
+            "%ld expected, %ld with %d threads",
+            iteration, mode_names[c.mode], c.word, c.max_errors, c.len,
+            (long)expected, (long)got, bad);
+        ERR("The text is in '%s'", path);
+        return 1;
+}
+
+int main(int argc, char **argv) {
+        static const struct option long_options[] = {
+                { "iterations", required_argument, NULL, 'i' },
+                { "seed", required_argument, NULL, 's' },
+                { NULL, 0, NULL, 0 }
+        };
+        long iterations = 2000, seed = 1;
+        int opt;
+
+        while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+                char *e;
+                errno = 0;
+                long v = strtol(optarg ? optarg : "", &e, 10);
+                if (opt == '?' || errno || *e != '\0' || v < 0) {
+                        ERR("Usage: %s [--iterations=<n>] [--seed=<n>]", argv[0]);
+                        return 1;
+                }
+                if (opt == 'i') iterations = v;
+                else seed = v;
+        }
+
+        /* Several blocks per chunk, whatever BUFFER_SIZE */
+        size_t max_len = MAX(8 * (BUFFER_SIZE + 2 * MAX_WORD_LENGTH), 4096);
+        char *text = malloc(max_len);
+        if (!text) return 1;
+
+        setup();
+        rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+        for (long i = 0; i < iterations; i++) {
+                if (random_case(i, text, max_len) != 0) {
+                        ERR("Run again with --seed=%ld", seed);
+                        free(text);
+                        return 1;
+                }
+        }
+        unlink(path);
+        free(text);
+        fprintf(stderr, "LOG: %ld cases agree at every thread count (BUFFER_SIZE %d, seed %ld)\n",
+                iterations, BUFFER_SIZE, seed);
+        return 0;
+}
+
+#endif /* TSEARCH_LIBFUZZER */
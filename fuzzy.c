@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ======================= Approximate matching ==========================
+ *
+ * Two passes of Myers' algorithm find a match:
+ *
+ *   - A forward pass in search mode (a match may start anywhere) gives,
+ *     at every end j, the smallest distance of a span ending at j. It
+ *     only runs around the word ends worth checking.
+ *   - When that is <= k, a backward pass with the reversed word, anchored
+ *     at j, walks the possible starts and looks for one at the beginning
+ *     of a word within k edits.
+ *
+ * A span with at most k edits is at most m + k bytes long, which bounds
+ * both the warm-up of the forward pass and the backward walk.
+ *
+ * Pigeonhole prefilter: if the word is split into k + 1 pieces, k edits
+ * can't touch all of them, so every match contains one piece unchanged.
+ * When the pieces are long enough they are searched with the SIMD literal
+ * search and only the ends near a hit are checked.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "tsearch.h"
+#include "fuzzy.h"
+
+struct piece {
+        int off;
+        int len;
+};
+
+struct fuzzy_t {
+        int m;                          /* Word length */
+        int k;                          /* Errors allowed */
+        char word[FUZZY_MAX_WORD];
+        uint64_t high;                  /* Bit of the last row */
+        uint64_t peq[256];              /* Bit i set if word[i] == c */
+        uint64_t peq_rev[256];          /* Same for the reversed word */
+        int npieces;
+        struct piece pieces[FUZZY_MAX_WORD];
+        uint8_t *marks;                 /* Candidate ends of the current call */
+        size_t marks_cap;
+};
+
+struct fuzzy_t *fuzzy_new(const char *word, int word_len, int max_errors,
+                          char *err, size_t err_len) {
+        if (word_len > FUZZY_MAX_WORD) {
+                snprintf(err, err_len, "approximate matching supports words up to %d bytes",
+                         FUZZY_MAX_WORD);
+                return NULL;
+        }
+        if (max_errors < 0 || max_errors >= word_len) {
+                snprintf(err, err_len, "the errors allowed must be less than the word length");
+                return NULL;
+        }
+
+        struct fuzzy_t *f = calloc(1, sizeof(*f));
+        if (!f) {
+                snprintf(err, err_len, "out of memory");
+                return NULL;
+        }
+
+        f->m = word_len;
+        f->k = max_errors;
+        memcpy(f->word, word, word_len);
+        f->high = 1ULL << (word_len - 1);
+        for (int i = 0; i < word_len; i++) {
+                f->peq[(uint8_t)word[i]] |= 1ULL << i;
+                f->peq_rev[(uint8_t)word[word_len - 1 - i]] |= 1ULL << i;
+        }
+
+        /* k + 1 pieces as even as possible */
+        int n = max_errors + 1;
+        if (word_len / n >= FUZZY_MIN_PIECE) {
+                f->npieces = n;
+                for (int i = 0; i < n; i++) {
+                        f->pieces[i].off = i * word_len / n;
+                        f->pieces[i].len = (i + 1) * word_len / n - f->pieces[i].off;
+                }
+        }
+        return f;
+}
+
+void fuzzy_free(struct fuzzy_t *f) {
+        if (!f) return;
+        free(f->marks);
+        free(f);
+}
+
+size_t fuzzy_lookbehind(const struct fuzzy_t *f) {
+        return f->m + f->k + 1;
+}
+
+int fuzzy_pieces(const struct fuzzy_t *f) {
+        return f->npieces;
+}
+
+/* One column of Myers' algorithm, returns the change of the last row.
+ * `anchored` is 1 when the match must start at the first byte given
+ * (the top row grows by one per byte), 0 when it can start anywhere. */
+static inline int myers_step(uint64_t eq, uint64_t *pv, uint64_t *mv,
+                             uint64_t high, uint64_t anchored) {
+        uint64_t xv = eq | *mv;
+        uint64_t xh = (((eq & *pv) + *pv) ^ *pv) | eq;
+        uint64_t ph = *mv | ~(xh | *pv);
+        uint64_t mh = *pv & xh;
+        int delta = (ph & high) ? 1 : (mh & high) ? -1 : 0;
+
+        ph = (ph << 1) | anchored;
+        mh <<= 1;
+        *pv = mh | ~(xv | ph);
+        *mv = ph & xv;
+        return delta;
+}
+
+/* Is there a word start s, with text[s..j] within k edits of the word? */
+static int has_start(const struct fuzzy_t *f, const char *text, size_t j, int bof) {
+        uint64_t pv = ~0ULL, mv = 0;
+        int score = f->m;
+        size_t span = MIN(j + 1, (size_t)(f->m + f->k));
+
+        for (size_t i = 0; i < span; i++) {
+                size_t s = j - i;
+                score += myers_step(f->peq_rev[(uint8_t)text[s]], &pv, &mv, f->high, 1);
+                if (score <= f->k && IS_WORD_CHAR(text[s]) &&
+                    (s > 0 ? !IS_WORD_CHAR(text[s - 1]) : bof))
+                        return 1;
+        }
+        return 0;
+}
+
+/* Mark the ends in [from, to) that a piece hit makes possible */
+static int mark_candidates(struct fuzzy_t *f, const char *text, size_t len,
+                           size_t from, size_t to) {
+        size_t span = f->m + f->k;
+
+        if (f->marks_cap < to - from) {
+                uint8_t *marks = realloc(f->marks, to - from);
+                if (!marks) return -1;
+                f->marks = marks;
+                f->marks_cap = to - from;
+        }
+        memset(f->marks, 0, to - from);
+
+        /* A piece of a match ending in [from, to) lies in this range */
+        size_t lo = from > span ? from - span : 0;
+        size_t hi = MIN(len, to + f->m);
+
+        for (int q = 0; q < f->npieces; q++) {
+                const struct piece *pc = &f->pieces[q];
+                const char *p = text + lo;
+                const char *hit;
+
+                while ((hit = find_substring(p, text + hi - p, f->word + pc->off, pc->len))) {
+                        /* word[off] is at hit, so the match ends about m - off
+                         * bytes later, give or take k */
+                        long end = (hit - text) + f->m - pc->off - 1;
+                        long a = MAX(end - f->k, (long)from);
+                        long b = MIN(end + f->k, (long)to - 1);
+                        if (a <= b)
+                                memset(f->marks + (a - from), 1, b - a + 1);
+                        p = hit + 1;
+                }
+        }
+        return 0;
+}
+
+uint64_t fuzzy_count(struct fuzzy_t *f, const char *text, size_t len,
+                     size_t from, size_t to, int bof) {
+        size_t span = f->m + f->k;
+        uint64_t count = 0;
+        uint64_t pv = 0, mv = 0;
+        int score = 0;
+        size_t next = 0;    /* Next byte of the forward pass, 0: not started */
+        int prefilter = f->npieces > 0;
+
+        if (to <= from)
+                return 0;
+        if (prefilter && mark_candidates(f, text, len, from, to) != 0)
+                prefilter = 0;
+
+        for (size_t j = from; j < to; j++) {
+                if (prefilter && !f->marks[j - from])
+                        continue;
+
+                /* Only word ends */
+                if (!IS_WORD_CHAR(text[j]) || (j + 1 < len && IS_WORD_CHAR(text[j + 1])))
+                        continue;
+
+                /* Restart the forward pass if it's too far behind: spans
+                 * longer than m + k can't be within k edits anyway */
+                size_t start = j + 1 > span ? j + 1 - span : 0;
+                if (next == 0 || next < start) {
+                        pv = ~0ULL;
+                        mv = 0;
+                        score = f->m;
+                        next = start;
+                }
+                for (; next <= j; next++)
+                        score += myers_step(f->peq[(uint8_t)text[next]], &pv, &mv, f->high, 0);
+
+                if (score <= f->k && has_start(f, text, j, bof))
+                        count++;
+        }
+        return count;
+}
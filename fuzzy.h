@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ======================= Approximate matching ==========================
+ *
+ * Counts the places where the word appears with at most k edits
+ * (insertions, deletions, substitutions), using Myers' bit-parallel edit
+ * distance: the whole column of the dynamic programming matrix fits in a
+ * 64-bit integer and is updated with a handful of logic operations per
+ * byte of text.
+ *
+ * The matched span must respect word boundaries: it has to start at the
+ * beginning of a word and end at the end of a word (according to
+ * word_chars). A match is counted once per word end, so "helo" with k = 1
+ * is found in "hello", "help" and "helo" but not in "helloworld".
+ */
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest word, the pattern must fit in a machine word */
+#define FUZZY_MAX_WORD 64
+
+/* Shortest piece of the word worth a pigeonhole prefilter */
+#define FUZZY_MIN_PIECE 3
+
+struct fuzzy_t;
+
+/* On error returns NULL and writes a message to err */
+struct fuzzy_t *fuzzy_new(const char *word, int word_len, int max_errors,
+                          char *err, size_t err_len);
+void fuzzy_free(struct fuzzy_t *f);
+
+/* Bytes of context needed before the first end to check */
+size_t fuzzy_lookbehind(const struct fuzzy_t *f);
+
+/* Number of exact pieces used by the prefilter, 0 if the whole text is
+ * scanned (when the pieces would be too short to be selective). */
+int fuzzy_pieces(const struct fuzzy_t *f);
+
+/* Count the matches ending in text[from, to).
+ *
+ * text[to] must be in the buffer unless the text ends the file, and
+ * fuzzy_lookbehind() bytes before `from` too unless `bof` is set (the
+ * buffer starts at the beginning of the file). */
+uint64_t fuzzy_count(struct fuzzy_t *f, const char *text, size_t len,
+                     size_t from, size_t to, int bof);
+
+#endif /* FUZZY_H */
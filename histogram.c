@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "tsearch.h"
+#include "histogram.h"
+
+struct hist_term {
+        size_t   str;       /* Offset in the arena */
+        uint32_t len;
+        uint64_t count;
+        uint64_t hash;
+};
+
+struct histogram_t {
+        uint32_t *slots;    /* Term id + 1, 0 if empty */
+        uint32_t nslots;
+        struct hist_term *terms;
+        size_t nterms, terms_cap;
+        char *arena;
+        size_t arena_len, arena_cap;
+        uint64_t words;
+};
+
+static uint64_t hash_word(const char *s, size_t len) {
+        uint64_t h = 0xcbf29ce484222325ULL;     /* FNV-1a */
+
+        for (size_t i = 0; i < len; i++) {
+                h ^= (uint8_t)s[i];
+                h *= 0x100000001b3ULL;
+        }
+        return h;
+}
+
+static int grow(void **p, size_t *cap, size_t need, size_t size) {
+        if (need <= *cap) return 0;
+
+        size_t n = *cap ? *cap : 64;
+        while (n < need) n *= 2;
+        void *q = realloc(*p, n * size);
+        if (!q) return -1;
+        *p = q;
+        *cap = n;
+        return 0;
+}
+
+struct histogram_t *histogram_new(void) {
+        struct histogram_t *h = calloc(1, sizeof(*h));
+        if (!h) return NULL;
+
+        h->nslots = 1024;
+        h->slots = calloc(h->nslots, sizeof(uint32_t));
+        if (!h->slots) {
+                free(h);
+                return NULL;
+        }
+        return h;
+}
+
+void histogram_free(struct histogram_t *h) {
+        if (!h) return;
+        free(h->slots);
+        free(h->terms);
+        free(h->arena);
+        free(h);
+}
+
+/* Double the table once it's half full */
+static int rehash(struct histogram_t *h) {
+        uint32_t n = h->nslots * 2;
+        uint32_t *slots = calloc(n, sizeof(uint32_t));
+        if (!slots) return -1;
+
+        for (size_t t = 0; t < h->nterms; t++) {
+                uint32_t i = h->terms[t].hash & (n - 1);
+                while (slots[i]) i = (i + 1) & (n - 1);
+                slots[i] = t + 1;
+        }
+        free(h->slots);
+        h->slots = slots;
+        h->nslots = n;
+        return 0;
+}
+
+static int add_count(struct histogram_t *h, const char *word, size_t len,
+                     uint64_t hash, uint64_t count) {
+        uint32_t i = hash & (h->nslots - 1);
+        size_t t;
+
+        for (;;) {
+                if (!h->slots[i]) break;
+                t = h->slots[i] - 1;
+                if (h->terms[t].hash == hash && h->terms[t].len == len &&
+                    memcmp(h->arena + h->terms[t].str, word, len) == 0)
+                        goto found;
+                i = (i + 1) & (h->nslots - 1);
+        }
+
+        /* New word */
+        if (h->nterms >= UINT32_MAX / 2 ||
+            grow((void **)&h->terms, &h->terms_cap, h->nterms + 1, sizeof(struct hist_term)) != 0 ||
+            grow((void **)&h->arena, &h->arena_cap, h->arena_len + len, 1) != 0)
+                return -1;
+
+        t = h->nterms++;
+        h->terms[t] = (struct hist_term) {
+                .str = h->arena_len, .len = len, .count = 0, .hash = hash,
+        };
+        memcpy(h->arena + h->arena_len, word, len);
+        h->arena_len += len;
+        h->slots[i] = t + 1;
+
+        if (h->nterms * 2 > h->nslots && rehash(h) != 0)
+                return -1;
+
+found:
+        h->terms[t].count += count;
+        h->words += count;
+        return 0;
+}
+
+int histogram_add(struct histogram_t *h, const char *word, size_t len) {
+        return add_count(h, word, len, hash_word(word, len), 1);
+}
+
+/* Most frequent first, then by bytes, so the output doesn't depend on
+ * the number of threads */
+static int cmp_entry(const void *a, const void *b) {
+        const struct histogram_entry_t *x = a, *y = b;
+
+        if (x->count != y->count) return x->count > y->count ? -1 : 1;
+        int c = memcmp(x->word, y->word, MIN(x->len, y->len));
+        if (c) return c;
+        return x->len < y->len ? -1 : x->len > y->len;
+}
+
+/* A partition of the words, merged by one thread */
+struct merge_job_t {
+        struct histogram_t **parts;
+        int nparts;
+        int partition, npartitions;
+        size_t k;
+        struct histogram_t *merged;
+        struct histogram_entry_t *top;  /* Its k most frequent words */
+        size_t ntop;
+        int failed;
+};
+
+/* Keep the k most frequent words in a heap, the least frequent on top */
+static void heap_push(struct histogram_entry_t *heap, size_t *n, size_t k,
+                      struct histogram_entry_t e) {
+        size_t i;
+
+        if (*n == k) {
+                if (cmp_entry(&e, &heap[0]) >= 0) return;
+                i = 0;
+                /* Replace the top and sift it down */
+                for (;;) {
+                        size_t c = 2 * i + 1;
+                        if (c >= *n) break;
+                        if (c + 1 < *n && cmp_entry(&heap[c + 1], &heap[c]) > 0) c++;
+                        if (cmp_entry(&heap[c], &e) <= 0) break;
+                        heap[i] = heap[c];
+                        i = c;
+                }
+                heap[i] = e;
+                return;
+        }
+
+        i = (*n)++;
+        while (i > 0 && cmp_entry(&heap[(i - 1) / 2], &e) < 0) {
+                heap[i] = heap[(i - 1) / 2];
+                i = (i - 1) / 2;
+        }
+        heap[i] = e;
+}
+
+static void *merge_partition(void *arg) {
+        struct merge_job_t *job = arg;
+        struct histogram_t *m = job->merged;
+
+        for (int p = 0; p < job->nparts; p++) {
+                const struct histogram_t *h = job->parts[p];
+                for (size_t t = 0; t < h->nterms; t++) {
+                        const struct hist_term *term = &h->terms[t];
+                        if ((term->hash >> 32) % job->npartitions != (uint64_t)job->partition)
+                                continue;
+                        if (add_count(m, h->arena + term->str, term->len, term->hash,
+                                      term->count) != 0) {
+                                job->failed = 1;
+                                return NULL;
+                        }
+                }
+        }
+
+        for (size_t t = 0; t < m->nterms; t++) {
+                struct histogram_entry_t e = {
+                        .word = m->arena + m->terms[t].str,
+                        .len = m->terms[t].len,
+                        .count = m->terms[t].count,
+                };
+                heap_push(job->top, &job->ntop, job->k, e);
+        }
+        return NULL;
+}
+
+struct histogram_top_t *histogram_top(struct histogram_t **parts, int nparts,
+                                      int threads, size_t k) {
+        struct merge_job_t *jobs = NULL;
+        pthread_t *tids = NULL;
+        int failed = 0;
+
+        if (threads < 1) threads = 1;
+        if (k == 0) k = 1;
+
+        struct histogram_top_t *top = calloc(1, sizeof(*top));
+        if (!top) return NULL;
+        top->merged = calloc(threads, sizeof(*top->merged));
+        top->entries = malloc(threads * k * sizeof(*top->entries));
+        jobs = calloc(threads, sizeof(*jobs));
+        tids = calloc(threads, sizeof(*tids));
+        if (!top->merged || !top->entries || !jobs || !tids)
+                goto fail;
+        top->nmerged = threads;
+
+        for (int i = 0; i < threads; i++) {
+                top->merged[i] = histogram_new();
+                if (!top->merged[i]) goto fail;
+                jobs[i] = (struct merge_job_t) {
+                        .parts = parts, .nparts = nparts,
+                        .partition = i, .npartitions = threads,
+                        .k = k, .merged = top->merged[i],
+                        .top = top->entries + i * k,
+                };
+        }
+
+        for (int i = 0; i < threads; i++) {
+                if (pthread_create(&tids[i], NULL, merge_partition, &jobs[i]) != 0) {
+                        merge_partition(&jobs[i]);
+                        tids[i] = 0;
+                }
+        }
+        for (int i = 0; i < threads; i++) {
+                if (tids[i]) pthread_join(tids[i], NULL);
+                failed |= jobs[i].failed;
+        }
+        if (failed) goto fail;
+
+        /* The top k of the partitions, packed and sorted */
+        for (int i = 0; i < threads; i++) {
+                memmove(top->entries + top->n, jobs[i].top, jobs[i].ntop * sizeof(*top->entries));
+                top->n += jobs[i].ntop;
+                top->words += top->merged[i]->words;
+                top->distinct += top->merged[i]->nterms;
+        }
+        qsort(top->entries, top->n, sizeof(*top->entries), cmp_entry);
+        top->n = MIN(top->n, k);
+
+        free(jobs);
+        free(tids);
+        return top;
+
+fail:
+        free(jobs);
+        free(tids);
+        histogram_top_free(top);
+        return NULL;
+}
+
+void histogram_top_free(struct histogram_top_t *top) {
+        if (!top) return;
+        for (int i = 0; i < top->nmerged; i++)
+                histogram_free(top->merged[i]);
+        free(top->merged);
+        free(top->entries);
+        free(top);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ========================== Word histogram =============================
+ *
+ * Counts every word of the file (`--histogram`). Each thread counts the
+ * words starting in its chunk in its own open addressing table, the
+ * words themselves being stored in an arena, so nothing is shared or
+ * locked while scanning.
+ *
+ * The tables are then merged in parallel: the words are split in
+ * partitions by hash, a thread merges one partition of every table and
+ * keeps its k most frequent words, and the partitions' top k are merged
+ * into the final one.
+ */
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct histogram_t;
+
+/* A word and its count, pointing into the tables */
+struct histogram_entry_t {
+        const char *word;
+        uint32_t len;
+        uint64_t count;
+};
+
+/* The k most frequent words, most frequent first (ties by bytes) */
+struct histogram_top_t {
+        uint64_t words;             /* Occurrences counted */
+        uint64_t distinct;          /* Distinct words */
+        size_t n;
+        struct histogram_entry_t *entries;
+        struct histogram_t **merged;    /* Partitions the entries point into */
+        int nmerged;
+};
+
+/* Words of a single chunk, filled by a single thread */
+struct histogram_t *histogram_new(void);
+void histogram_free(struct histogram_t *h);
+int histogram_add(struct histogram_t *h, const char *word, size_t len);
+
+/* Merge the tables using `threads` threads and return the k most
+ * frequent words, or NULL if out of memory */
+struct histogram_top_t *histogram_top(struct histogram_t **parts, int nparts,
+                                      int threads, size_t k);
+void histogram_top_free(struct histogram_top_t *top);
+
+#endif /* HISTOGRAM_H */
@@ -0,0 +1,396 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ========================= Kernel microbenchmarks ======================
+ *
+ * `make kbench` (or `./tsearch-kbench [options]`) times the matching
+ * kernels alone, on a buffer in memory (see tsearch_matcher_new()): no
+ * file, no threads, no page cache. It sweeps
+ *
+ *   - the kernel: word, substring, overlapping, regex, fuzzy, wildcard;
+ *   - the length of the word, from 1 to 127 bytes (the longest word a
+ *     search takes, fuzzy stops at 64);
+ *   - the density of the hits, copies of the word per MiB of buffer;
+ *   - the alphabet of the buffer: `text` (lowercase words separated by
+ *     spaces and newlines), `dna` (acgt, no word boundaries at all) or
+ *     `binary` (any byte), the word is made of letters;
+ *   - the alignment of the start of the buffer to 64 bytes;
+ *
+ * and prints one CSV row per case with the best and the median of the runs
+ * in cycles per byte (time stamp counter ticks, so reference cycles, on
+ * x86; -1 elsewhere) and in ns per byte. Where the kernels cross over, e.g.
+ * the word length from which a prefilter pays off, can be read from them.
+ *
+ * Options:
+ *   --kernels=<list>       Kernels to time (default all).
+ *   --lengths=<list>       Word lengths (default 1,2,3,4,6,8,12,16,32,64,127).
+ *   --density=<list>       Hits per MiB (default 0,100,10000).
+ *   --alphabet=<list>      text, dna, binary (default all).
+ *   --align=<list>         Offsets of the buffer from 64 bytes (default 0,1).
+ *   --size=<KiB>           Size of the buffer (default 4096).
+ *   --runs=<n>             Runs of every case (default 5).
+ *   --seed=<n>             Seed of the buffers and the words (default 1).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "tsearch.h"
+#include "fuzzy.h"
+
+#define KBENCH_MAX_LIST 64
+
+struct kernel {
+        const char *name;
+        enum search_mode_t mode;
+        int overlapping;
+        int max_errors;
+};
+
+static const struct kernel kernels[] = {
+        { "word",        SEARCH_WORD,      0, 0 },
+        { "substring",   SEARCH_SUBSTRING, 0, 0 },
+        { "overlapping", SEARCH_SUBSTRING, 1, 0 },
+        { "regex",       SEARCH_REGEX,     0, 0 },
+        { "fuzzy",       SEARCH_FUZZY,     0, 1 },
+        { "wildcard",    SEARCH_WILDCARD,  0, 0 },
+};
+#define NKERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+static const char *alphabets[] = { "text", "dna", "binary" };
+#define NALPHABETS (int)(sizeof(alphabets) / sizeof(alphabets[0]))
+
+static uint64_t rng_state;
+
+/* xorshift64*: the same buffers on every machine */
+static uint64_t rng(void) {
+        rng_state ^= rng_state >> 12;
+        rng_state ^= rng_state << 25;
+        rng_state ^= rng_state >> 27;
+        return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static char random_byte(int alphabet) {
+        switch (alphabet) {
+        case 0: {
+                uint64_t r = rng() % 480;
+                if (r < 6) return '\n';
+                if (r < 80) return ' ';
+                return 'a' + r % 26;
+        }
+        case 1:
+                return "acgt"[rng() % 4];
+        default:
+                return (char)(rng() % 256);
+        }
+}
+
+/* Fill the buffer from the alphabet, then copy the word about density
+ * times per MiB at random places (between spaces for text) */
+static void fill(char *text, size_t len, int alphabet, const char *word, int word_len,
+                 long density) {
+        for (size_t i = 0; i < len; i++)
+                text[i] = random_byte(alphabet);
+
+        long copies = (long)((double)density * len / (1 << 20));
+        for (long i = 0; i < copies && len > (size_t)word_len + 2; i++) {
+                size_t at = rng() % (len - word_len - 2);
+                if (alphabet == 0) {
+                        text[at++] = ' ';
+                        text[at + word_len] = ' ';
+                }
+                memcpy(text + at, word, word_len);
+        }
+}
+
+static void random_word(char *word, int len, int alphabet) {
+        for (int i = 0; i < len; i++)
+                word[i] = alphabet == 1 ? "acgt"[rng() % 4] : 'a' + rng() % 26;
+        word[len] = '\0';
+}
+
+static int64_t now_ns(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t ticks(void) {
+#ifdef HAVE_TSC
+        return __rdtsc();
+#else
+        return 0;
+#endif
+}
+
+static int cmp_double(const void *a, const void *b) {
+        double x = *(const double *)a, y = *(const double *)b;
+        return (x > y) - (x < y);
+}
+
+/* Parse a comma separated list of numbers, the count or -1 */
+static int parse_list(const char *list, long *values, int max) {
+        int n = 0;
+
+        while (*list) {
+                char *e;
+                errno = 0;
+                long v = strtol(list, &e, 10);
+                if (errno || e == list || (*e != ',' && *e != '\0') || v < 0 || n == max)
+                        return -1;
+                values[n++] = v;
+                list = *e ? e + 1 : e;
+        }
+        return n > 0 ? n : -1;
+}
+
+/* Bitmask of the names of the list found in names, 0 if one is unknown */
+static unsigned parse_names(const char *list, const char *const *names, size_t stride, int n) {
+        unsigned mask = 0;
+
+        while (*list) {
+                size_t len = strcspn(list, ",");
+                int i;
+                for (i = 0; i < n; i++) {
+                        const char *name = *(const char *const *)((const char *)names + i * stride);
+                        if (strlen(name) == len && strncmp(list, name, len) == 0)
+                                break;
+                }
+                if (i == n) return 0;
+                mask |= 1u << i;
+                list += len;
+                if (*list == ',') list++;
+        }
+        return mask;
+}
+
+/* Count the matches of the buffer runs times, the timings per byte of
+ * every run go to cycles and ns */
+static int time_kernel(const struct search_opts_t *opts, const char *word,
+                       const char *text, size_t len, int runs,
+                       double *cycles, double *ns, uint64_t *count) {
+        struct tsearch_matcher_t *m = tsearch_matcher_new(word, opts);
+        if (!m) return -1;
+
+        for (int r = 0; r < runs; r++) {
+                int64_t t0 = now_ns();
+                uint64_t c0 = ticks();
+                *count = tsearch_matcher_count(m, text, len);
+                uint64_t c1 = ticks();
+                int64_t t1 = now_ns();
+
+                cycles[r] = (double)(c1 - c0) / len;
+                ns[r] = (double)(t1 - t0) / len;
+        }
+        tsearch_matcher_free(m);
+        return 0;
+}
+
+static void usage(void) {
+        ERR("Usage: ./tsearch-kbench [options]");
+        ERR("  --kernels=<list>       word, substring, overlapping, regex, fuzzy, wildcard");
+        ERR("  --lengths=<list>       word lengths, 1 to %d (default 1,2,3,4,6,8,12,16,32,64,127)",
+            MAX_WORD_LENGTH - 1);
+        ERR("  --density=<list>       hits per MiB (default 0,100,10000)");
+        ERR("  --alphabet=<list>      text, dna, binary (default all)");
+        ERR("  --align=<list>         offsets of the buffer from 64 bytes (default 0,1)");
+        ERR("  --size=<KiB>           size of the buffer (default 4096)");
+        ERR("  --runs=<n>             runs of every case (default 5)");
+        ERR("  --seed=<n>             seed of the buffers and the words (default 1)");
+}
+
+int main(int argc, char **argv) {
+        static const struct option long_options[] = {
+                { "kernels", required_argument, NULL, 'k' },
+                { "lengths", required_argument, NULL, 'l' },
+                { "density", required_argument, NULL, 'd' },
+                { "alphabet", required_argument, NULL, 'a' },
+                { "align", required_argument, NULL, 'A' },
+                { "size", required_argument, NULL, 's' },
+                { "runs", required_argument, NULL, 'r' },
+                { "seed", required_argument, NULL, 'S' },
+                { NULL, 0, NULL, 0 }
+        };
+        long lengths[KBENCH_MAX_LIST] = { 1, 2, 3, 4, 6, 8, 12, 16, 32, 64, 127 };
+        long densities[KBENCH_MAX_LIST] = { 0, 100, 10000 };
+        long aligns[KBENCH_MAX_LIST] = { 0, 1 };
+        int nlengths = 11, ndensities = 3, naligns = 2;
+        unsigned kernel_mask = (1u << NKERNELS) - 1;
+        unsigned alphabet_mask = (1u << NALPHABETS) - 1;
+        long size_kib = 4096, runs = 5, seed = 1;
+        int opt;
+
+        while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+                long v[1];
+
+                switch (opt) {
+                case 'k':
+                        kernel_mask = parse_names(optarg, &kernels[0].name, sizeof(kernels[0]),
+                                                  NKERNELS);
+                        if (!kernel_mask) {
+                                ERR("Unknown kernels '%s'", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'a':
+                        alphabet_mask = parse_names(optarg, alphabets, sizeof(alphabets[0]),
+                                                    NALPHABETS);
+                        if (!alphabet_mask) {
+                                ERR("Unknown alphabets '%s'", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'l':
+                        nlengths = parse_list(optarg, lengths, KBENCH_MAX_LIST);
+                        for (int i = 0; i < nlengths; i++)
+                                if (lengths[i] < 1 || lengths[i] >= MAX_WORD_LENGTH)
+                                        nlengths = -1;
+                        if (nlengths < 0) {
+                                ERR("Invalid word lengths '%s'", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'd':
+                        ndensities = parse_list(optarg, densities, KBENCH_MAX_LIST);
+                        if (ndensities < 0) {
+                                ERR("Invalid densities '%s'", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'A':
+                        naligns = parse_list(optarg, aligns, KBENCH_MAX_LIST);
+                        for (int i = 0; i < naligns; i++)
+                                if (aligns[i] >= 64) naligns = -1;
+                        if (naligns < 0) {
+                                ERR("Invalid alignments '%s'", optarg);
+                                return 1;
+                        }
+                        break;
+                case 's':
+                case 'r':
+                case 'S':
+                        if (parse_list(optarg, v, 1) != 1 || (opt != 'S' && v[0] < 1)) {
+                                ERR("Invalid number '%s'", optarg);
+                                return 1;
+                        }
+                        if (opt == 's') size_kib = v[0];
+                        else if (opt == 'r') runs = v[0];
+                        else seed = v[0];
+                        break;
+                default:
+                        usage();
+                        return 1;
+                }
+        }
+        if (optind != argc) {
+                usage();
+                return 1;
+        }
+
+        size_t len = (size_t)size_kib << 10;
+        char *buffer = aligned_alloc(64, (len + 127) / 64 * 64);
+        double *cycles = calloc(runs, sizeof(double));
+        double *ns = calloc(runs, sizeof(double));
+        if (!buffer || !cycles || !ns) {
+                ERR("Failed to allocate %zu bytes", len);
+                return 1;
+        }
+
+        /* The results keep stdout, the logs of the matchers go nowhere */
+        fflush(stdout);
+        FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+        if (!out || !freopen("/dev/null", "w", stdout)) {
+                ERR("Failed to redirect the logs");
+                return 1;
+        }
+
+        word_chars_init(NULL);
+        rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+        fprintf(out, "kernel,word_len,density,alphabet,align,bytes,count,"
+                "best_cycles_per_byte,median_cycles_per_byte,best_ns_per_byte,median_ns_per_byte\n");
+
+        for (int a = 0; a < NALPHABETS; a++) {
+                if (!(alphabet_mask & (1u << a))) continue;
+
+                for (int l = 0; l < nlengths; l++) {
+                        char word[MAX_WORD_LENGTH];
+                        random_word(word, lengths[l], a);
+
+                        for (int d = 0; d < ndensities; d++) {
+                                /* The same content at every alignment */
+                                uint64_t state = rng_state;
+
+                                for (int al = 0; al < naligns; al++) {
+                                        char *text = buffer + aligns[al];
+
+                                        rng_state = state;
+                                        fill(text, len, a, word, lengths[l], densities[d]);
+
+                                        for (int k = 0; k < NKERNELS; k++) {
+                                                const struct kernel *kn = &kernels[k];
+                                                const struct search_opts_t opts = {
+                                                        .mode = kn->mode,
+                                                        .overlapping = kn->overlapping,
+                                                        .max_errors = kn->max_errors,
+                                                };
+
+                                                if (!(kernel_mask & (1u << k))) continue;
+                                                if (kn->mode == SEARCH_FUZZY &&
+                                                    (lengths[l] <= kn->max_errors ||
+                                                     lengths[l] > FUZZY_MAX_WORD))
+                                                        continue;
+
+                                                uint64_t count = 0;
+                                                if (time_kernel(&opts, word, text, len, runs,
+                                                                cycles, ns, &count) != 0) {
+                                                        ERR("Can't build the %s kernel for '%s'",
+                                                            kn->name, word);
+                                                        return 1;
+                                                }
+                                                qsort(cycles, runs, sizeof(double), cmp_double);
+                                                qsort(ns, runs, sizeof(double), cmp_double);
+#ifndef HAVE_TSC
+                                                cycles[0] = cycles[(runs - 1) / 2] = -1;
+#endif
+                                                fprintf(out, "%s,%ld,%ld,%s,%ld,%zu,%lu,%.4f,%.4f,%.4f,%.4f\n",
+                                                        kn->name, lengths[l], densities[d],
+                                                        alphabets[a], aligns[al], len, count,
+                                                        cycles[0], cycles[(runs - 1) / 2],
+                                                        ns[0], ns[(runs - 1) / 2]);
+                                                fflush(out);
+                                        }
+                                }
+                        }
+                }
+        }
+
+        fclose(out);
+        free(buffer);
+        free(cycles);
+        free(ns);
+        return 0;
+}
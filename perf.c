@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "perf.h"
+
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const struct {
+        uint32_t type;
+        uint64_t config;
+} events[PERF_NCOUNTERS] = {
+        [PERF_CYCLES]        = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        [PERF_INSTRUCTIONS]  = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        [PERF_LLC_MISSES]    = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        [PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        [PERF_PAGE_FAULTS]   = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+struct perf_t {
+        int fd[PERF_NCOUNTERS];     /* -1 if the counter isn't available */
+};
+
+static int open_event(int i) {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        /* This thread, on any CPU */
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+                attr.exclude_kernel = 1;
+                fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+        return fd;
+}
+
+struct perf_t *perf_open(void) {
+        struct perf_t *perf = malloc(sizeof(*perf));
+        int opened = 0;
+
+        if (!perf) return NULL;
+        for (int i = 0; i < PERF_NCOUNTERS; i++) {
+                perf->fd[i] = open_event(i);
+                if (perf->fd[i] >= 0) opened++;
+        }
+        if (!opened) {
+                free(perf);
+                return NULL;
+        }
+        return perf;
+}
+
+void perf_close(struct perf_t *perf) {
+        if (!perf) return;
+        for (int i = 0; i < PERF_NCOUNTERS; i++)
+                if (perf->fd[i] >= 0) close(perf->fd[i]);
+        free(perf);
+}
+
+static void control(struct perf_t *perf, unsigned long request) {
+        if (!perf) return;
+        for (int i = 0; i < PERF_NCOUNTERS; i++)
+                if (perf->fd[i] >= 0) ioctl(perf->fd[i], request, 0);
+}
+
+void perf_enable(struct perf_t *perf) {
+        control(perf, PERF_EVENT_IOC_ENABLE);
+}
+
+void perf_disable(struct perf_t *perf) {
+        control(perf, PERF_EVENT_IOC_DISABLE);
+}
+
+void perf_read(struct perf_t *perf, struct perf_counts_t *counts) {
+        if (!perf) return;
+        for (int i = 0; i < PERF_NCOUNTERS; i++) {
+                uint64_t v[3];  /* value, time enabled, time running */
+
+                if (perf->fd[i] < 0 || read(perf->fd[i], v, sizeof(v)) != sizeof(v))
+                        continue;
+                /* Multiplexed: extrapolate to the whole time enabled */
+                if (v[2] > 0 && v[2] < v[1])
+                        v[0] = (uint64_t)((double)v[0] * v[1] / v[2]);
+                counts->value[i] += v[0];
+                counts->valid |= 1u << i;
+        }
+}
+
+#else
+
+struct perf_t *perf_open(void) { return NULL; }
+void perf_close(struct perf_t *perf) { (void)perf; }
+void perf_enable(struct perf_t *perf) { (void)perf; }
+void perf_disable(struct perf_t *perf) { (void)perf; }
+void perf_read(struct perf_t *perf, struct perf_counts_t *counts) { (void)perf; (void)counts; }
+
+#endif
+
+void perf_add(struct perf_counts_t *sum, const struct perf_counts_t *counts) {
+        for (int i = 0; i < PERF_NCOUNTERS; i++)
+                if (counts->valid & (1u << i))
+                        sum->value[i] += counts->value[i];
+        sum->valid |= counts->valid;
+}
+
+void perf_format(const struct perf_counts_t *counts, char *buf, size_t len) {
+        static const char *names[PERF_NCOUNTERS] = {
+                "cycles", "instructions", "LLC misses", "branch misses", "page faults",
+        };
+        size_t n = 0;
+
+        if (!counts->valid) {
+                snprintf(buf, len, "no counters available");
+                return;
+        }
+        buf[0] = '\0';
+        for (int i = 0; i < PERF_NCOUNTERS && n < len; i++) {
+                if (!(counts->valid & (1u << i))) continue;
+                n += snprintf(buf + n, len - n, "%s%lu %s", n ? ", " : "",
+                              counts->value[i], names[i]);
+                if (i == PERF_INSTRUCTIONS && (counts->valid & (1u << PERF_CYCLES)) &&
+                    counts->value[PERF_CYCLES] && n < len)
+                        n += snprintf(buf + n, len - n, " (%.2f IPC)",
+                                      (double)counts->value[PERF_INSTRUCTIONS] /
+                                      counts->value[PERF_CYCLES]);
+        }
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ====================== Hardware performance counters ==================
+ *
+ * `--perf-counters`: every thread counts, with perf_event_open(2), the
+ * cycles, instructions, last level cache misses, branch misses and page
+ * faults of its own scan, so a slow search tells whether it waits on the
+ * disk (few cycles for the time spent), on memory (LLC misses) or on
+ * mispredicted branches. No external tool is needed, only a kernel which
+ * allows perf events to unprivileged processes (perf_event_paranoid up to
+ * 2 counts user space only, which is retried when counting the kernel too
+ * is refused).
+ *
+ * Counters the machine doesn't have (hardware events in most virtual
+ * machines) are left out, and counts are scaled when the kernel had to
+ * multiplex them.
+ */
+#ifndef PERF_H
+#define PERF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum perf_counter_t {
+        PERF_CYCLES,
+        PERF_INSTRUCTIONS,
+        PERF_LLC_MISSES,
+        PERF_BRANCH_MISSES,
+        PERF_PAGE_FAULTS,
+        PERF_NCOUNTERS
+};
+
+struct perf_counts_t {
+        uint64_t value[PERF_NCOUNTERS];
+        unsigned valid;     /* Bit i set: value[i] was counted */
+};
+
+struct perf_t;
+
+/* Counters of the calling thread, stopped, or NULL if none can be opened */
+struct perf_t *perf_open(void);
+void perf_close(struct perf_t *perf);
+
+/* Start and stop counting, nothing with NULL */
+void perf_enable(struct perf_t *perf);
+void perf_disable(struct perf_t *perf);
+
+/* Add the counts so far to counts */
+void perf_read(struct perf_t *perf, struct perf_counts_t *counts);
+
+void perf_add(struct perf_counts_t *sum, const struct perf_counts_t *counts);
+
+/* "1234 cycles, 2345 instructions (1.90 IPC), ..." */
+void perf_format(const struct perf_counts_t *counts, char *buf, size_t len);
+
+#endif /* PERF_H */
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+/* The items of a pool_run() call */
+struct batch {
+        void *(*fn)(void *);
+        char *items;
+        size_t size;
+        int n;
+        int next;               /* First item not taken yet */
+        int done;
+        pthread_cond_t finished;
+        struct batch *link;     /* Queue of the batches with items left */
+};
+
+struct pool_t {
+        pthread_mutex_t lock;
+        pthread_cond_t work;
+        struct batch *head, *tail;
+        pthread_t *workers;
+        int nworkers;
+        int stop;
+};
+
+/* Take the next item of the batch, the pool being locked. The batch
+ * leaves the queue with its last item. */
+static int take(struct pool_t *pool, struct batch *b) {
+        int i = b->next++;
+
+        if (b->next == b->n) {
+                struct batch **p = &pool->head, *prev = NULL;
+                while (*p && *p != b) {
+                        prev = *p;
+                        p = &(*p)->link;
+                }
+                if (*p) {
+                        *p = b->link;
+                        if (pool->tail == b) pool->tail = prev;
+                }
+        }
+        return i;
+}
+
+/* Run an item, the pool being locked */
+static void run(struct pool_t *pool, struct batch *b, int i) {
+        pthread_mutex_unlock(&pool->lock);
+        b->fn(b->items + i * b->size);
+        pthread_mutex_lock(&pool->lock);
+
+        if (++b->done == b->n)
+                pthread_cond_broadcast(&b->finished);
+}
+
+static void *worker(void *arg) {
+        struct pool_t *pool = arg;
+
+        pthread_mutex_lock(&pool->lock);
+        for (;;) {
+                while (!pool->stop && !pool->head)
+                        pthread_cond_wait(&pool->work, &pool->lock);
+                if (!pool->head) break;
+
+                struct batch *b = pool->head;
+                run(pool, b, take(pool, b));
+        }
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+}
+
+struct pool_t *pool_new(int workers) {
+        struct pool_t *pool = calloc(1, sizeof(*pool));
+        if (!pool) return NULL;
+
+        pool->workers = calloc(workers, sizeof(pthread_t));
+        if (!pool->workers) {
+                free(pool);
+                return NULL;
+        }
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->work, NULL);
+
+        for (int i = 0; i < workers; i++) {
+                if (pthread_create(&pool->workers[i], NULL, worker, pool) != 0)
+                        break;
+                pool->nworkers++;
+        }
+        if (pool->nworkers == 0) {
+                pool_free(pool);
+                return NULL;
+        }
+        return pool;
+}
+
+void pool_free(struct pool_t *pool) {
+        if (!pool) return;
+
+        pthread_mutex_lock(&pool->lock);
+        pool->stop = 1;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (int i = 0; i < pool->nworkers; i++)
+                pthread_join(pool->workers[i], NULL);
+        pthread_cond_destroy(&pool->work);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->workers);
+        free(pool);
+}
+
+void pool_run(struct pool_t *pool, void *(*fn)(void *), void *items, size_t size, int n) {
+        struct batch b = {
+                .fn = fn, .items = items, .size = size, .n = n,
+        };
+
+        if (n <= 0) return;
+        pthread_cond_init(&b.finished, NULL);
+
+        pthread_mutex_lock(&pool->lock);
+        if (pool->tail) pool->tail->link = &b;
+        else pool->head = &b;
+        pool->tail = &b;
+        pthread_cond_broadcast(&pool->work);
+
+        /* Help with our own items rather than just waiting */
+        while (b.next < b.n)
+                run(pool, &b, take(pool, &b));
+        while (b.done < b.n)
+                pthread_cond_wait(&b.finished, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+
+        pthread_cond_destroy(&b.finished);
+}
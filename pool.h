@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ============================= Worker pool =============================
+ *
+ * Threads started once and reused by every search, for processes running
+ * many of them (`--serve`): a search hands its chunks to the pool instead
+ * of creating and joining a thread per chunk. Several searches can use
+ * the pool at the same time, their chunks are taken in order of arrival
+ * and the caller works on its own chunks too while it waits.
+ */
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+struct pool_t;
+
+struct pool_t *pool_new(int workers);
+
+/* Wait for the running batches and stop the workers */
+void pool_free(struct pool_t *pool);
+
+/* Call fn on the n items of size bytes at items, in parallel, and return
+ * once all the calls are done */
+void pool_run(struct pool_t *pool, void *(*fn)(void *), void *items, size_t size, int n);
+
+#endif /* POOL_H */
@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "tsearch.h"
+#include "profile.h"
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#include <stdatomic.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <fcntl.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/* Missing from the older C libraries */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+struct sample {
+        int depth;                      /* 0: not written */
+        uintptr_t pc[PROFILE_DEPTH];    /* Innermost first */
+};
+
+struct profile_thread_t {
+        timer_t timer;
+};
+
+static struct sample *samples;
+static atomic_size_t nsamples;
+static volatile int profiling;
+
+/* The stack of the thread, the frame pointers outside of it are garbage */
+static __thread uintptr_t stack_lo, stack_hi;
+
+static void on_sigprof(int sig, siginfo_t *info, void *context) {
+        const ucontext_t *uc = context;
+        uintptr_t pc, fp;
+        (void)sig;
+        (void)info;
+
+        size_t i = atomic_fetch_add_explicit(&nsamples, 1, memory_order_relaxed);
+        if (i >= PROFILE_MAX_SAMPLES) return;
+        struct sample *s = &samples[i];
+
+#if defined(__x86_64__)
+        pc = uc->uc_mcontext.gregs[REG_RIP];
+        fp = uc->uc_mcontext.gregs[REG_RBP];
+#else
+        pc = uc->uc_mcontext.pc;
+        fp = uc->uc_mcontext.regs[29];
+#endif
+        int depth = 0;
+        s->pc[depth++] = pc;
+
+#if defined(TSEARCH_FRAME_POINTERS)
+        /* A frame starts with the caller's frame pointer, then the return
+         * address: both must be on the stack, and the callers are above */
+        while (depth < PROFILE_DEPTH && fp % sizeof(uintptr_t) == 0 &&
+               fp >= stack_lo && fp + 2 * sizeof(uintptr_t) <= stack_hi) {
+                const uintptr_t *frame = (const uintptr_t *)fp;
+                if (frame[1] == 0) break;
+                /* The call instruction, not the one after it */
+                s->pc[depth++] = frame[1] - 1;
+                if (frame[0] <= fp) break;
+                fp = frame[0];
+        }
+#else
+        (void)fp;
+#endif
+        s->depth = depth;
+}
+
+int profile_start(void) {
+        struct sigaction sa = { .sa_sigaction = on_sigprof, .sa_flags = SA_SIGINFO | SA_RESTART };
+
+        /* Only the pages of the samples taken are ever touched */
+        samples = calloc(PROFILE_MAX_SAMPLES, sizeof(*samples));
+        if (!samples) {
+                ERR("Failed to allocate the profile samples");
+                return -1;
+        }
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGPROF, &sa, NULL) != 0) {
+                ERR("Failed to install the SIGPROF handler: %s", strerror(errno));
+                free(samples);
+                samples = NULL;
+                return -1;
+        }
+#if !defined(TSEARCH_FRAME_POINTERS)
+        LOG("Built without frame pointers, the profile only has the functions sampled "
+            "(`make profile` builds tsearch-profile with them)");
+#endif
+        profiling = 1;
+        return 0;
+}
+
+struct profile_thread_t *profile_thread_start(void) {
+        struct sigevent sev = { .sigev_notify = SIGEV_THREAD_ID, .sigev_signo = SIGPROF };
+        struct itimerspec period = {
+                .it_interval = { .tv_nsec = 1000000000 / PROFILE_HZ },
+                .it_value = { .tv_nsec = 1000000000 / PROFILE_HZ },
+        };
+        pthread_attr_t attr;
+        void *stack;
+        size_t size;
+
+        if (!profiling) return NULL;
+
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+                if (pthread_attr_getstack(&attr, &stack, &size) == 0) {
+                        stack_lo = (uintptr_t)stack;
+                        stack_hi = (uintptr_t)stack + size;
+                }
+                pthread_attr_destroy(&attr);
+        }
+
+        struct profile_thread_t *thread = malloc(sizeof(*thread));
+        if (!thread) return NULL;
+        sev.sigev_notify_thread_id = syscall(SYS_gettid);
+        if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &thread->timer) != 0) {
+                ERR("Failed to create the profiling timer: %s", strerror(errno));
+                free(thread);
+                return NULL;
+        }
+        if (timer_settime(thread->timer, 0, &period, NULL) != 0) {
+                timer_delete(thread->timer);
+                free(thread);
+                return NULL;
+        }
+        return thread;
+}
+
+void profile_thread_stop(struct profile_thread_t *thread) {
+        if (!thread) return;
+        timer_delete(thread->timer);
+        free(thread);
+}
+
+/* The function symbols of the executable, sorted by address */
+struct symbol {
+        uintptr_t start;
+        uintptr_t size;
+        char *name;
+};
+
+static struct symbol *symbols;
+static size_t nsymbols;
+static uintptr_t exe_base;
+
+static int cmp_symbols(const void *a, const void *b) {
+        const struct symbol *x = a, *y = b;
+        return (x->start > y->start) - (x->start < y->start);
+}
+
+/* Read the symbol table of /proc/self/exe, the dynamic one if stripped */
+static void load_symbols(void) {
+        struct stat st;
+        Dl_info info;
+
+        /* The address the executable is loaded at */
+        if (!dladdr((void *)profile_start, &info)) return;
+        exe_base = (uintptr_t)info.dli_fbase;
+
+        int fd = open("/proc/self/exe", O_RDONLY);
+        if (fd < 0) return;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ElfW(Ehdr))) {
+                close(fd);
+                return;
+        }
+        const unsigned char *elf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (elf == MAP_FAILED) return;
+
+        const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr) *)elf;
+        const ElfW(Shdr) *shdr = (const ElfW(Shdr) *)(elf + ehdr->e_shoff);
+        const ElfW(Shdr) *table = NULL;
+
+        if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+            ehdr->e_shoff + (size_t)ehdr->e_shnum * sizeof(ElfW(Shdr)) > (size_t)st.st_size)
+                goto out;
+        for (int i = 0; i < ehdr->e_shnum; i++) {
+                if (shdr[i].sh_type == SHT_SYMTAB) table = &shdr[i];
+                else if (shdr[i].sh_type == SHT_DYNSYM && !table) table = &shdr[i];
+        }
+        if (!table || table->sh_link >= ehdr->e_shnum) goto out;
+
+        const ElfW(Shdr) *strtab = &shdr[table->sh_link];
+        if (table->sh_offset + table->sh_size > (size_t)st.st_size ||
+            strtab->sh_offset + strtab->sh_size > (size_t)st.st_size)
+                goto out;
+
+        const ElfW(Sym) *syms = (const ElfW(Sym) *)(elf + table->sh_offset);
+        size_t n = table->sh_size / sizeof(ElfW(Sym));
+        /* A position independent executable has addresses from 0 */
+        uintptr_t bias = ehdr->e_type == ET_DYN ? exe_base : 0;
+
+        symbols = malloc(n * sizeof(*symbols));
+        if (!symbols) goto out;
+        for (size_t i = 0; i < n; i++) {
+                if (ELF64_ST_TYPE(syms[i].st_info) != STT_FUNC || syms[i].st_size == 0 ||
+                    syms[i].st_name >= strtab->sh_size)
+                        continue;
+                char *name = strdup((const char *)elf + strtab->sh_offset + syms[i].st_name);
+                if (!name) continue;
+                symbols[nsymbols++] = (struct symbol){
+                        .start = syms[i].st_value + bias, .size = syms[i].st_size, .name = name,
+                };
+        }
+        qsort(symbols, nsymbols, sizeof(*symbols), cmp_symbols);
+out:
+        munmap((void *)elf, st.st_size);
+}
+
+/* The name of the function at pc, "[library]" or "[unknown]" */
+static const char *symbol_name(uintptr_t pc, char *buf, size_t len) {
+        Dl_info info;
+        size_t lo = 0, hi = nsymbols;
+
+        while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (symbols[mid].start <= pc) lo = mid + 1;
+                else hi = mid;
+        }
+        if (lo > 0 && pc < symbols[lo - 1].start + symbols[lo - 1].size)
+                return symbols[lo - 1].name;
+
+        if (!dladdr((void *)pc, &info) || (uintptr_t)info.dli_fbase == exe_base)
+                return "[unknown]";
+        if (info.dli_sname)
+                return info.dli_sname;
+        const char *lib = info.dli_fname ? strrchr(info.dli_fname, '/') : NULL;
+        snprintf(buf, len, "[%s]", lib ? lib + 1 : info.dli_fname ? info.dli_fname : "unknown");
+        return buf;
+}
+
+static int cmp_strings(const void *a, const void *b) {
+        return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int profile_write(const char *path) {
+        size_t taken = atomic_load(&nsamples);
+        size_t n = MIN(taken, (size_t)PROFILE_MAX_SAMPLES);
+        char **stacks = NULL;
+        size_t nstacks = 0;
+        int ret = -1;
+
+        /* The threads which called profile_thread_start() have stopped */
+        profiling = 0;
+        signal(SIGPROF, SIG_IGN);
+
+        FILE *out = fopen(path, "w");
+        if (!out) {
+                ERR("Failed to open '%s': %s", path, strerror(errno));
+                goto out;
+        }
+        load_symbols();
+
+        stacks = malloc(MAX(n, 1) * sizeof(*stacks));
+        if (!stacks) goto out;
+        for (size_t i = 0; i < n; i++) {
+                const struct sample *s = &samples[i];
+                char line[PROFILE_DEPTH * 64], buf[256];
+                size_t len = 0;
+
+                if (s->depth == 0) continue;
+                /* Outermost frame first */
+                for (int d = s->depth - 1; d >= 0 && len < sizeof(line); d--)
+                        len += snprintf(line + len, sizeof(line) - len, "%s%s",
+                                        d == s->depth - 1 ? "" : ";",
+                                        symbol_name(s->pc[d], buf, sizeof(buf)));
+                stacks[nstacks] = strdup(line);
+                if (stacks[nstacks]) nstacks++;
+        }
+
+        /* Count the runs of equal stacks */
+        qsort(stacks, nstacks, sizeof(*stacks), cmp_strings);
+        for (size_t i = 0; i < nstacks; ) {
+                size_t j = i + 1;
+                while (j < nstacks && strcmp(stacks[i], stacks[j]) == 0) j++;
+                fprintf(out, "%s %zu\n", stacks[i], j - i);
+                i = j;
+        }
+        if (taken > n)
+                LOG("The profile is full, %zu of %zu samples were dropped", taken - n, taken);
+        LOG("Wrote %zu samples to '%s'", nstacks, path);
+        ret = 0;
+out:
+        if (out && fclose(out) != 0) ret = -1;
+        for (size_t i = 0; i < nstacks; i++)
+                free(stacks[i]);
+        free(stacks);
+        for (size_t i = 0; i < nsymbols; i++)
+                free(symbols[i].name);
+        free(symbols);
+        symbols = NULL;
+        nsymbols = 0;
+        free(samples);
+        samples = NULL;
+        return ret;
+}
+
+#else
+
+int profile_start(void) {
+        ERR("--profile needs Linux on x86-64 or AArch64");
+        return -1;
+}
+struct profile_thread_t *profile_thread_start(void) { return NULL; }
+void profile_thread_stop(struct profile_thread_t *thread) { (void)thread; }
+int profile_write(const char *path) { (void)path; return -1; }
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * =========================== Sampling profiler =========================
+ *
+ * `--profile=<file>` profiles the scan without perf or any other tool:
+ * every thread scanning the file gets a timer on its own CPU time which
+ * sends it SIGPROF PROFILE_HZ times a second. The handler walks the
+ * frame pointers from the interrupted registers and stores the stack in
+ * a buffer of PROFILE_MAX_SAMPLES samples allocated beforehand (a signal
+ * handler can't allocate). At the end the stacks are named with the
+ * symbol table of the executable and dladdr() for the libraries, and
+ * written in the folded format of flame graphs, a line per distinct
+ * stack with its count:
+ *
+ *     start_thread;search_ranges;search_chunk;word_kernel 1234
+ *
+ * so that `flamegraph.pl <file> > scan.svg` draws it.
+ *
+ * The stacks need frame pointers: `make profile` builds tsearch-profile
+ * with -fno-omit-frame-pointer. The other builds only record the
+ * function a sample was taken in. The library functions (memchr, read)
+ * usually have no frame pointer and hide their caller. Time spent
+ * waiting for the disk uses no CPU and isn't sampled, see
+ * --thread-stats for it.
+ *
+ * Without --profile no timer or handler exists, a thread only checks a
+ * flag when it starts.
+ */
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#define PROFILE_HZ          997         /* Not a multiple of the scheduler tick */
+#define PROFILE_DEPTH       64          /* Frames kept per sample */
+#define PROFILE_MAX_SAMPLES (1 << 16)   /* The others are counted and dropped */
+
+struct profile_thread_t;
+
+/* Start profiling the threads which call profile_thread_start(), 0 on
+ * success */
+int profile_start(void);
+
+/* Sample the calling thread until profile_thread_stop(): NULL when not
+ * profiling, nothing to stop then */
+struct profile_thread_t *profile_thread_start(void);
+void profile_thread_stop(struct profile_thread_t *thread);
+
+/* Stop profiling and write the folded stacks to path, 0 on success */
+int profile_write(const char *path);
+
+#endif /* PROFILE_H */
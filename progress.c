@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "tsearch.h"
+#include "progress.h"
+
+struct progress_t {
+        struct progress_slot_t *slots;
+        int threads;
+        uint64_t total;
+        long interval_ms;
+        int tty;                    /* Rewrite a single line */
+        int stopping;
+        pthread_mutex_t lock;
+        pthread_cond_t stop;
+        pthread_t reporter;
+};
+
+static int64_t monotonic_ns(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t bytes_done(struct progress_t *p) {
+        uint64_t done = 0;
+
+        for (int i = 0; i < p->threads; i++)
+                done += atomic_load_explicit(&p->slots[i].bytes, memory_order_relaxed);
+        /* The chunks read a little past their ends */
+        return MIN(done, p->total);
+}
+
+static void report(struct progress_t *p, uint64_t done, double gbps, int64_t elapsed_ns) {
+        double percent = p->total ? 100.0 * done / p->total : 100;
+        char eta[32] = "-";
+
+        if (done > 0 && done < p->total) {
+                long left = (long)((double)(p->total - done) * elapsed_ns / done / 1e9);
+                snprintf(eta, sizeof(eta), "%ld:%02ld:%02ld", left / 3600, left / 60 % 60, left % 60);
+        }
+        fprintf(stderr, "%sPROGRESS: %5.1f%% of %.2f GB, %.2f GB/s, ETA %s%s",
+                p->tty ? "\r" : "", percent, p->total / 1e9, gbps, eta, p->tty ? "" : "\n");
+        fflush(stderr);
+}
+
+static void advance(struct timespec *ts, long ms) {
+        ts->tv_nsec += ms % 1000 * 1000000;
+        ts->tv_sec += ms / 1000 + ts->tv_nsec / 1000000000;
+        ts->tv_nsec %= 1000000000;
+}
+
+static void *reporter(void *arg) {
+        struct progress_t *p = arg;
+        int64_t start = monotonic_ns(), last = start;
+        uint64_t last_done = 0;
+        struct timespec wake;
+
+        /* An absolute deadline: early wakeups don't move the next report */
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+        advance(&wake, p->interval_ms);
+        pthread_mutex_lock(&p->lock);
+        while (!p->stopping) {
+                if (pthread_cond_timedwait(&p->stop, &p->lock, &wake) != ETIMEDOUT)
+                        continue;
+                advance(&wake, p->interval_ms);
+
+                int64_t now = monotonic_ns();
+                uint64_t done = bytes_done(p);
+                report(p, done, (double)(done - last_done) / (now - last), now - start);
+                last = now;
+                last_done = done;
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        /* The whole scan, on its own line */
+        int64_t now = monotonic_ns();
+        uint64_t done = bytes_done(p);
+        report(p, done, now > start ? (double)done / (now - start) : 0, now - start);
+        if (p->tty) fputc('\n', stderr);
+        return NULL;
+}
+
+struct progress_t *progress_start(uint64_t total, int threads, long interval_ms) {
+        struct progress_t *p = calloc(1, sizeof(*p));
+
+        if (!p) return NULL;
+        p->slots = aligned_alloc(_Alignof(struct progress_slot_t),
+                                 threads * sizeof(struct progress_slot_t));
+        if (!p->slots) {
+                free(p);
+                return NULL;
+        }
+        for (int i = 0; i < threads; i++)
+                atomic_init(&p->slots[i].bytes, 0);
+        p->threads = threads;
+        p->total = total;
+        p->interval_ms = interval_ms > 0 ? interval_ms : PROGRESS_INTERVAL_MS;
+        p->tty = isatty(STDERR_FILENO);
+        pthread_mutex_init(&p->lock, NULL);
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&p->stop, &attr);
+        pthread_condattr_destroy(&attr);
+
+        if (pthread_create(&p->reporter, NULL, reporter, p) != 0) {
+                ERR("Failed to start the progress reporter");
+                pthread_mutex_destroy(&p->lock);
+                pthread_cond_destroy(&p->stop);
+                free(p->slots);
+                free(p);
+                return NULL;
+        }
+        return p;
+}
+
+struct progress_slot_t *progress_slot(struct progress_t *progress, int i) {
+        return progress ? &progress->slots[i] : NULL;
+}
+
+void progress_stop(struct progress_t *progress) {
+        if (!progress) return;
+
+        pthread_mutex_lock(&progress->lock);
+        progress->stopping = 1;
+        pthread_cond_signal(&progress->stop);
+        pthread_mutex_unlock(&progress->lock);
+        pthread_join(progress->reporter, NULL);
+
+        pthread_mutex_destroy(&progress->lock);
+        pthread_cond_destroy(&progress->stop);
+        free(progress->slots);
+        free(progress);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ============================ Scan progress ============================
+ *
+ * `--progress[=<ms>]`: a long scan prints on stderr, every <ms>, how much
+ * of the file was read, the throughput since the previous report and
+ * the time left at the average throughput so far.
+ *
+ * Every thread owns a counter of the bytes it read, alone on its cache
+ * line, and only ever stores to it: the scan never writes a line another
+ * thread writes, and there is no atomic read-modify-write. A reporter
+ * thread adds the counters up, it's the only one reading them.
+ */
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define PROGRESS_INTERVAL_MS 500    /* Default time between two reports */
+
+struct progress_slot_t {
+        _Alignas(64) _Atomic uint64_t bytes;
+};
+
+struct progress_t;
+
+/* Report every interval_ms the progress of threads reading total bytes,
+ * NULL on failure (the scan goes on without) */
+struct progress_t *progress_start(uint64_t total, int threads, long interval_ms);
+
+/* The counter of thread i */
+struct progress_slot_t *progress_slot(struct progress_t *progress, int i);
+
+/* Print the last report and stop, nothing with NULL */
+void progress_stop(struct progress_t *progress);
+
+/* Called by the owner of the slot only */
+static inline void progress_add(struct progress_slot_t *slot, uint64_t bytes) {
+        uint64_t done = atomic_load_explicit(&slot->bytes, memory_order_relaxed);
+        atomic_store_explicit(&slot->bytes, done + bytes, memory_order_relaxed);
+}
+
+#endif /* PROGRESS_H */
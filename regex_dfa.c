@@ -0,0 +1,960 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ======================= Regular expressions ===========================
+ *
+ * The pattern goes through three steps:
+ *
+ *   1. Parsing into a small syntax tree (struct node), also used to find
+ *      the literal every match must contain.
+ *   2. Compilation into a Thompson NFA. Counted repetitions are expanded,
+ *      so `[0-9]{4}` becomes four states.
+ *   3. Matching with a lazy DFA: a DFA state is the set of NFA states
+ *      reachable at some point of the line, and it's built the first time
+ *      it's needed. Transitions are cached per "byte class" (bytes that
+ *      no part of the pattern can tell apart) to keep the table small.
+ *
+ * Matches are leftmost-longest, like grep -o. The unanchored search (the
+ * NFA start is added back after every byte) finds where the earliest
+ * match ends; the leftmost match starts before that, so anchored runs
+ * (the start isn't added back, a set ending with prog->n marks their
+ * states) are tried from each position up to there. The first one which
+ * matches is stepped until it dies, its last match is counted, and the
+ * search goes on from its end.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "regex_dfa.h"
+
+#define MAX_NODES 4096
+#define MAX_NFA_STATES 16384
+#define MAX_REPEAT 1000
+#define MAX_LITERAL 128
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define SET_HAS(set, c) ((set)[(uint8_t)(c) >> 3] & (1 << ((uint8_t)(c) & 7)))
+#define SET_ADD(set, c) ((set)[(uint8_t)(c) >> 3] |= (1 << ((uint8_t)(c) & 7)))
+
+/* ============================ Syntax tree ============================= */
+
+enum node_type {
+        N_EMPTY,
+        N_SET,          /* One byte out of `set` */
+        N_CONCAT,       /* a then b */
+        N_ALT,          /* a or b */
+        N_REPEAT,       /* a repeated min..max times, max == -1 means no limit */
+        N_BOL,          /* ^ */
+        N_EOL,          /* $ */
+};
+
+struct node {
+        enum node_type type;
+        int a, b;
+        int min, max;
+        uint8_t set[32];
+};
+
+struct parser {
+        const char *p;
+        struct node *nodes;
+        int count;
+        char *err;
+        size_t err_len;
+};
+
+static int fail(struct parser *ps, const char *msg) {
+        if (ps->err && ps->err[0] == '\0')
+                snprintf(ps->err, ps->err_len, "%s", msg);
+        return -1;
+}
+
+static int new_node(struct parser *ps, enum node_type type, int a, int b) {
+        if (ps->count == MAX_NODES)
+                return fail(ps, "regex too long");
+        struct node *n = &ps->nodes[ps->count];
+        memset(n, 0, sizeof(*n));
+        n->type = type;
+        n->a = a;
+        n->b = b;
+        return ps->count++;
+}
+
+static void set_range(uint8_t *set, int lo, int hi) {
+        for (int c = lo; c <= hi; c++)
+                SET_ADD(set, c);
+}
+
+static void set_negate(uint8_t *set) {
+        for (int i = 0; i < 32; i++)
+                set[i] = ~set[i];
+}
+
+static int hex_value(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+}
+
+/* Parse the escape after a backslash. Single bytes are returned (so that
+ * they can start a range inside [...]), classes are added to `set` and
+ * -2 is returned. */
+static int parse_escape(struct parser *ps, uint8_t *set) {
+        char c = *ps->p++;
+        uint8_t tmp[32] = { 0 };
+        int negate = 0;
+
+        switch (c) {
+        case '\0':
+                ps->p--;
+                return fail(ps, "trailing backslash");
+        case 'D': negate = 1; /* fall through */
+        case 'd':
+                set_range(tmp, '0', '9');
+                break;
+        case 'W': negate = 1; /* fall through */
+        case 'w':
+                set_range(tmp, '0', '9');
+                set_range(tmp, 'A', 'Z');
+                set_range(tmp, 'a', 'z');
+                SET_ADD(tmp, '_');
+                break;
+        case 'S': negate = 1; /* fall through */
+        case 's':
+                SET_ADD(tmp, ' ');
+                set_range(tmp, '\t', '\r');
+                break;
+        case 't': return '\t';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        case 'x': {
+                int hi = hex_value(ps->p[0]);
+                int lo = hi < 0 ? -1 : hex_value(ps->p[1]);
+                if (lo < 0)
+                        return fail(ps, "invalid \\x escape");
+                ps->p += 2;
+                return hi << 4 | lo;
+        }
+        default:
+                if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+                    (c >= 'a' && c <= 'z'))
+                        return fail(ps, "unsupported escape");
+                return (uint8_t)c;
+        }
+
+        if (negate)
+                set_negate(tmp);
+        for (int i = 0; i < 32; i++)
+                set[i] |= tmp[i];
+        return -2;
+}
+
+/* [...] and [^...] */
+static int parse_class(struct parser *ps, uint8_t *set) {
+        int negate = 0;
+
+        if (*ps->p == '^') {
+                negate = 1;
+                ps->p++;
+        }
+
+        int first = 1;
+        while (*ps->p != ']' || first) {
+                int lo;
+
+                first = 0;
+                if (*ps->p == '\0')
+                        return fail(ps, "missing ]");
+                if (*ps->p == '\\') {
+                        ps->p++;
+                        lo = parse_escape(ps, set);
+                        if (lo == -1) return -1;
+                        if (lo == -2) continue;
+                } else {
+                        lo = (uint8_t)*ps->p++;
+                }
+
+                /* Range, unless the '-' is the last char of the class */
+                if (ps->p[0] == '-' && ps->p[1] != ']' && ps->p[1] != '\0') {
+                        int hi;
+                        ps->p++;
+                        if (*ps->p == '\\') {
+                                ps->p++;
+                                hi = parse_escape(ps, set);
+                                if (hi == -1) return -1;
+                                if (hi == -2) return fail(ps, "invalid range in []");
+                        } else {
+                                hi = (uint8_t)*ps->p++;
+                        }
+                        if (hi < lo)
+                                return fail(ps, "invalid range in []");
+                        set_range(set, lo, hi);
+                } else {
+                        SET_ADD(set, lo);
+                }
+        }
+        ps->p++;
+
+        if (negate)
+                set_negate(set);
+        return 0;
+}
+
+static int parse_alt(struct parser *ps);
+
+static int parse_atom(struct parser *ps) {
+        int n;
+        char c = *ps->p++;
+
+        switch (c) {
+        case '(':
+                if (ps->p[0] == '?' && ps->p[1] == ':')
+                        ps->p += 2;
+                n = parse_alt(ps);
+                if (n < 0) return -1;
+                if (*ps->p != ')')
+                        return fail(ps, "missing )");
+                ps->p++;
+                return n;
+        case '[':
+                n = new_node(ps, N_SET, -1, -1);
+                if (n < 0 || parse_class(ps, ps->nodes[n].set) < 0) return -1;
+                return n;
+        case '.':
+                n = new_node(ps, N_SET, -1, -1);
+                if (n < 0) return -1;
+                set_range(ps->nodes[n].set, 0, 255);
+                ps->nodes[n].set['\n' >> 3] &= ~(1 << ('\n' & 7));
+                return n;
+        case '^':
+                return new_node(ps, N_BOL, -1, -1);
+        case '$':
+                return new_node(ps, N_EOL, -1, -1);
+        case '*': case '+': case '?': case '{':
+                return fail(ps, "nothing to repeat");
+        case '\\': {
+                uint8_t set[32] = { 0 };
+                int b = parse_escape(ps, set);
+                if (b == -1) return -1;
+                n = new_node(ps, N_SET, -1, -1);
+                if (n < 0) return -1;
+                memcpy(ps->nodes[n].set, set, sizeof(set));
+                if (b >= 0) SET_ADD(ps->nodes[n].set, b);
+                return n;
+        }
+        default:
+                n = new_node(ps, N_SET, -1, -1);
+                if (n < 0) return -1;
+                SET_ADD(ps->nodes[n].set, c);
+                return n;
+        }
+}
+
+static int parse_number(struct parser *ps) {
+        int v = 0;
+        if (*ps->p < '0' || *ps->p > '9')
+                return -1;
+        while (*ps->p >= '0' && *ps->p <= '9') {
+                v = v * 10 + (*ps->p++ - '0');
+                if (v > MAX_REPEAT) return MAX_REPEAT + 1;
+        }
+        return v;
+}
+
+static int parse_repeat(struct parser *ps) {
+        int n = parse_atom(ps);
+        if (n < 0) return -1;
+
+        for (;;) {
+                int min, max;
+                char c = *ps->p;
+
+                if (c == '*') {
+                        min = 0; max = -1;
+                } else if (c == '+') {
+                        min = 1; max = -1;
+                } else if (c == '?') {
+                        min = 0; max = 1;
+                } else if (c == '{') {
+                        ps->p++;
+                        min = max = parse_number(ps);
+                        if (min < 0)
+                                return fail(ps, "invalid repetition");
+                        if (*ps->p == ',') {
+                                ps->p++;
+                                max = *ps->p == '}' ? -1 : parse_number(ps);
+                                if (*ps->p != '}' || (max >= 0 && max < min))
+                                        return fail(ps, "invalid repetition");
+                        }
+                        if (*ps->p != '}')
+                                return fail(ps, "invalid repetition");
+                        if (min > MAX_REPEAT || max > MAX_REPEAT)
+                                return fail(ps, "repetition count too big");
+                } else {
+                        return n;
+                }
+                ps->p++;
+
+                /* Lazy quantifiers are accepted, matches are the longest anyway */
+                if (*ps->p == '?')
+                        ps->p++;
+
+                int r = new_node(ps, N_REPEAT, n, -1);
+                if (r < 0) return -1;
+                ps->nodes[r].min = min;
+                ps->nodes[r].max = max;
+                n = r;
+        }
+}
+
+static int parse_concat(struct parser *ps) {
+        int left = -1;
+
+        while (*ps->p != '\0' && *ps->p != '|' && *ps->p != ')') {
+                int right = parse_repeat(ps);
+                if (right < 0) return -1;
+                left = left < 0 ? right : new_node(ps, N_CONCAT, left, right);
+                if (left < 0) return -1;
+        }
+        return left < 0 ? new_node(ps, N_EMPTY, -1, -1) : left;
+}
+
+static int parse_alt(struct parser *ps) {
+        int left = parse_concat(ps);
+
+        while (left >= 0 && *ps->p == '|') {
+                ps->p++;
+                int right = parse_concat(ps);
+                if (right < 0) return -1;
+                left = new_node(ps, N_ALT, left, right);
+        }
+        return left;
+}
+
+/* ========================= Required literal =========================== */
+
+/* If the node only matches one string, write it to buf and return its
+ * length, otherwise return -1. */
+static int exact_string(const struct node *nodes, int n, char *buf, int cap) {
+        const struct node *nd = &nodes[n];
+        int len, c = -1;
+
+        switch (nd->type) {
+        case N_EMPTY:
+        case N_BOL:
+        case N_EOL:
+                return 0;
+        case N_SET:
+                for (int b = 0; b < 256; b++) {
+                        if (!SET_HAS(nd->set, b)) continue;
+                        if (c >= 0) return -1;
+                        c = b;
+                }
+                if (c < 0 || cap < 1) return -1;
+                buf[0] = c;
+                return 1;
+        case N_CONCAT:
+                len = exact_string(nodes, nd->a, buf, cap);
+                if (len < 0) return -1;
+                int len2 = exact_string(nodes, nd->b, buf + len, cap - len);
+                return len2 < 0 ? -1 : len + len2;
+        case N_REPEAT:
+                if (nd->min != nd->max) return -1;
+                len = exact_string(nodes, nd->a, buf, cap);
+                if (len < 0 || (long)len * nd->min > cap) return -1;
+                for (int i = 1; i < nd->min; i++)
+                        memcpy(buf + i * len, buf, len);
+                return len * nd->min;
+        default:
+                return -1;
+        }
+}
+
+static void keep_longest(char *best, int *best_len, const char *s, int len) {
+        if (len > *best_len) {
+                memcpy(best, s, len);
+                *best_len = len;
+        }
+}
+
+/* Find the longest literal that every match of the node contains */
+static void required_literal(const struct node *nodes, int n, char *best, int *best_len) {
+        const struct node *nd = &nodes[n];
+        char run[MAX_LITERAL], tmp[MAX_LITERAL];
+        int run_len = 0;
+        int stack[MAX_NODES], sp = 0, len;
+
+        switch (nd->type) {
+        case N_SET:
+                len = exact_string(nodes, n, tmp, sizeof(tmp));
+                if (len > 0) keep_longest(best, best_len, tmp, len);
+                return;
+        case N_REPEAT:
+                if (nd->min >= 1) {
+                        len = exact_string(nodes, n, tmp, sizeof(tmp));
+                        if (len > 0) keep_longest(best, best_len, tmp, len);
+                        else required_literal(nodes, nd->a, best, best_len);
+                }
+                return;
+        case N_CONCAT:
+                /* Walk the concatenated items in order, joining the runs of
+                 * exact strings */
+                stack[sp++] = n;
+                while (sp > 0) {
+                        int cur = stack[--sp];
+                        if (nodes[cur].type == N_CONCAT) {
+                                stack[sp++] = nodes[cur].b;
+                                stack[sp++] = nodes[cur].a;
+                                continue;
+                        }
+                        len = exact_string(nodes, cur, tmp, sizeof(tmp));
+                        if (len >= 0 && run_len + len <= MAX_LITERAL) {
+                                memcpy(run + run_len, tmp, len);
+                                run_len += len;
+                                continue;
+                        }
+                        keep_longest(best, best_len, run, run_len);
+                        run_len = 0;
+                        if (len >= 0) {
+                                memcpy(run, tmp, len);
+                                run_len = len;
+                        } else {
+                                required_literal(nodes, cur, best, best_len);
+                        }
+                }
+                keep_longest(best, best_len, run, run_len);
+                return;
+        default:
+                /* Alternations (and the rest) don't require anything */
+                return;
+        }
+}
+
+/* ============================== NFA =================================== */
+
+enum state_type { S_SET, S_SPLIT, S_BOL, S_EOL, S_MATCH };
+
+struct nstate {
+        uint8_t type;
+        int out, out1;
+        uint8_t set[32];
+};
+
+struct regex_prog_t {
+        struct nstate *states;
+        int n;
+        int start;
+        uint8_t classes[256];       /* Byte -> byte class */
+        uint8_t class_rep[256];     /* Byte class -> one of its bytes */
+        int nclasses;
+        char literal[MAX_LITERAL];
+        int literal_len;
+};
+
+static int new_state(struct regex_prog_t *prog, enum state_type type, int out, int out1) {
+        if (prog->n == MAX_NFA_STATES)
+                return -1;
+        struct nstate *s = &prog->states[prog->n];
+        memset(s, 0, sizeof(*s));
+        s->type = type;
+        s->out = out;
+        s->out1 = out1;
+        return prog->n++;
+}
+
+/* Compile node n so that it continues to state `next`, returns its entry */
+static int compile_node(struct regex_prog_t *prog, const struct node *nodes, int n, int next) {
+        const struct node *nd = &nodes[n];
+        int s, x;
+
+        if (next < 0) return -1;
+
+        switch (nd->type) {
+        case N_EMPTY:
+                return next;
+        case N_SET:
+                s = new_state(prog, S_SET, next, -1);
+                if (s >= 0) memcpy(prog->states[s].set, nd->set, 32);
+                return s;
+        case N_BOL:
+                return new_state(prog, S_BOL, next, -1);
+        case N_EOL:
+                return new_state(prog, S_EOL, next, -1);
+        case N_CONCAT:
+                return compile_node(prog, nodes, nd->a,
+                                    compile_node(prog, nodes, nd->b, next));
+        case N_ALT:
+                x = compile_node(prog, nodes, nd->a, next);
+                if (x < 0) return -1;
+                return new_state(prog, S_SPLIT, x,
+                                 compile_node(prog, nodes, nd->b, next));
+        case N_REPEAT:
+                x = next;
+                if (nd->max < 0) {
+                        /* Loop: split -> (child -> split) | next */
+                        s = new_state(prog, S_SPLIT, -1, next);
+                        if (s < 0) return -1;
+                        prog->states[s].out = compile_node(prog, nodes, nd->a, s);
+                        if (prog->states[s].out < 0) return -1;
+                        x = s;
+                } else {
+                        /* Optional copies, nested: (c(c(c)?)?)? */
+                        for (int i = nd->min; i < nd->max && x >= 0; i++)
+                                x = new_state(prog, S_SPLIT,
+                                              compile_node(prog, nodes, nd->a, x), next);
+                }
+                for (int i = 0; i < nd->min && x >= 0; i++)
+                        x = compile_node(prog, nodes, nd->a, x);
+                return x;
+        }
+        return -1;
+}
+
+/* Split the bytes into classes: two bytes are in the same class if every
+ * set of the program contains both or neither. Ranges are good enough. */
+static void compute_classes(struct regex_prog_t *prog) {
+        uint8_t boundary[256] = { 0 };
+
+        for (int i = 0; i < prog->n; i++) {
+                if (prog->states[i].type != S_SET) continue;
+                const uint8_t *set = prog->states[i].set;
+                for (int b = 1; b < 256; b++) {
+                        if (!SET_HAS(set, b) != !SET_HAS(set, b - 1))
+                                boundary[b] = 1;
+                }
+        }
+
+        int cls = 0;
+        prog->class_rep[0] = 0;
+        for (int b = 0; b < 256; b++) {
+                if (boundary[b]) {
+                        cls++;
+                        prog->class_rep[cls] = b;
+                }
+                prog->classes[b] = cls;
+        }
+        prog->nclasses = cls + 1;
+}
+
+/* ============================ Lazy DFA ================================ */
+
+#define F_MATCH 1
+#define F_EOL_MATCH 2
+#define F_DEAD 4        /* Anchored state without any NFA state left */
+
+struct regex_dfa_t {
+        const struct regex_prog_t *prog;
+        int ncls;
+
+        int max_states;
+        int nstates;
+        int32_t *trans;         /* nstates * ncls transitions, -1 unknown */
+        uint8_t *flags;
+        int32_t *set_off;       /* NFA states of a DFA state, in arena */
+        int32_t *set_len;
+        uint32_t *set_hash;
+        int32_t *arena;
+        size_t arena_len;
+        size_t arena_cap;
+        int32_t *table;         /* Hash table of states, -1 empty */
+        uint32_t table_mask;
+        int start[2];           /* Start state not at/at beginning of line */
+        int anchored[2];        /* The same for the anchored runs */
+
+        /* Scratch space for closures */
+        int32_t *stack;
+        int32_t *list;
+        int32_t *list2;
+        uint32_t *mark;
+        uint32_t gen;
+
+        uint64_t flushes;
+};
+
+static int cmp_int(const void *a, const void *b) {
+        return *(const int32_t *)a - *(const int32_t *)b;
+}
+
+/* Epsilon closure of in[], sorted. Only the states that can consume a
+ * byte, the match state and the pending $ assertions are kept. */
+static int closure(struct regex_dfa_t *dfa, const int32_t *in, int nin,
+                   int bol, int eol, int32_t *out) {
+        const struct nstate *states = dfa->prog->states;
+        int sp = 0, n = 0;
+
+        if (++dfa->gen == 0) {
+                memset(dfa->mark, 0, dfa->prog->n * sizeof(*dfa->mark));
+                dfa->gen = 1;
+        }
+        for (int i = 0; i < nin; i++)
+                dfa->stack[sp++] = in[i];
+
+        while (sp > 0) {
+                int s = dfa->stack[--sp];
+                if (dfa->mark[s] == dfa->gen) continue;
+                dfa->mark[s] = dfa->gen;
+
+                switch (states[s].type) {
+                case S_SPLIT:
+                        dfa->stack[sp++] = states[s].out1;
+                        dfa->stack[sp++] = states[s].out;
+                        break;
+                case S_BOL:
+                        if (bol) dfa->stack[sp++] = states[s].out;
+                        break;
+                case S_EOL:
+                        if (eol) dfa->stack[sp++] = states[s].out;
+                        else out[n++] = s;
+                        break;
+                default:
+                        out[n++] = s;
+                        break;
+                }
+        }
+        qsort(out, n, sizeof(*out), cmp_int);
+        return n;
+}
+
+static uint32_t hash_set(const int32_t *set, int n) {
+        uint32_t h = 2166136261u;
+        for (int i = 0; i < n; i++) {
+                h ^= (uint32_t)set[i];
+                h *= 16777619u;
+        }
+        return h;
+}
+
+static void dfa_flush(struct regex_dfa_t *dfa) {
+        dfa->nstates = 0;
+        dfa->arena_len = 0;
+        dfa->start[0] = dfa->start[1] = -1;
+        dfa->anchored[0] = dfa->anchored[1] = -1;
+        memset(dfa->table, 0xff, (dfa->table_mask + 1) * sizeof(*dfa->table));
+        dfa->flushes++;
+}
+
+static uint8_t state_flags(struct regex_dfa_t *dfa, const int32_t *set, int n) {
+        const struct nstate *states = dfa->prog->states;
+        uint8_t flags = 0;
+        int neol = 0;
+
+        /* The anchored marker isn't an NFA state */
+        if (n > 0 && set[n - 1] == dfa->prog->n) {
+                if (--n == 0) return F_DEAD;
+        }
+        for (int i = 0; i < n; i++) {
+                if (states[set[i]].type == S_MATCH)
+                        flags |= F_MATCH | F_EOL_MATCH;
+                else if (states[set[i]].type == S_EOL)
+                        dfa->list2[neol++] = states[set[i]].out;
+        }
+
+        /* Would the pending $ assertions match at the end of the line? */
+        if (!(flags & F_MATCH) && neol > 0) {
+                int32_t *tmp = dfa->list2 + neol;
+                int m = closure(dfa, dfa->list2, neol, 0, 1, tmp);
+                for (int i = 0; i < m; i++) {
+                        if (states[tmp[i]].type == S_MATCH)
+                                flags |= F_EOL_MATCH;
+                }
+        }
+        return flags;
+}
+
+/* Find or add the state for set[]. Returns -1 when the cache is full */
+static int find_state(struct regex_dfa_t *dfa, const int32_t *set, int n) {
+        uint32_t h = hash_set(set, n);
+        uint32_t slot = h & dfa->table_mask;
+
+        for (; dfa->table[slot] >= 0; slot = (slot + 1) & dfa->table_mask) {
+                int s = dfa->table[slot];
+                if (dfa->set_hash[s] == h && dfa->set_len[s] == n &&
+                    memcmp(dfa->arena + dfa->set_off[s], set, n * sizeof(*set)) == 0)
+                        return s;
+        }
+
+        if (dfa->nstates == dfa->max_states || dfa->arena_len + n > dfa->arena_cap)
+                return -1;
+
+        int s = dfa->nstates++;
+        memcpy(dfa->arena + dfa->arena_len, set, n * sizeof(*set));
+        dfa->set_off[s] = dfa->arena_len;
+        dfa->set_len[s] = n;
+        dfa->set_hash[s] = h;
+        dfa->arena_len += n;
+        for (int c = 0; c < dfa->ncls; c++)
+                dfa->trans[(size_t)s * dfa->ncls + c] = -1;
+        dfa->table[slot] = s;
+
+        /* state_flags() uses list2, which may hold `set` itself */
+        int32_t *copy = dfa->arena + dfa->set_off[s];
+        dfa->flags[s] = state_flags(dfa, copy, n);
+        return s;
+}
+
+/* Like find_state(), but flushes the cache when it's full */
+static int add_state(struct regex_dfa_t *dfa, const int32_t *set, int n) {
+        int s = find_state(dfa, set, n);
+        if (s < 0) {
+                dfa_flush(dfa);
+                s = find_state(dfa, set, n);
+        }
+        return s;
+}
+
+static int start_state(struct regex_dfa_t *dfa, int bol) {
+        if (dfa->start[bol] < 0) {
+                int32_t start = dfa->prog->start;
+                int n = closure(dfa, &start, 1, bol, 0, dfa->list);
+                int s = add_state(dfa, dfa->list, n);
+                /* A flush also forgets the other start state */
+                dfa->start[bol] = s;
+        }
+        return dfa->start[bol];
+}
+
+static int anchored_state(struct regex_dfa_t *dfa, int bol) {
+        if (dfa->anchored[bol] < 0) {
+                int32_t start = dfa->prog->start;
+                int n = closure(dfa, &start, 1, bol, 0, dfa->list);
+                dfa->list[n++] = dfa->prog->n;
+                dfa->anchored[bol] = add_state(dfa, dfa->list, n);
+        }
+        return dfa->anchored[bol];
+}
+
+/* Build the transition of state s on byte class c */
+static int dfa_step(struct regex_dfa_t *dfa, int s, int c) {
+        const struct nstate *states = dfa->prog->states;
+        uint8_t b = dfa->prog->class_rep[c];
+        const int32_t *set = dfa->arena + dfa->set_off[s];
+        int len = dfa->set_len[s];
+        int anchored = len > 0 && set[len - 1] == dfa->prog->n;
+        int n = 0;
+
+        for (int i = 0; i < len - anchored; i++) {
+                const struct nstate *st = &states[set[i]];
+                if (st->type == S_SET && SET_HAS(st->set, b))
+                        dfa->list2[n++] = st->out;
+        }
+        if (!anchored)
+                dfa->list2[n++] = dfa->prog->start;  /* unanchored search */
+
+        n = closure(dfa, dfa->list2, n, 0, 0, dfa->list);
+        if (anchored)
+                dfa->list[n++] = dfa->prog->n;
+
+        int t = find_state(dfa, dfa->list, n);
+        if (t >= 0) {
+                dfa->trans[(size_t)s * dfa->ncls + c] = t;
+                return t;
+        }
+
+        /* s is gone with the flush, so the edge is not cached */
+        dfa_flush(dfa);
+        return find_state(dfa, dfa->list, n);
+}
+
+/* ============================== API =================================== */
+
+struct regex_prog_t *regex_compile(const char *pattern, char *err, size_t err_len) {
+        struct parser ps = {
+                .p = pattern,
+                .err = err,
+                .err_len = err_len,
+        };
+        struct regex_prog_t *prog = NULL;
+
+        if (err && err_len) err[0] = '\0';
+
+        ps.nodes = malloc(MAX_NODES * sizeof(*ps.nodes));
+        if (!ps.nodes) {
+                fail(&ps, "out of memory");
+                return NULL;
+        }
+
+        int root = parse_alt(&ps);
+        if (root >= 0 && *ps.p != '\0') {
+                fail(&ps, "unmatched )");
+                root = -1;
+        }
+        if (root < 0) goto out;
+
+        prog = calloc(1, sizeof(*prog));
+        if (prog) prog->states = malloc(MAX_NFA_STATES * sizeof(*prog->states));
+        if (!prog || !prog->states) {
+                fail(&ps, "out of memory");
+                goto error;
+        }
+
+        int match = new_state(prog, S_MATCH, -1, -1);
+        prog->start = compile_node(prog, ps.nodes, root, match);
+        if (prog->start < 0) {
+                fail(&ps, "regex too big");
+                goto error;
+        }
+        compute_classes(prog);
+        required_literal(ps.nodes, root, prog->literal, &prog->literal_len);
+
+        /* Counting empty matches makes no sense, refuse them */
+        struct regex_dfa_t *dfa = regex_dfa_new(prog, 0);
+        if (!dfa) {
+                fail(&ps, "out of memory");
+                goto error;
+        }
+        int32_t start = prog->start;
+        int n = closure(dfa, &start, 1, 1, 1, dfa->list);
+        int empty = 0;
+        for (int i = 0; i < n; i++)
+                empty |= prog->states[dfa->list[i]].type == S_MATCH;
+        regex_dfa_free(dfa);
+        if (empty) {
+                fail(&ps, "regex matches the empty string");
+                goto error;
+        }
+        goto out;
+
+error:
+        regex_free(prog);
+        prog = NULL;
+out:
+        free(ps.nodes);
+        return prog;
+}
+
+void regex_free(struct regex_prog_t *prog) {
+        if (!prog) return;
+        free(prog->states);
+        free(prog);
+}
+
+const char *regex_literal(const struct regex_prog_t *prog, int *len) {
+        *len = prog->literal_len;
+        return prog->literal;
+}
+
+struct regex_dfa_t *regex_dfa_new(const struct regex_prog_t *prog, size_t cache_size) {
+        struct regex_dfa_t *dfa = calloc(1, sizeof(*dfa));
+        if (!dfa) return NULL;
+
+        dfa->prog = prog;
+        dfa->ncls = prog->nclasses;
+
+        /* Transitions, flags, set bookkeeping, hash slots and ~8 NFA states */
+        size_t per_state = dfa->ncls * sizeof(int32_t) + 1 + 3 * sizeof(int32_t) +
+                           2 * sizeof(int32_t) + 8 * sizeof(int32_t);
+        dfa->max_states = MAX(cache_size / per_state, 16);
+        dfa->arena_cap = MAX((size_t)dfa->max_states * 8, (size_t)prog->n * 2);
+
+        uint32_t slots = 1;
+        while (slots < (uint32_t)dfa->max_states * 2) slots <<= 1;
+        dfa->table_mask = slots - 1;
+
+        dfa->trans = malloc((size_t)dfa->max_states * dfa->ncls * sizeof(*dfa->trans));
+        dfa->flags = malloc(dfa->max_states);
+        dfa->set_off = malloc(dfa->max_states * sizeof(*dfa->set_off));
+        dfa->set_len = malloc(dfa->max_states * sizeof(*dfa->set_len));
+        dfa->set_hash = malloc(dfa->max_states * sizeof(*dfa->set_hash));
+        dfa->arena = malloc(dfa->arena_cap * sizeof(*dfa->arena));
+        dfa->table = malloc(slots * sizeof(*dfa->table));
+        dfa->stack = malloc((4 * prog->n + 4) * sizeof(*dfa->stack));
+        dfa->list = malloc((prog->n + 1) * sizeof(*dfa->list));
+        dfa->list2 = malloc((2 * prog->n + 2) * sizeof(*dfa->list2));
+        dfa->mark = calloc(prog->n, sizeof(*dfa->mark));
+
+        if (!dfa->trans || !dfa->flags || !dfa->set_off || !dfa->set_len ||
+            !dfa->set_hash || !dfa->arena || !dfa->table || !dfa->stack ||
+            !dfa->list || !dfa->list2 || !dfa->mark) {
+                regex_dfa_free(dfa);
+                return NULL;
+        }
+
+        dfa_flush(dfa);
+        dfa->flushes = 0;
+        return dfa;
+}
+
+void regex_dfa_free(struct regex_dfa_t *dfa) {
+        if (!dfa) return;
+        free(dfa->trans);
+        free(dfa->flags);
+        free(dfa->set_off);
+        free(dfa->set_len);
+        free(dfa->set_hash);
+        free(dfa->arena);
+        free(dfa->table);
+        free(dfa->stack);
+        free(dfa->list);
+        free(dfa->list2);
+        free(dfa->mark);
+        free(dfa);
+}
+
+static inline int next_state(struct regex_dfa_t *dfa, int s, uint8_t byte) {
+        int c = dfa->prog->classes[byte];
+        int t = dfa->trans[(size_t)s * dfa->ncls + c];
+        return t >= 0 ? t : dfa_step(dfa, s, c);
+}
+
+/* End of the longest match starting at line[from], 0 if none does */
+static size_t longest_match(struct regex_dfa_t *dfa, const char *line, size_t len,
+                            size_t from) {
+        int s = anchored_state(dfa, from == 0);
+        size_t end = 0;
+
+        for (size_t i = from; i < len && !(dfa->flags[s] & F_DEAD); i++) {
+                s = next_state(dfa, s, line[i]);
+                if (dfa->flags[s] & F_MATCH)
+                        end = i + 1;
+        }
+        /* Dead states have no flag: s has read the whole line */
+        if (dfa->flags[s] & F_EOL_MATCH)
+                end = len;
+        return end;
+}
+
+uint64_t regex_dfa_count_line(struct regex_dfa_t *dfa, const char *line, size_t len) {
+        uint64_t count = 0;
+        size_t i = 0;
+
+        while (i < len) {
+                /* Where the earliest match from i on ends */
+                int s = start_state(dfa, i == 0);
+                size_t e = i;
+                while (e < len && !(dfa->flags[s] & F_MATCH))
+                        s = next_state(dfa, s, line[e++]);
+                if (!(dfa->flags[s] & (F_MATCH | F_EOL_MATCH)))
+                        break;
+
+                /* The leftmost match starts before e */
+                size_t end = 0;
+                for (size_t from = i; from < e && end == 0; from++)
+                        end = longest_match(dfa, line, len, from);
+                if (end == 0)
+                        break;
+                count++;
+                i = end;
+        }
+        return count;
+}
+
+uint64_t regex_dfa_flushes(const struct regex_dfa_t *dfa) {
+        return dfa->flushes;
+}
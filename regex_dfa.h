@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ======================= Regular expressions ===========================
+ *
+ * A small regex engine made for counting: the pattern is compiled once
+ * into a Thompson NFA (struct regex_prog_t, immutable and shared by every
+ * thread) and each thread runs it through its own lazy DFA
+ * (struct regex_dfa_t), whose states are built on demand and kept in a
+ * bounded cache which is flushed when full.
+ *
+ * Matches never span a newline: the text is matched one line at a time.
+ * Matches are counted like `grep -o` finds them: leftmost-longest and
+ * not overlapping, so `ERR[0-9]{4}` is found once in "ERR12345", `\d+`
+ * twice in "ERR12345 ERR1234" and `[a-z]+` once per lowercase word.
+ *
+ * Supported syntax:
+ *   literals, `.`, `[...]`, `[^...]` with ranges, `\d \D \w \W \s \S`,
+ *   `\t \n \r \xHH`, escaped punctuation, `(...)`, `(?:...)`, `|`,
+ *   `* + ?`, `{n} {n,} {n,m}`, `^` and `$` (start/end of line).
+ */
+#ifndef REGEX_DFA_H
+#define REGEX_DFA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Default memory budget of the state cache of each thread */
+#ifndef REGEX_DFA_CACHE_SIZE
+#define REGEX_DFA_CACHE_SIZE (1 << 20)
+#endif
+
+struct regex_prog_t;
+struct regex_dfa_t;
+
+/* Compile `pattern`. On error returns NULL and writes a message to err */
+struct regex_prog_t *regex_compile(const char *pattern, char *err, size_t err_len);
+void regex_free(struct regex_prog_t *prog);
+
+/* Longest literal every match has to contain (may be empty), used to
+ * skip the lines which can't match without running the DFA on them. */
+const char *regex_literal(const struct regex_prog_t *prog, int *len);
+
+/* Per-thread lazy DFA using at most about `cache_size` bytes */
+struct regex_dfa_t *regex_dfa_new(const struct regex_prog_t *prog, size_t cache_size);
+void regex_dfa_free(struct regex_dfa_t *dfa);
+
+/* Count the matches in a single line (without its '\n') */
+uint64_t regex_dfa_count_line(struct regex_dfa_t *dfa, const char *line, size_t len);
+
+/* Times the state cache has been flushed since regex_dfa_new() */
+uint64_t regex_dfa_flushes(const struct regex_dfa_t *dfa);
+
+#endif /* REGEX_DFA_H */
@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "tsearch.h"
+#include "server.h"
+#include "fuzzy.h"
+#include "pool.h"
+
+/* Longest file name accepted in a request */
+#define SERVE_MAX_PATH 4096
+
+static volatile sig_atomic_t stopping;
+
+/* The options every search of the server starts from */
+static struct search_opts_t server_opts;
+static int server_workers;
+
+/* The searches running on the pool, which can't be freed under them */
+static pthread_mutex_t searches_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t searches_done = PTHREAD_COND_INITIALIZER;
+static int searches;
+static int draining;            /* The server stops, no new search */
+
+static void on_signal(int sig) {
+        (void)sig;
+        stopping = 1;
+}
+
+/* Read or write exactly len bytes, 0 on success */
+static int read_all(int fd, void *buf, size_t len) {
+        char *p = buf;
+
+        while (len > 0) {
+                ssize_t n = read(fd, p, len);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return -1;
+                p += n;
+                len -= n;
+        }
+        return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+        const char *p = buf;
+
+        while (len > 0) {
+                ssize_t n = write(fd, p, len);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return -1;
+                p += n;
+                len -= n;
+        }
+        return 0;
+}
+
+/* 0 if the request can be read: the connection is dropped otherwise */
+static int check_framing(const struct serve_request *req) {
+        if (req->magic != SERVE_MAGIC || req->version != SERVE_VERSION)
+                return -1;
+        if (req->filename_len == 0 || req->filename_len >= SERVE_MAX_PATH)
+                return -1;
+        if (req->word_len == 0 || req->word_len >= MAX_WORD_LENGTH)
+                return -1;
+        return 0;
+}
+
+/* The same checks as the command line: 0 if the request can be run, or
+ * the status of the response */
+static int check_request(const struct serve_request *req) {
+        if (req->mode < SEARCH_WORD || req->mode > SEARCH_WILDCARD)
+                return -1;
+        if (req->overlapping && req->mode != SEARCH_SUBSTRING)
+                return -1;
+        if (req->mode == SEARCH_FUZZY &&
+            (req->max_errors < 0 || req->max_errors >= FUZZY_MAX_WORD))
+                return -1;
+        /* The table is global to the process, it can't change per search */
+        if (memcmp(req->word_chars, word_chars, sizeof(word_chars)) != 0)
+                return SERVE_WORD_CHARS;
+        return 0;
+}
+
+/* Run one search, response->status tells if it failed */
+static void answer(const struct serve_request *req, char *filename, char *word,
+                   struct serve_response *response) {
+        struct search_opts_t opts = server_opts;
+        char index[SERVE_MAX_PATH + 8], trigrams[SERVE_MAX_PATH + 8];
+        char bloom[SERVE_MAX_PATH + 8], fm[SERVE_MAX_PATH + 8];
+
+        opts.mode = req->mode;
+        opts.overlapping = req->overlapping;
+        opts.max_errors = req->max_errors;
+        if (!(req->flags & SERVE_NO_INDEX)) {
+                snprintf(index, sizeof(index), "%s.tsidx", filename);
+                snprintf(trigrams, sizeof(trigrams), "%s.tstri", filename);
+                snprintf(bloom, sizeof(bloom), "%s.tsblm", filename);
+                snprintf(fm, sizeof(fm), "%s.tsfm", filename);
+                opts.index_path = index;
+                opts.trigram_path = trigrams;
+                opts.bloom_path = bloom;
+                opts.fm_path = fm;
+        }
+
+        /* 0 threads: as many chunks as workers */
+        uint8_t threads = req->threads ? (uint8_t)MIN(req->threads, 255u) :
+                                          (uint8_t)MIN(server_workers, 255);
+
+        pthread_mutex_lock(&searches_lock);
+        if (draining) {
+                pthread_mutex_unlock(&searches_lock);
+                response->status = -1;
+                return;
+        }
+        searches++;
+        pthread_mutex_unlock(&searches_lock);
+
+        LOG("Searching for word '%s' in '%s' using %d threads", word, filename, threads);
+        struct search_result_t *res = tsearch(filename, word, &opts, threads);
+
+        pthread_mutex_lock(&searches_lock);
+        if (--searches == 0)
+                pthread_cond_broadcast(&searches_done);
+        pthread_mutex_unlock(&searches_lock);
+        if (!res) {
+                response->status = -1;
+                return;
+        }
+        response->occurrences = res->occurrences;
+        response->elapsed_time = res->elapsed_time;
+        response->elapsed_ns = res->elapsed_ns;
+        response->bytes = res->bytes;
+        free(res);
+}
+
+/* Answer the requests of a client until it hangs up */
+static void *serve_client(void *arg) {
+        int fd = (int)(intptr_t)arg;
+        struct serve_request req;
+        char filename[SERVE_MAX_PATH];
+        char word[MAX_WORD_LENGTH];
+
+        while (read_all(fd, &req, sizeof(req)) == 0) {
+                struct serve_response response = { .magic = SERVE_MAGIC };
+
+                if (check_framing(&req) != 0) {
+                        ERR("Invalid request, closing the connection");
+                        break;
+                }
+                if (read_all(fd, filename, req.filename_len) != 0 ||
+                    read_all(fd, word, req.word_len) != 0)
+                        break;
+                filename[req.filename_len] = '\0';
+                word[req.word_len] = '\0';
+
+                response.status = check_request(&req);
+                if (response.status == 0)
+                        answer(&req, filename, word, &response);
+                if (write_all(fd, &response, sizeof(response)) != 0)
+                        break;
+        }
+        close(fd);
+        return NULL;
+}
+
+/* Listen at path, replacing the socket of a previous server */
+static int listen_at(const char *path) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        struct stat st;
+
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+                ERR("Socket path '%s' is too long", path);
+                return -1;
+        }
+        strcpy(addr.sun_path, path);
+
+        if (lstat(path, &st) == 0) {
+                if (!S_ISSOCK(st.st_mode)) {
+                        ERR("'%s' exists and isn't a socket", path);
+                        return -1;
+                }
+                unlink(path);
+        }
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+                ERR("Failed to create a socket: %s", strerror(errno));
+                return -1;
+        }
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+                ERR("Failed to listen at '%s': %s", path, strerror(errno));
+                close(fd);
+                return -1;
+        }
+        return fd;
+}
+
+int tsearch_serve(const char *path, int workers, const struct search_opts_t *defaults) {
+        struct sigaction sa = { .sa_handler = on_signal };
+        pthread_attr_t attr;
+
+        server_opts = *defaults;
+        server_workers = workers;
+
+        struct pool_t *pool = pool_new(workers);
+        if (!pool) {
+                ERR("Failed to start %d workers", workers);
+                return -1;
+        }
+        tsearch_set_pool(pool);
+
+        int fd = listen_at(path);
+        if (fd < 0) {
+                tsearch_set_pool(NULL);
+                pool_free(pool);
+                return -1;
+        }
+
+        /* No SA_RESTART: accept() has to return to see the signal */
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+        signal(SIGPIPE, SIG_IGN);
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        LOG("Serving at '%s' with %d workers", path, workers);
+        while (!stopping) {
+                pthread_t thread;
+
+                int client = accept(fd, NULL, NULL);
+                if (client < 0) {
+                        if (errno != EINTR)
+                                ERR("Failed to accept a connection: %s", strerror(errno));
+                        continue;
+                }
+                if (pthread_create(&thread, &attr, serve_client, (void *)(intptr_t)client) != 0) {
+                        ERR("Failed to create a thread for a client");
+                        close(client);
+                }
+        }
+        LOG("Stopping the server at '%s'", path);
+
+        pthread_attr_destroy(&attr);
+        close(fd);
+        unlink(path);
+        /* The clients still connected are left to the exit of the
+         * process, which is the only thing to follow, but the searches
+         * they're running still use the pool */
+        pthread_mutex_lock(&searches_lock);
+        draining = 1;
+        while (searches > 0)
+                pthread_cond_wait(&searches_done, &searches_lock);
+        pthread_mutex_unlock(&searches_lock);
+        tsearch_set_pool(NULL);
+        pool_free(pool);
+        return 0;
+}
+
+struct search_result_t *tsearch_remote(const char *path, const char *filename,
+                                       const char *word, const struct search_opts_t *opts,
+                                       uint8_t threads) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        struct serve_request req = {
+                .magic = SERVE_MAGIC,
+                .version = SERVE_VERSION,
+                .mode = opts->mode,
+                .overlapping = opts->overlapping,
+                .max_errors = opts->max_errors,
+                .threads = threads,
+                .flags = opts->index_path ? 0 : SERVE_NO_INDEX,
+        };
+        struct serve_response response;
+        char real[PATH_MAX];
+
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+                ERR("Socket path '%s' is too long", path);
+                return NULL;
+        }
+        strcpy(addr.sun_path, path);
+        memcpy(req.word_chars, word_chars, sizeof(req.word_chars));
+
+        /* The server doesn't run in our directory */
+        if (!realpath(filename, real)) {
+                ERR("Failed to open file '%s': %s", filename, strerror(errno));
+                return NULL;
+        }
+        req.filename_len = strlen(real);
+        req.word_len = strnlen(word, MAX_WORD_LENGTH - 1);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+                ERR("Failed to create a socket: %s", strerror(errno));
+                return NULL;
+        }
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+                ERR("Failed to connect to '%s': %s", path, strerror(errno));
+                close(fd);
+                return NULL;
+        }
+
+        struct search_result_t *res = NULL;
+        if (write_all(fd, &req, sizeof(req)) != 0 ||
+            write_all(fd, real, req.filename_len) != 0 ||
+            write_all(fd, word, req.word_len) != 0 ||
+            read_all(fd, &response, sizeof(response)) != 0 ||
+            response.magic != SERVE_MAGIC) {
+                ERR("No answer from the server at '%s'", path);
+                goto out;
+        }
+        if (response.status == SERVE_WORD_CHARS) {
+                ERR("The server at '%s' has other word characters, start it with the same --word-chars",
+                    path);
+                goto out;
+        }
+        if (response.status != 0) {
+                ERR("The search failed on the server");
+                goto out;
+        }
+
+        res = calloc(1, sizeof(*res));
+        if (!res) goto out;
+        memcpy(res->word, word, req.word_len);
+        res->occurrences = response.occurrences;
+        res->elapsed_time = response.elapsed_time;
+        res->elapsed_ns = response.elapsed_ns;
+        res->bytes = response.bytes;
+out:
+        close(fd);
+        return res;
+}
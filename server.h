@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ============================ Search server ============================
+ *
+ * `tsearch --serve <socket>` stays resident and answers searches sent on
+ * a Unix domain socket, so many small queries don't each pay for a
+ * process, its threads and its setup: the scans run on a pool of workers
+ * started once (see pool.h). `tsearch --client=<socket> ...` sends the
+ * search of its command line to the server instead of running it.
+ *
+ * A connection carries any number of searches, one after the other. Each
+ * is a struct serve_request followed by filename_len bytes of the (absolute)
+ * file name and word_len bytes of the word, answered by a struct
+ * serve_response. The integers are in the native byte order: client and
+ * server run on the same machine. The request carries the word characters
+ * of the client, and the server refuses it with SERVE_WORD_CHARS if they
+ * aren't its own: they are shared by all its searches. The indexes are the
+ * default ones of the file and --cache applies to all the searches of the
+ * server; the client refuses the options it can't send.
+ */
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+#include "tsearch.h"
+
+#define SERVE_MAGIC    0x51525354   /* "TSRQ" */
+#define SERVE_VERSION  3
+
+/* serve_request.flags */
+#define SERVE_NO_INDEX 1
+
+/* serve_response.status, besides 0 and -1 */
+#define SERVE_WORD_CHARS -2     /* The server has other word characters */
+
+struct serve_request {
+        uint32_t magic;
+        uint32_t version;
+        int32_t  mode;              /* enum search_mode_t */
+        int32_t  overlapping;
+        int32_t  max_errors;
+        uint32_t threads;
+        uint32_t flags;
+        uint32_t filename_len;
+        uint32_t word_len;
+        uint8_t  word_chars[256];   /* The client's, see word_chars_init() */
+};
+
+struct serve_response {
+        uint32_t magic;
+        int32_t  status;            /* 0, -1 if the search failed, SERVE_WORD_CHARS */
+        uint64_t occurrences;
+        int64_t  elapsed_time;      /* Of the search in the server, in ms */
+        int64_t  elapsed_ns;        /* The same in ns */
+        uint64_t bytes;             /* Read by the search */
+};
+
+/* Answer the searches sent on the socket at path with a pool of workers,
+ * until SIGINT or SIGTERM. defaults gives the options of the server. */
+int tsearch_serve(const char *path, int workers, const struct search_opts_t *defaults);
+
+/* Run the search on the server listening at path */
+struct search_result_t *tsearch_remote(const char *path, const char *filename,
+                                       const char *word, const struct search_opts_t *opts,
+                                       uint8_t threads);
+
+#endif /* SERVER_H */
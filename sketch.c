@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "tsearch.h"
+#include "sketch.h"
+
+#define HLL_REGISTERS (1 << SKETCH_HLL_BITS)
+#define SS_SLOTS      (2 * SKETCH_COUNTERS)     /* Power of two */
+
+/* A SpaceSaving candidate: the word was seen at most `count` times, and
+ * at least count - error */
+struct ss_counter {
+        uint64_t count;
+        uint64_t error;
+        uint64_t hash;
+        uint32_t len;
+        uint32_t heap_pos;
+        char     word[MAX_WORD_LENGTH];
+};
+
+struct sketch_t {
+        uint64_t words;
+        uint8_t  hll[HLL_REGISTERS];
+        uint64_t *cm;               /* SKETCH_CM_DEPTH rows */
+        struct ss_counter ctr[SKETCH_COUNTERS];
+        uint32_t nctr;
+        uint32_t heap[SKETCH_COUNTERS];     /* Counters, the smallest count on top */
+        int32_t  slots[SS_SLOTS];           /* Counter of each word by hash, -1 if empty */
+};
+
+/* FNV-1a, mixed so that every bit depends on every byte (HyperLogLog
+ * takes the top bits) */
+static uint64_t hash_word(const char *s, size_t len) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+
+        for (size_t i = 0; i < len; i++) {
+                h ^= (uint8_t)s[i];
+                h *= 0x100000001b3ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+}
+
+struct sketch_t *sketch_new(void) {
+        struct sketch_t *s = calloc(1, sizeof(*s));
+        if (!s) return NULL;
+
+        s->cm = calloc((size_t)SKETCH_CM_DEPTH * SKETCH_CM_WIDTH, sizeof(uint64_t));
+        if (!s->cm) {
+                free(s);
+                return NULL;
+        }
+        for (int i = 0; i < SS_SLOTS; i++)
+                s->slots[i] = -1;
+        return s;
+}
+
+void sketch_free(struct sketch_t *s) {
+        if (!s) return;
+        free(s->cm);
+        free(s);
+}
+
+/* Column of the word in each row of the Count-Min sketch */
+static uint32_t cm_column(uint64_t h, int row) {
+        uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+        return (h1 + (uint32_t)row * h2) & (SKETCH_CM_WIDTH - 1);
+}
+
+static uint64_t cm_estimate(const uint64_t *cm, uint64_t h) {
+        uint64_t est = UINT64_MAX;
+
+        for (int r = 0; r < SKETCH_CM_DEPTH; r++)
+                est = MIN(est, cm[(size_t)r * SKETCH_CM_WIDTH + cm_column(h, r)]);
+        return est;
+}
+
+/* Slot of the word, or the empty slot where it would go */
+static uint32_t ss_find(const struct sketch_t *s, const char *word, size_t len, uint64_t h) {
+        uint32_t i = h & (SS_SLOTS - 1);
+
+        while (s->slots[i] >= 0) {
+                const struct ss_counter *c = &s->ctr[s->slots[i]];
+                if (c->hash == h && c->len == len && memcmp(c->word, word, len) == 0)
+                        break;
+                i = (i + 1) & (SS_SLOTS - 1);
+        }
+        return i;
+}
+
+/* Empty slot i, moving back the words that probed past it */
+static void ss_remove(struct sketch_t *s, uint32_t i) {
+        uint32_t j = i;
+
+        for (;;) {
+                j = (j + 1) & (SS_SLOTS - 1);
+                if (s->slots[j] < 0) break;
+
+                uint32_t home = s->ctr[s->slots[j]].hash & (SS_SLOTS - 1);
+                /* Can the word at j move to i? Only if its home isn't in (i, j] */
+                int between = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+                if (!between) {
+                        s->slots[i] = s->slots[j];
+                        i = j;
+                }
+        }
+        s->slots[i] = -1;
+}
+
+static void heap_swap(struct sketch_t *s, uint32_t a, uint32_t b) {
+        uint32_t t = s->heap[a];
+
+        s->heap[a] = s->heap[b];
+        s->heap[b] = t;
+        s->ctr[s->heap[a]].heap_pos = a;
+        s->ctr[s->heap[b]].heap_pos = b;
+}
+
+static void heap_down(struct sketch_t *s, uint32_t i) {
+        for (;;) {
+                uint32_t c = 2 * i + 1;
+                if (c >= s->nctr) return;
+                if (c + 1 < s->nctr && s->ctr[s->heap[c + 1]].count < s->ctr[s->heap[c]].count)
+                        c++;
+                if (s->ctr[s->heap[i]].count <= s->ctr[s->heap[c]].count) return;
+                heap_swap(s, i, c);
+                i = c;
+        }
+}
+
+static void heap_up(struct sketch_t *s, uint32_t i) {
+        while (i > 0 && s->ctr[s->heap[(i - 1) / 2]].count > s->ctr[s->heap[i]].count) {
+                heap_swap(s, i, (i - 1) / 2);
+                i = (i - 1) / 2;
+        }
+}
+
+void sketch_add(struct sketch_t *s, const char *word, size_t len) {
+        uint64_t h = hash_word(word, len);
+
+        s->words++;
+
+        /* HyperLogLog: the top bits pick the register, which keeps the
+         * longest run of leading zeros seen in the others */
+        uint32_t reg = h >> (64 - SKETCH_HLL_BITS);
+        uint64_t rest = h << SKETCH_HLL_BITS;
+        uint8_t rank = rest ? __builtin_clzll(rest) + 1 : 64 - SKETCH_HLL_BITS + 1;
+        if (rank > s->hll[reg]) s->hll[reg] = rank;
+
+        for (int r = 0; r < SKETCH_CM_DEPTH; r++)
+                s->cm[(size_t)r * SKETCH_CM_WIDTH + cm_column(h, r)]++;
+
+        /* SpaceSaving: a new word takes the place of the least counted
+         * one, inheriting its count as error */
+        uint32_t slot = ss_find(s, word, len, h);
+        struct ss_counter *c;
+        if (s->slots[slot] >= 0) {
+                c = &s->ctr[s->slots[slot]];
+                c->count++;
+                heap_down(s, c->heap_pos);
+                return;
+        }
+
+        uint32_t id;
+        uint64_t min = 0;
+        if (s->nctr < SKETCH_COUNTERS) {
+                id = s->nctr++;
+                s->heap[id] = id;
+                s->ctr[id].heap_pos = id;
+        } else {
+                id = s->heap[0];
+                min = s->ctr[id].count;
+                ss_remove(s, ss_find(s, s->ctr[id].word, s->ctr[id].len, s->ctr[id].hash));
+                slot = ss_find(s, word, len, h);
+        }
+
+        c = &s->ctr[id];
+        c->count = min + 1;
+        c->error = min;
+        c->hash = h;
+        c->len = len;
+        memcpy(c->word, word, len);
+        s->slots[slot] = id;
+        if (min == 0) heap_up(s, c->heap_pos);
+        else heap_down(s, c->heap_pos);
+}
+
+static double hll_estimate(const uint8_t *hll) {
+        double m = HLL_REGISTERS, sum = 0;
+        int zeros = 0;
+
+        for (int i = 0; i < HLL_REGISTERS; i++) {
+                sum += ldexp(1.0, -hll[i]);
+                zeros += hll[i] == 0;
+        }
+        double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+        /* Few distinct words: count the empty registers instead */
+        if (e <= 2.5 * m && zeros > 0)
+                e = m * log(m / zeros);
+        return e;
+}
+
+/* Most frequent first, then by bytes */
+static int cmp_entry(const void *a, const void *b) {
+        const struct sketch_entry_t *x = a, *y = b;
+
+        if (x->count != y->count) return x->count > y->count ? -1 : 1;
+        int c = memcmp(x->word, y->word, MIN(x->len, y->len));
+        if (c) return c;
+        return x->len < y->len ? -1 : x->len > y->len;
+}
+
+struct sketch_result_t *sketch_top(struct sketch_t **parts, int nparts, size_t k) {
+        struct sketch_result_t *res = calloc(1, sizeof(*res));
+        uint8_t *hll = calloc(HLL_REGISTERS, 1);
+        uint64_t *cm = calloc((size_t)SKETCH_CM_DEPTH * SKETCH_CM_WIDTH, sizeof(uint64_t));
+        size_t total = 0, n = 0;
+        uint64_t *hashes = NULL;
+        int32_t *slots = NULL;
+
+        if (!res || !hll || !cm) goto fail;
+        if (k == 0) k = 1;
+        if (k > SKETCH_COUNTERS) k = SKETCH_COUNTERS;
+
+        for (int p = 0; p < nparts; p++) {
+                const struct sketch_t *s = parts[p];
+                res->words += s->words;
+                for (int i = 0; i < HLL_REGISTERS; i++)
+                        hll[i] = MAX(hll[i], s->hll[i]);
+                for (size_t i = 0; i < (size_t)SKETCH_CM_DEPTH * SKETCH_CM_WIDTH; i++)
+                        cm[i] += s->cm[i];
+                total += s->nctr;
+        }
+        res->distinct = hll_estimate(hll);
+
+        /* The candidates of all the threads, once each */
+        size_t nslots = 1;
+        while (nslots < 2 * total + 1) nslots *= 2;
+        res->entries = malloc((total ? total : 1) * sizeof(*res->entries));
+        hashes = malloc((total ? total : 1) * sizeof(uint64_t));
+        slots = malloc(nslots * sizeof(int32_t));
+        if (!res->entries || !hashes || !slots) goto fail;
+        for (size_t i = 0; i < nslots; i++)
+                slots[i] = -1;
+
+        for (int p = 0; p < nparts; p++) {
+                const struct sketch_t *s = parts[p];
+                for (uint32_t j = 0; j < s->nctr; j++) {
+                        const struct ss_counter *c = &s->ctr[j];
+                        size_t i = c->hash & (nslots - 1);
+                        while (slots[i] >= 0) {
+                                const struct sketch_entry_t *e = &res->entries[slots[i]];
+                                if (hashes[slots[i]] == c->hash && e->len == c->len &&
+                                    memcmp(e->word, c->word, c->len) == 0)
+                                        break;
+                                i = (i + 1) & (nslots - 1);
+                        }
+                        if (slots[i] >= 0) continue;
+
+                        slots[i] = n;
+                        hashes[n] = c->hash;
+                        memcpy(res->entries[n].word, c->word, c->len);
+                        res->entries[n].len = c->len;
+                        n++;
+                }
+        }
+
+        /* A thread which didn't keep the word saw it at most as many
+         * times as its least counted candidate, if it had to drop any */
+        for (size_t i = 0; i < n; i++) {
+                struct sketch_entry_t *e = &res->entries[i];
+                uint64_t upper = 0, lower = 0;
+
+                for (int p = 0; p < nparts; p++) {
+                        const struct sketch_t *s = parts[p];
+                        int32_t id = s->slots[ss_find(s, e->word, e->len, hashes[i])];
+                        if (id >= 0) {
+                                upper += s->ctr[id].count;
+                                lower += s->ctr[id].count - s->ctr[id].error;
+                        } else if (s->nctr == SKETCH_COUNTERS) {
+                                upper += s->ctr[s->heap[0]].count;
+                        }
+                }
+                e->count = MIN(upper, cm_estimate(cm, hashes[i]));
+                e->lower = lower;
+        }
+        qsort(res->entries, n, sizeof(*res->entries), cmp_entry);
+        res->n = MIN(n, k);
+
+        free(hll);
+        free(cm);
+        free(hashes);
+        free(slots);
+        return res;
+
+fail:
+        free(hll);
+        free(cm);
+        free(hashes);
+        free(slots);
+        sketch_result_free(res);
+        return NULL;
+}
+
+void sketch_result_free(struct sketch_result_t *res) {
+        if (!res) return;
+        free(res->entries);
+        free(res);
+}
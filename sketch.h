@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ============================== Sketches ===============================
+ *
+ * `--histogram --sketch`: word statistics in a fixed amount of memory per
+ * thread, whatever the size of the input, for files whose distinct words
+ * don't fit in the exact tables of histogram.h.
+ *
+ *  - A HyperLogLog of 2^SKETCH_HLL_BITS registers estimates the number of
+ *    distinct words, within about 1% (1.04 / sqrt(registers)).
+ *  - SpaceSaving keeps SKETCH_COUNTERS candidate heavy hitters per thread:
+ *    a word more frequent than 1 / SKETCH_COUNTERS of the words is always
+ *    among them, with an upper and a lower bound of its count.
+ *  - A Count-Min sketch (SKETCH_CM_DEPTH rows of SKETCH_CM_WIDTH counters)
+ *    gives another upper bound of the count of any word, usually tighter.
+ *
+ * Each thread fills its own sketches, they are merged once the scan is
+ * over: the registers by max, the Count-Min counters by sum and the
+ * candidates by adding up their bounds.
+ */
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tsearch.h"
+
+#define SKETCH_HLL_BITS 14
+#define SKETCH_CM_DEPTH 4
+#define SKETCH_CM_WIDTH (1 << 16)
+#define SKETCH_COUNTERS 1024
+
+struct sketch_t;
+
+/* An estimated heavy hitter */
+struct sketch_entry_t {
+        char     word[MAX_WORD_LENGTH];
+        uint32_t len;
+        uint64_t count;     /* Upper bound */
+        uint64_t lower;     /* Guaranteed occurrences */
+};
+
+struct sketch_result_t {
+        uint64_t words;     /* Occurrences counted, exactly */
+        double distinct;    /* Estimated distinct words */
+        size_t n;
+        struct sketch_entry_t *entries;     /* Most frequent first */
+};
+
+/* Sketches of the words seen by a single thread */
+struct sketch_t *sketch_new(void);
+void sketch_free(struct sketch_t *s);
+void sketch_add(struct sketch_t *s, const char *word, size_t len);
+
+/* Merge the sketches and estimate the k (at most SKETCH_COUNTERS) most
+ * frequent words, NULL if out of memory */
+struct sketch_result_t *sketch_top(struct sketch_t **parts, int nparts, size_t k);
+void sketch_result_free(struct sketch_result_t *res);
+
+#endif /* SKETCH_H */
@@ -0,0 +1,330 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * =========================== Trigram index =============================
+ *
+ * A thread sees the positions of its chunk in order, so it collects one
+ * block at a time: a bitmap of the 2^24 trigrams tells which ones were
+ * already seen in the block, and when the block changes they become
+ * (trigram, block) pairs. A block cut by a chunk boundary is seen by two
+ * threads, the merge sorts all the pairs and drops the duplicates.
+ *
+ * Layout of the file (native byte order):
+ *
+ *   struct trigram_header
+ *   table        ntrigrams struct trigram_entry sorted by trigram
+ *   postings     the blocks of each trigram, sorted uint32_t
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "tsearch.h"
+#include "trigram.h"
+
+#define TRIGRAM_MAGIC   "TSTRI\0\0\0"
+#define TRIGRAM_VERSION 1
+#define TRIGRAMS        (1 << 24)
+
+struct trigram_header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t header_size;
+        struct file_id_t source;
+        uint64_t file_size;
+        uint64_t block_size;
+        uint64_t nblocks;
+        uint64_t ntrigrams;
+        uint64_t table;         /* Offsets of the sections */
+        uint64_t postings;
+        uint64_t npostings;
+};
+
+struct trigram_entry {
+        uint32_t trigram;
+        uint32_t nblocks;
+        uint64_t first;         /* Index of its first block in the postings */
+};
+
+struct trigram_part_t {
+        uint64_t block;         /* Block being collected */
+        uint8_t *seen;          /* Trigrams of the block, a bit each */
+        uint32_t *cur;          /* The same, as a list */
+        size_t ncur, cur_cap;
+        uint64_t *pairs;        /* trigram << 32 | block */
+        size_t npairs, pairs_cap;
+};
+
+struct trigram_index_t {
+        const uint8_t *map;
+        size_t size;
+        const struct trigram_header *hdr;
+        const struct trigram_entry *table;
+        const uint32_t *postings;
+};
+
+static int grow(void **p, size_t *cap, size_t need, size_t size) {
+        if (need <= *cap) return 0;
+
+        size_t n = *cap ? *cap : 1024;
+        while (n < need) n *= 2;
+        void *q = realloc(*p, n * size);
+        if (!q) return -1;
+        *p = q;
+        *cap = n;
+        return 0;
+}
+
+struct trigram_part_t *trigram_part_new(void) {
+        struct trigram_part_t *part = calloc(1, sizeof(*part));
+        if (!part) return NULL;
+
+        part->seen = calloc(TRIGRAMS / 8, 1);
+        if (!part->seen) {
+                free(part);
+                return NULL;
+        }
+        return part;
+}
+
+void trigram_part_free(struct trigram_part_t *part) {
+        if (!part) return;
+        free(part->seen);
+        free(part->cur);
+        free(part->pairs);
+        free(part);
+}
+
+/* Turn the trigrams of the current block into pairs */
+static int flush_block(struct trigram_part_t *part) {
+        if (grow((void **)&part->pairs, &part->pairs_cap, part->npairs + part->ncur,
+                 sizeof(uint64_t)) != 0)
+                return -1;
+
+        for (size_t i = 0; i < part->ncur; i++) {
+                uint32_t t = part->cur[i];
+                part->pairs[part->npairs++] = (uint64_t)t << 32 | part->block;
+                part->seen[t >> 3] &= ~(1 << (t & 7));
+        }
+        part->ncur = 0;
+        return 0;
+}
+
+int trigram_part_add(struct trigram_part_t *part, const char *text, size_t len,
+                     size_t from, size_t to, uint64_t base) {
+        const uint8_t *u = (const uint8_t *)text;
+
+        for (size_t i = from; i < to && i + 3 <= len; i++) {
+                uint64_t block = (base + i) / TRIGRAM_BLOCK_SIZE;
+                uint32_t t = u[i] << 16 | u[i + 1] << 8 | u[i + 2];
+
+                if (block != part->block && flush_block(part) != 0)
+                        return -1;
+                part->block = block;
+
+                if (part->seen[t >> 3] & (1 << (t & 7)))
+                        continue;
+                if (grow((void **)&part->cur, &part->cur_cap, part->ncur + 1,
+                         sizeof(uint32_t)) != 0)
+                        return -1;
+                part->seen[t >> 3] |= 1 << (t & 7);
+                part->cur[part->ncur++] = t;
+        }
+        return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+        uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+        return x < y ? -1 : x > y;
+}
+
+long trigram_write(const char *path, struct trigram_part_t **parts, int nparts,
+                   const struct file_id_t *source) {
+        struct trigram_entry *table = NULL;
+        uint32_t *postings = NULL;
+        uint64_t *pairs;
+        size_t npairs = 0, n = 0, ntrigrams = 0;
+        long ret = -1;
+
+        for (int p = 0; p < nparts; p++) {
+                if (flush_block(parts[p]) != 0)
+                        return -1;
+                npairs += parts[p]->npairs;
+        }
+
+        pairs = malloc((npairs ? npairs : 1) * sizeof(uint64_t));
+        if (!pairs) return -1;
+        for (int p = 0; p < nparts; p++) {
+                memcpy(pairs + n, parts[p]->pairs, parts[p]->npairs * sizeof(uint64_t));
+                n += parts[p]->npairs;
+        }
+        qsort(pairs, npairs, sizeof(uint64_t), cmp_u64);
+
+        table = malloc((npairs ? npairs : 1) * sizeof(*table));
+        postings = malloc((npairs ? npairs : 1) * sizeof(uint32_t));
+        if (!table || !postings) goto out;
+
+        n = 0;
+        for (size_t i = 0; i < npairs; i++) {
+                uint32_t t = pairs[i] >> 32;
+
+                if (i > 0 && pairs[i] == pairs[i - 1])
+                        continue;
+                if (ntrigrams == 0 || table[ntrigrams - 1].trigram != t)
+                        table[ntrigrams++] = (struct trigram_entry) { .trigram = t, .first = n };
+                table[ntrigrams - 1].nblocks++;
+                postings[n++] = (uint32_t)pairs[i];
+        }
+
+        struct trigram_header hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, TRIGRAM_MAGIC, sizeof(hdr.magic));
+        hdr.version = TRIGRAM_VERSION;
+        hdr.header_size = sizeof(hdr);
+        hdr.source = *source;
+        hdr.block_size = TRIGRAM_BLOCK_SIZE;
+        hdr.nblocks = (source->size + TRIGRAM_BLOCK_SIZE - 1) / TRIGRAM_BLOCK_SIZE;
+        hdr.ntrigrams = ntrigrams;
+        hdr.table = sizeof(hdr);
+        hdr.postings = hdr.table + ntrigrams * sizeof(*table);
+        hdr.npostings = n;
+        hdr.file_size = hdr.postings + n * sizeof(uint32_t);
+
+        struct iovec iov[] = {
+                { &hdr, sizeof(hdr) },
+                { table, ntrigrams * sizeof(*table) },
+                { postings, n * sizeof(uint32_t) },
+        };
+        if (replace_file(path, iov, 3) == 0)
+                ret = ntrigrams;
+
+out:
+        free(pairs);
+        free(table);
+        free(postings);
+        return ret;
+}
+
+struct trigram_index_t *trigram_open(const char *path, const struct file_id_t *source,
+                                     int *ret) {
+        struct trigram_index_t *idx = NULL;
+        struct stat st;
+        void *map;
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                *ret = INDEX_MISSING;
+                return NULL;
+        }
+
+        *ret = INDEX_CORRUPT;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct trigram_header)) {
+                close(fd);
+                return NULL;
+        }
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+                return NULL;
+
+        const struct trigram_header *hdr = map;
+        if (memcmp(hdr->magic, TRIGRAM_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != TRIGRAM_VERSION || hdr->header_size != sizeof(*hdr) ||
+            hdr->block_size != TRIGRAM_BLOCK_SIZE || hdr->file_size != (uint64_t)st.st_size ||
+            hdr->table != sizeof(*hdr) ||
+            hdr->postings != hdr->table + hdr->ntrigrams * sizeof(struct trigram_entry) ||
+            hdr->file_size != hdr->postings + hdr->npostings * sizeof(uint32_t))
+                goto fail;
+
+        if (memcmp(&hdr->source, source, sizeof(*source)) != 0) {
+                *ret = INDEX_STALE;
+                goto fail;
+        }
+
+        idx = malloc(sizeof(*idx));
+        if (!idx) goto fail;
+
+        idx->map = map;
+        idx->size = st.st_size;
+        idx->hdr = hdr;
+        idx->table = (const struct trigram_entry *)(idx->map + hdr->table);
+        idx->postings = (const uint32_t *)(idx->map + hdr->postings);
+        *ret = INDEX_OK;
+        return idx;
+
+fail:
+        munmap(map, st.st_size);
+        return NULL;
+}
+
+void trigram_close(struct trigram_index_t *idx) {
+        if (!idx) return;
+        munmap((void *)idx->map, idx->size);
+        free(idx);
+}
+
+uint64_t trigram_blocks(const struct trigram_index_t *idx) {
+        return idx->hdr->nblocks;
+}
+
+static const struct trigram_entry *find(const struct trigram_index_t *idx, uint32_t t) {
+        size_t lo = 0, hi = idx->hdr->ntrigrams;
+
+        while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (idx->table[mid].trigram == t) return &idx->table[mid];
+                if (idx->table[mid].trigram < t) lo = mid + 1;
+                else hi = mid;
+        }
+        return NULL;
+}
+
+uint64_t trigram_candidates(const struct trigram_index_t *idx, const char *literal,
+                            size_t len, uint8_t *cand) {
+        const uint8_t *u = (const uint8_t *)literal;
+        uint64_t nblocks = idx->hdr->nblocks, count = 0;
+
+        memset(cand, 1, nblocks);
+
+        for (size_t i = 0; i + 3 <= len; i++) {
+                uint32_t t = u[i] << 16 | u[i + 1] << 8 | u[i + 2];
+                const struct trigram_entry *e = find(idx, t);
+
+                if (!e || e->first > idx->hdr->npostings ||
+                    e->nblocks > idx->hdr->npostings - e->first) {
+                        memset(cand, 0, nblocks);
+                        return 0;
+                }
+
+                /* cand &= blocks of the trigram, and the ones right before them */
+                const uint32_t *b = idx->postings + e->first;
+                uint64_t k = 0;
+                for (uint64_t blk = 0; blk < nblocks; blk++) {
+                        while (k < e->nblocks && b[k] < blk) k++;
+                        int near = k < e->nblocks && (b[k] == blk || b[k] == blk + 1);
+                        if (!near) cand[blk] = 0;
+                }
+        }
+
+        for (uint64_t blk = 0; blk < nblocks; blk++)
+                count += cand[blk];
+        return count;
+}
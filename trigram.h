@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * =========================== Trigram index =============================
+ *
+ * The file is cut in blocks of TRIGRAM_BLOCK_SIZE bytes and, for every
+ * trigram (3 consecutive bytes) of the file, the index lists the blocks
+ * where it starts. A literal of at least 3 bytes can only start in a
+ * block b if each of its trigrams starts in b or b + 1 (a literal is
+ * shorter than a block), so the blocks where this doesn't hold are not
+ * scanned at all. Substring and word searches use the word itself, regex
+ * searches the literal required by the pattern.
+ *
+ * Like the word index it is built in parallel, used through mmap() and
+ * tied to the identity of the file it was built from.
+ */
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tsearch.h"
+
+#ifndef TRIGRAM_BLOCK_SIZE
+#define TRIGRAM_BLOCK_SIZE (64 << 10)
+#endif
+
+struct trigram_part_t;
+struct trigram_index_t;
+
+/* Trigrams of the blocks seen by a single thread */
+struct trigram_part_t *trigram_part_new(void);
+void trigram_part_free(struct trigram_part_t *part);
+
+/* Add the trigrams starting in text[from, to), text[0] being at file
+ * offset `base`. Trigrams not complete within text[0, len) are skipped. */
+int trigram_part_add(struct trigram_part_t *part, const char *text, size_t len,
+                     size_t from, size_t to, uint64_t base);
+
+/* Merge the parts and write the index to path, returns the number of
+ * distinct trigrams or -1 */
+long trigram_write(const char *path, struct trigram_part_t **parts, int nparts,
+                   const struct file_id_t *source);
+
+/* Map the index at path if it's usable for the file identified by source,
+ * otherwise returns NULL and the reason (INDEX_*) in ret */
+struct trigram_index_t *trigram_open(const char *path, const struct file_id_t *source,
+                                     int *ret);
+void trigram_close(struct trigram_index_t *idx);
+
+uint64_t trigram_blocks(const struct trigram_index_t *idx);
+
+/* Set cand[b] for every block b where the literal may start (cand has
+ * trigram_blocks() entries). Returns the number of candidate blocks. */
+uint64_t trigram_candidates(const struct trigram_index_t *idx, const char *literal,
+                            size_t len, uint8_t *cand);
+
+#endif /* TRIGRAM_H */
@@ -42,10 +42,75 @@
  *   gcc search.c -o tsearch -pthread
  *
  * Usage:
- *   ./tsearch <filename> <word> <num_threads>
+ *   ./tsearch [options] <filename> <word> <num_threads>
+ *
+ * Options:
+ *   --word-chars=<chars>   Extra bytes treated as part of a word, on top
+ *                          of [A-Za-z0-9] (e.g. "_-").
+ *   --substring            Count raw substrings, ignoring word boundaries.
+ *   --overlapping          With --substring, count overlapping matches
+ *                          ("aa" is found twice in "aaa").
+ *   --regex                The word is a regular expression (see
+ *                          regex_dfa.h), matches don't span lines.
+ *   --max-errors=<k>       Approximate search: count the words within k
+ *                          edits of the word (see fuzzy.h).
+ *   --wildcard             The word is a glob pattern with `*`, `?` and
+ *                          `[...]`, matched against whole words.
+ *   --build-index[=<kinds>]
+ *                          `./tsearch --build-index <filename> <num_threads>`
+ *                          builds the indexes in <kinds>, a comma separated
+ *                          list of `words` (the default, see wordindex.h),
+ *                          `trigrams` (see trigram.h), `bloom` (see
+ *                          bloom.h) and `fm` (see fmindex.h). The searches use them while the file
+ *                          doesn't change; Bloom filters also follow a file
+ *                          which only grows and building them again only
+ *                          indexes what was appended.
+ *   --histogram[=<k>]      `./tsearch --histogram <filename> <num_threads>`
+ *                          prints the k (default 10) most frequent words
+ *                          of the file, see histogram.h.
+ *   --sketch               With --histogram, estimate them in a bounded
+ *                          amount of memory (see sketch.h).
+ *   --update-index         `./tsearch --update-index <filename> <num_threads>`
+ *                          adds what was appended to the file since to its
+ *                          word index (and Bloom filters, if any).
+ *   --index=<path>         Word index, <filename>.tsidx by default.
+ *   --trigram-index=<path> Trigram index, <filename>.tstri by default.
+ *   --bloom-index=<path>   Bloom filters, <filename>.tsblm by default.
+ *   --fm-index=<path>      FM-index, <filename>.tsfm by default.
+ *   --cache[=<dir>]        Keep the results on disk and answer the same
+ *                          search on the same unchanged file from there
+ *                          (see cache.h), in $XDG_CACHE_HOME/tsearch or
+ *                          ~/.cache/tsearch by default.
+ *   --cache-entries=<n>    Results kept in the cache, the least recently
+ *                          used ones are dropped.
+ *   --no-index             Always scan the whole file.
+ *   --perf-counters        Print the hardware counters of the scan of
+ *                          every thread and their sum (see perf.h).
+ *   --thread-stats[=all]   Print the min, median and max time and bytes
+ *                          of the threads, how unbalanced they were and
+ *                          their time in I/O and scanning, and with `all`
+ *                          a row per thread.
+ *   --progress[=<ms>]      Print on stderr every <ms> (default 500) the
+ *                          percent of the file scanned, the throughput
+ *                          and the time left, see progress.h.
+ *   --profile=<file>       Sample the stacks of the threads scanning the
+ *                          file and write them to <file> in the folded
+ *                          format of flame graphs (see profile.h, build
+ *                          with `make profile` for whole stacks).
+ *   --json                 Print the result as a JSON object on stdout
+ *                          (wall time in ns, CPU time, bytes read,
+ *                          throughput, counts) and the logs on stderr.
+ *   --serve=<socket>       `./tsearch --serve=<socket> [<num_workers>]`
+ *                          stays resident and answers the searches sent on
+ *                          the Unix socket with a pool of workers (by
+ *                          default one per CPU), see server.h.
+ *   --client=<socket>      Send the search to the server at <socket>.
  *
  * Example:
  *   ./tsearch biglog.txt ERROR 4
+ *   ./tsearch --word-chars=_ main.c thread_id 4
+ *   ./tsearch --regex biglog.txt 'ERR[0-9]{4}' 4
+ *   ./tsearch --wildcard biglog.txt 'timeout*' 4
  *
  */
 #include <stdio.h>
@@ -54,16 +119,41 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
-#include <ctype.h>
+#include <getopt.h>
+#include <stdatomic.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #if defined(__unix__)
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <fcntl.h>
 #endif
 
-#define LOG(str, ...) printf("LOG: " str "\n", ##__VA_ARGS__);
-#define ERR(str, ...) fprintf(stderr, "ERR: " str "\n", ##__VA_ARGS__);
+#include "tsearch.h"
+#include "regex_dfa.h"
+#include "fuzzy.h"
+#include "wildcard.h"
+#include "wordindex.h"
+#include "trigram.h"
+#include "bloom.h"
+#include "fmindex.h"
+#include "histogram.h"
+#include "sketch.h"
+#include "cache.h"
+#include "pool.h"
+#include "server.h"
+#include "perf.h"
+#include "profile.h"
+#include "progress.h"
 
 /* This macro converts a string to long, 
  * if the conversion result in error
@@ -75,20 +165,39 @@
     (errno == ERANGE || *e != '\0') ? 0 : n; \
 })
 
-#define MAX_WORD_LENGTH 128
-#define BUFFER_SIZE 4096
-#define MIN(a, b) ((a) < (b) ? (a) : (b))
+/* Greedy non-overlapping counting: a match is taken only if it starts
+ * after the end of the previous one. */
+struct chain_t {
+        long next;          /* First file offset where a match may start */
+        uint64_t count;     /* Matches taken */
+};
+
+typedef struct thread_data thread_data_t;
 
-/* Structure given at the end of the search as result */
-struct search_result_t {
-        time_t    elapsed_time;           /* The runtime of the search */
-        char      word[MAX_WORD_LENGTH];  /* Word to search */
-        uint64_t  occurrences;            /* Occurrence founds */
+/* --thread-stats: where the time of a thread went */
+struct thread_stats_t {
+        int64_t start_ns;           /* CLOCK_MONOTONIC when it started and ended */
+        int64_t end_ns;
+        int64_t io_ns;              /* Waiting for fread() */
+        int64_t scan_ns;            /* In the kernel */
+        uint64_t bytes;             /* Read from the file, always counted */
 };
 
+/* A scan kernel counts the matches starting in text[from, limit).
+ *
+ * The data->lookbehind bytes before text[from] are always in the buffer,
+ * unless the buffer starts at the beginning of the file, so some context
+ * before the candidates is available (one byte for most kernels). `eof` tells if text[len - 1] is the last
+ * byte of the file: if not, the kernel can leave undecided the candidates
+ * that need bytes past the end of the buffer.
+ *
+ * Returns the position to resume from in the next call. */
+typedef size_t (*scan_kernel_t)(thread_data_t *data, const char *text, size_t len,
+                                size_t from, size_t limit, int eof);
+
 /* Simple and parser-inspired struct for a chunk, which scan a portion
  * of the entire text and finds occurrences of the word. */
-typedef struct {
+struct thread_data {
         int thread_id;
         char *filename;              /* We cannot use FILE * because of concurrency */
         long start_pos;              /* The start position of the chunk to read */
@@ -96,244 +205,2460 @@ typedef struct {
         char word[MAX_WORD_LENGTH];
         uint64_t occurrences;
         int word_len;
-} thread_data_t;
+
+        const struct search_opts_t *opts;
+        scan_kernel_t kernel;        /* Matching function for opts->mode */
+        long base;                   /* File offset of the scan buffer */
+        size_t lookbehind;           /* Bytes kept before the candidates */
+        struct chain_t chain;        /* Non-overlapping substrings of this chunk */
+        struct chain_t fix;          /* Chain re-synchronization, see fix_chains() */
+        int converged;
+        struct regex_dfa_t *dfa;     /* SEARCH_REGEX: state cache owned by this thread */
+        const char *literal;         /* SEARCH_REGEX: literal required by the pattern */
+        int literal_len;             /* Also the fixed fragment of SEARCH_WILDCARD */
+        struct fuzzy_t *fuzzy;       /* SEARCH_FUZZY: matcher owned by this thread */
+        const struct wildcard_t *wildcard; /* SEARCH_WILDCARD: shared compiled pattern */
+        struct index_part_t *part;   /* --build-index: words found in this chunk */
+        struct trigram_part_t *trigrams; /* --build-index=trigrams: trigrams of this chunk */
+        struct bloom_part_t *bloom;  /* --build-index=bloom: filters of this chunk */
+        struct histogram_t *histogram; /* --histogram: words of this chunk */
+        struct sketch_t *sketch;     /* --histogram --sketch: sketches of this chunk */
+        const struct range_t *ranges; /* The parts of the file given to this thread */
+        int nranges;
+        struct perf_counts_t perf;   /* --perf-counters: counted during the scan */
+        struct thread_stats_t stats; /* --thread-stats */
+        struct progress_slot_t *progress; /* --progress: bytes read, or NULL */
+        int failed;                  /* Part of the chunk wasn't scanned (open, read, memory) */
+};
+
+static int64_t now_ns(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
 long elapsed_ms(struct timespec start, struct timespec end) {
     return (end.tv_sec - start.tv_sec) * 1000 +
            (end.tv_nsec - start.tv_nsec) / 1000000;
 }
 
-/* Function to count word occurrences in a string */
-uint64_t count_word_occurrences(const char *text, size_t text_len, 
-                               const char *word, int word_len) {
+static int64_t elapsed_ns(struct timespec start, struct timespec end) {
+        return (int64_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+               (end.tv_nsec - start.tv_nsec);
+}
+
+/* Word characters classification.
+ *
+ * A byte belongs to a word when word_chars[byte] is non-zero. By default
+ * the set is [A-Za-z0-9], which is what isalnum() gives in the "C" locale,
+ * and can be extended with --word-chars. The table is filled once in main()
+ * before any thread is started, so the workers only ever read it.
+ *
+ * For the SIMD path the same set is also kept as a short list of byte
+ * ranges: a range check is two instructions per 16 bytes, while a table
+ * lookup can't be vectorized with plain SSE2. If the set is too fragmented
+ * (more than MAX_CLASS_RANGES ranges) class_ranges_count is -1 and the
+ * boundary checks fall back to the table. */
+#define MAX_CLASS_RANGES 8
+
+uint8_t word_chars[256];
+
+static struct {
+        uint8_t lo;
+        uint8_t span;   /* hi - lo */
+} class_ranges[MAX_CLASS_RANGES];
+static int class_ranges_count;
+
+void word_chars_init(const char *extra) {
+        memset(word_chars, 0, sizeof(word_chars));
+        for (int c = '0'; c <= '9'; c++) word_chars[c] = 1;
+        for (int c = 'A'; c <= 'Z'; c++) word_chars[c] = 1;
+        for (int c = 'a'; c <= 'z'; c++) word_chars[c] = 1;
+        for (const char *p = extra; p && *p; p++)
+                word_chars[(unsigned char)*p] = 1;
+
+        /* Collapse the table into ranges of consecutive word bytes */
+        class_ranges_count = 0;
+        for (int c = 0; c < 256; c++) {
+                if (!word_chars[c]) continue;
+                int hi = c;
+                while (hi + 1 < 256 && word_chars[hi + 1]) hi++;
+                if (class_ranges_count == MAX_CLASS_RANGES) {
+                        class_ranges_count = -1;
+                        return;
+                }
+                class_ranges[class_ranges_count].lo = c;
+                class_ranges[class_ranges_count].span = hi - c;
+                class_ranges_count++;
+                c = hi;
+        }
+}
+
+#if defined(__SSE2__)
+/* Bitmask of the 16 bytes at p which are word characters */
+static inline unsigned word_chars_mask16(const char *p) {
+        __m128i x = _mm_loadu_si128((const __m128i *)p);
+        __m128i acc = _mm_setzero_si128();
+
+        for (int r = 0; r < class_ranges_count; r++) {
+                /* (x - lo) <= span, as unsigned bytes */
+                __m128i d = _mm_sub_epi8(x, _mm_set1_epi8((char)class_ranges[r].lo));
+                __m128i m = _mm_min_epu8(d, _mm_set1_epi8((char)class_ranges[r].span));
+                acc = _mm_or_si128(acc, _mm_cmpeq_epi8(m, d));
+        }
+        return (unsigned)_mm_movemask_epi8(acc);
+}
+#endif
+
+/* Check a single position: the word must be there and must not be glued
+ * to other word characters on either side. */
+static inline int word_at(const char *text, size_t text_len, size_t i,
+                          const char *word, int word_len) {
+        return text[i] == word[0] &&
+               memcmp(text + i, word, word_len) == 0 &&
+               (i == 0 || !IS_WORD_CHAR(text[i - 1])) &&
+               (i + word_len >= text_len || !IS_WORD_CHAR(text[i + word_len]));
+}
+
+/* Count the words starting in text[from, to)
+ *
+ * The SIMD path compares the first and the last byte of the word against
+ * 16 positions at once, which gives a bitmask of candidates. The boundary
+ * check is then done on the whole bitmask too: the 16 bytes before and the
+ * 16 bytes after the candidates are classified in one go, and only the
+ * candidates surrounded by non-word bytes are verified with memcmp(). */
+static uint64_t count_word_range(const char *text, size_t text_len,
+                                 size_t from, size_t to,
+                                 const char *word, int word_len) {
         uint64_t count = 0;
-        const char *p = text;
-        const char *end = text + text_len - word_len + 1;
-    
-        while (p < end) {
-                if (strncmp(p, word, word_len) == 0) {
-                        /* Check word boundaries */
-                        if ((p == text || !isalnum((unsigned char)p[-1])) &&
-                                (p + word_len >= text + text_len || !isalnum((unsigned char)p[word_len]))) {
-                                count++;
+        size_t i = from;
+
+        if (word_len <= 0 || text_len < (size_t)word_len)
+                return 0;
+
+#if defined(__SSE2__)
+        if (class_ranges_count >= 0) {
+                const __m128i first = _mm_set1_epi8(word[0]);
+                const __m128i last = _mm_set1_epi8(word[word_len - 1]);
+
+                /* Position 0 has no byte before it */
+                if (i == 0 && i < to)
+                        count += word_at(text, text_len, i++, word, word_len);
+
+                for (; i + 16 <= to && i + word_len + 16 <= text_len; i += 16) {
+                        __m128i f = _mm_cmpeq_epi8(first,
+                                        _mm_loadu_si128((const __m128i *)(text + i)));
+                        __m128i l = _mm_cmpeq_epi8(last,
+                                        _mm_loadu_si128((const __m128i *)(text + i + word_len - 1)));
+                        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(f, l));
+                        if (!mask) continue;
+
+                        mask &= ~(word_chars_mask16(text + i - 1) |
+                                  word_chars_mask16(text + i + word_len));
+                        while (mask) {
+                                int bit = __builtin_ctz(mask);
+                                if (memcmp(text + i + bit, word, word_len) == 0)
+                                        count++;
+                                mask &= mask - 1;
                         }
-               }
-               p++;
+                }
+        }
+#endif
+
+        /* Scalar tail (or whole text without SSE2) */
+        for (; i < to && i + word_len <= text_len; i++) {
+                if (word_at(text, text_len, i, word, word_len))
+                        count++;
         }
         return count;
 }
 
+/* Function to count word occurrences in a string, the edges of the
+ * string count as word boundaries. */
+uint64_t count_word_occurrences(const char *text, size_t text_len,
+                                const char *word, int word_len) {
+        return count_word_range(text, text_len, 0, text_len, word, word_len);
+}
 
-/* Thread function to search in a chunk
+/* Count the substrings starting in text[from, to), no boundaries involved.
  *
- * - Positions file pointer at chunk start.
- * - Adds overlap (word_len - 1) to avoid missing matches across boundaries.
- * - Reads chunk in BUFFER_SIZE blocks.
- * - Uses count_word_occurrences() to count matches in each block.
- * - Stores total matches in data->occurrences.
+ * When `next` is NULL every occurrence is counted, overlapping or not.
+ * Otherwise the count is greedy and non-overlapping: candidates before
+ * *next are skipped and *next is moved past every match taken.
  *
- * Issues fixed:
- *      If a word is sliced between two chunks we can lose it,
- *      so this function make a overlap to word_len - 1 to catch
- *      all the word occurrences.
- */
-void *search_chunk(void *arg) {
-        thread_data_t* data = (thread_data_t*)arg;
-        char buffer[BUFFER_SIZE];
-        size_t bytes_read;
-        long total_read = 0;
-        long chunk_size = data->end_pos - data->start_pos;
-    
-        FILE *file = fopen(data->filename, "r");
-        if (!file) {
-                ERR("Thread %d: Failed to open file", data->thread_id);
-                return NULL;
+ * This is the pure-bandwidth kernel: the first/last byte filter does all
+ * the work and words of one or two bytes don't even need memcmp(). */
+static uint64_t count_substring_range(const char *text, size_t text_len,
+                                      size_t from, size_t to,
+                                      const char *word, int word_len,
+                                      size_t *next) {
+        uint64_t count = 0;
+        size_t i = from;
+
+        if (word_len <= 0 || text_len < (size_t)word_len)
+                return 0;
+
+#if defined(__SSE2__)
+        const __m128i first = _mm_set1_epi8(word[0]);
+        const __m128i last = _mm_set1_epi8(word[word_len - 1]);
+
+        for (; i + 16 <= to && i + word_len + 15 <= text_len; i += 16) {
+                __m128i f = _mm_cmpeq_epi8(first,
+                                _mm_loadu_si128((const __m128i *)(text + i)));
+                __m128i l = _mm_cmpeq_epi8(last,
+                                _mm_loadu_si128((const __m128i *)(text + i + word_len - 1)));
+                unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(f, l));
+                if (!mask) continue;
+
+                if (!next && word_len <= 2) {
+                        count += __builtin_popcount(mask);
+                        continue;
+                }
+                while (mask) {
+                        size_t pos = i + __builtin_ctz(mask);
+                        mask &= mask - 1;
+                        if (next && pos < *next) continue;
+                        if (word_len > 2 && memcmp(text + pos, word, word_len) != 0)
+                                continue;
+                        count++;
+                        if (next) *next = pos + word_len;
+                }
         }
-        
-        long actual_start = data->start_pos;
-        long actual_chunk_size = chunk_size;
-    
-        long overlap = data->word_len - 1;
-        if (data->thread_id > 0 && actual_start >= overlap) {
-                actual_start -= overlap;
-                actual_chunk_size += overlap;
+#endif
+
+        for (; i < to && i + word_len <= text_len; i++) {
+                if (next && i < *next) continue;
+                if (text[i] == word[0] && memcmp(text + i, word, word_len) == 0) {
+                        count++;
+                        if (next) *next = i + word_len;
+                }
         }
+        return count;
+}
 
-        if (fseek(file, actual_start, SEEK_SET) != 0) {
-                ERR("Thread %d: Seek failed", data->thread_id);
-                fclose(file);
+/* First occurrence of word in text, or NULL */
+const char *find_substring(const char *text, size_t text_len,
+                           const char *word, int word_len) {
+        size_t i = 0;
+
+        if (text_len < (size_t)word_len)
                 return NULL;
+        if (word_len == 1)
+                return memchr(text, word[0], text_len);
+
+#if defined(__SSE2__)
+        const __m128i first = _mm_set1_epi8(word[0]);
+        const __m128i last = _mm_set1_epi8(word[word_len - 1]);
+
+        for (; i + word_len + 15 <= text_len; i += 16) {
+                __m128i f = _mm_cmpeq_epi8(first,
+                                _mm_loadu_si128((const __m128i *)(text + i)));
+                __m128i l = _mm_cmpeq_epi8(last,
+                                _mm_loadu_si128((const __m128i *)(text + i + word_len - 1)));
+                unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(f, l));
+                while (mask) {
+                        size_t pos = i + __builtin_ctz(mask);
+                        if (memcmp(text + pos, word, word_len) == 0)
+                                return text + pos;
+                        mask &= mask - 1;
+                }
         }
-    
-        while (total_read < actual_chunk_size && 
-               (bytes_read = fread(buffer, 1, 
-                                  MIN(BUFFER_SIZE, actual_chunk_size - total_read), 
-                                  file)) > 0) {
-                
-                data->occurrences += count_word_occurrences(buffer, bytes_read, 
-                                                           data->word, data->word_len);
-                total_read += bytes_read;
+#endif
+
+        for (; i + word_len <= text_len; i++) {
+                if (text[i] == word[0] && memcmp(text + i, word, word_len) == 0)
+                        return text + i;
         }
-    
-        fclose(file);
         return NULL;
 }
 
-/* Search for a word occourrences by giving a file pointer */
-struct search_result_t *tsearch(char *filename, char word[MAX_WORD_LENGTH], uint8_t threads) {
-        struct search_result_t *res = malloc(sizeof(struct search_result_t));
-        if (res == NULL) return NULL;
-        memset(res, 0, sizeof(*res));
+/* Position after the last '\n' in text[from, to), or `from` if there is none */
+static size_t line_start(const char *text, size_t from, size_t to) {
+        while (to > from && text[to - 1] != '\n')
+                to--;
+        return to;
+}
 
-        strncpy(res->word, word, MAX_WORD_LENGTH - 1);
-        res->word[MAX_WORD_LENGTH - 1] = '\0';
-        
-        /* Start time counter */
-        struct timespec start, end;
-        clock_gettime(CLOCK_MONOTONIC, &start);
+int file_id_get(const char *filename, struct file_id_t *id) {
+        struct stat st;
+
+        if (stat(filename, &st) != 0)
+                return -1;
+        memset(id, 0, sizeof(*id));
+        id->dev = st.st_dev;
+        id->ino = st.st_ino;
+        id->size = st.st_size;
+        id->mtime_sec = st.st_mtim.tv_sec;
+        id->mtime_nsec = st.st_mtim.tv_nsec;
+        return 0;
+}
+
+/* FNV-1a hash of the bytes [from, to) of the file, at most a page */
+static int hash_range(int fd, uint64_t from, uint64_t to, uint64_t *hash) {
+        uint8_t buf[4096];
+        size_t n = to - from;
 
-        /* File opening for each threads to avoid race conditions */
-        FILE *fp = fopen(filename, "r");
+        if (n > sizeof(buf) || pread(fd, buf, n, from) != (ssize_t)n)
+                return -1;
+        *hash = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < n; i++) {
+                *hash ^= buf[i];
+                *hash *= 0x100000001b3ULL;
+        }
+        return 0;
+}
+
+int file_guards(const char *filename, uint64_t end, uint64_t guards[2]) {
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) return -1;
+
+        int ret = hash_range(fd, 0, MIN(end, 4096), &guards[0]) != 0 ||
+                  hash_range(fd, end > 4096 ? end - 4096 : 0, end, &guards[1]) != 0 ? -1 : 0;
+        close(fd);
+        return ret;
+}
+
+int replace_file(const char *path, const struct iovec *iov, int iovcnt) {
+        static atomic_uint calls;
+        char tmp[4096];
+
+        /* The threads of a server may replace the same file at once: each
+         * writes its own temporary file, and only the last rename stays */
+        snprintf(tmp, sizeof(tmp), "%s.tmp.%d.%u", path, (int)getpid(),
+                 atomic_fetch_add(&calls, 1));
+        int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd < 0) return -1;
+        FILE *fp = fdopen(fd, "wb");
         if (!fp) {
-                ERR("Failed to open file '%s'", filename);
-                free(res);
-                return NULL;
+                close(fd);
+                unlink(tmp);
+                return -1;
         }
 
-        fseek(fp, 0, SEEK_END); /* Move cursor to the EOF */
-        long file_size = ftell(fp); /* Get the position of the cursor (bytes) */
-        rewind(fp); /* Move cursor on the top of file */
-        
-        /* If file is small or single-threaded is requested, use simple approch */
-        if (file_size < BUFFER_SIZE || threads <= 1) {
-                LOG("Using single threaded search");
+        int ok = 1;
+        for (int i = 0; i < iovcnt; i++)
+                ok = ok && fwrite(iov[i].iov_base, 1, iov[i].iov_len, fp) == iov[i].iov_len;
+        ok = fflush(fp) == 0 && ok;
+        ok = fsync(fileno(fp)) == 0 && ok;
+        ok = fclose(fp) == 0 && ok;
 
-                char buffer[BUFFER_SIZE];
-                size_t bytes_read;
-                int word_len = strlen(word);
-                
-                /* Search and count word occurences */
-                while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, fp)) > 0) {
-                        res->occurrences += count_word_occurrences(buffer, bytes_read, word, word_len);
-                }
-                
-                /* stop timer */
-                clock_gettime(CLOCK_MONOTONIC, &end);
-                res->elapsed_time = elapsed_ms(start, end);
-                fclose(fp);
-                return res;
+        if (!ok || rename(tmp, path) != 0) {
+                unlink(tmp);
+                return -1;
         }
+        return 0;
+}
 
-        fclose(fp);
-        
-        /* Thread allocation and error handling */
-        pthread_t *thread_list = malloc(threads * sizeof(pthread_t));
-        thread_data_t *thread_data = malloc(threads * sizeof(thread_data_t));
+/* Start of the word ending right before text[i], not before `from` */
+static inline size_t word_start(const char *text, size_t from, size_t i) {
+        while (i > from && IS_WORD_CHAR(text[i - 1]))
+                i--;
+        return i;
+}
 
-        if (!thread_data || !thread_list) {
-                ERR("Memory allocation failed for threads");
-                goto cleanup;
+/* End (excluded) of the word going on at text[i] */
+static inline size_t word_end(const char *text, size_t len, size_t i) {
+        while (i < len && IS_WORD_CHAR(text[i]))
+                i++;
+        return i;
+}
+
+/* Last candidate (excluded) that can be decided with the bytes in the
+ * buffer, given how many bytes a candidate needs. */
+static inline size_t decidable(size_t len, size_t limit, size_t need, int eof) {
+        size_t to = eof ? len : (len >= need ? len - need + 1 : 0);
+        return MIN(to, limit);
+}
+
+/* SEARCH_WORD kernel: a candidate needs the word plus the byte after it */
+static size_t word_kernel(thread_data_t *data, const char *text, size_t len,
+                          size_t from, size_t limit, int eof) {
+        size_t to = decidable(len, limit, data->word_len + 1, eof);
+        if (to <= from) return from;
+
+        data->occurrences += count_word_range(text, len, from, to,
+                                              data->word, data->word_len);
+        return to;
+}
+
+/* SEARCH_SUBSTRING kernel */
+static size_t substring_kernel(thread_data_t *data, const char *text, size_t len,
+                               size_t from, size_t limit, int eof) {
+        size_t to = decidable(len, limit, data->word_len, eof);
+        if (to <= from) return from;
+
+        if (data->opts->overlapping) {
+                data->occurrences += count_substring_range(text, len, from, to,
+                                                           data->word, data->word_len, NULL);
+        } else {
+                size_t next = data->chain.next > data->base + (long)from ?
+                              (size_t)(data->chain.next - data->base) : from;
+                uint64_t n = count_substring_range(text, len, from, to,
+                                                   data->word, data->word_len, &next);
+                data->chain.next = data->base + next;
+                data->chain.count += n;
+                data->occurrences += n;
         }
-        
-        /* Chunk size evaluation */
-        long chunk_size = file_size / threads; 
-        int word_len = strlen(word); 
+        return to;
+}
 
-        for (int i = 0; i < threads; i++) {
+/* SEARCH_REGEX kernel
+ *
+ * Regex matches don't span lines, so the unit here is the line: a line
+ * belongs to the chunk where it starts and is only handed to the DFA once
+ * it's complete. When the pattern requires a literal, the SIMD literal
+ * search jumps straight to the lines containing it and the DFA never sees
+ * the others. */
+static size_t regex_kernel(thread_data_t *data, const char *text, size_t len,
+                           size_t from, size_t limit, int eof) {
+        size_t pos = from;
 
-                /* thread_data initialization */
-                thread_data[i].thread_id = i;
-                thread_data[i].filename = strdup(filename);
-                if (!thread_data[i].filename) {
-                        ERR("Failed to duplicate filename for thread %d", i);
-                        for (int j = 0; j < i; j++) {
-                                pthread_join(thread_list[j], NULL);
-                                free(thread_data[j].filename); 
+        /* The line in progress at the chunk start belongs to the previous chunk */
+        if (pos > 0 && text[pos - 1] != '\n') {
+                const char *nl = memchr(text + pos, '\n', len - pos);
+                if (!nl) return eof ? limit : len;
+                pos = nl - text + 1;
+        }
+
+        while (pos < limit) {
+                size_t line = pos;
+
+                if (data->literal_len > 0) {
+                        const char *hit = find_substring(text + pos, len - pos,
+                                                         data->literal, data->literal_len);
+                        if (!hit) {
+                                /* Only the last line can still get the literal */
+                                return eof ? limit : line_start(text, pos, len);
                         }
-                        goto cleanup;
+                        line = line_start(text, pos, hit - text);
+                        if (line >= limit) return line;
                 }
-                thread_data[i].start_pos = i * chunk_size;
-                thread_data[i].end_pos = (i == threads - 1) ? file_size : (i + 1) * chunk_size;
-                thread_data[i].occurrences = 0;
-                thread_data[i].word_len = word_len;
-                strncpy(thread_data[i].word, word, MAX_WORD_LENGTH);
-
-                /* threads creation */
-                if (pthread_create(&thread_list[i], NULL, search_chunk, &thread_data[i]) != 0)  {
-                        ERR("Failed to create thread %d", i);
-                        free(thread_data[i].filename); 
-                        /* wait for other threads before join */
-                        for (int j = 0; j < i; j++) {
-                                pthread_join(thread_list[j], NULL);
-                                free(thread_data[j].filename); 
+
+                const char *nl = memchr(text + line, '\n', len - line);
+                if (!nl && !eof) return line;
+
+                size_t line_end = nl ? (size_t)(nl - text) : len;
+                data->occurrences += regex_dfa_count_line(data->dfa, text + line,
+                                                          line_end - line);
+                pos = line_end + 1;
+        }
+        return MIN(pos, len);
+}
+
+/* SEARCH_WILDCARD kernel
+ *
+ * Works on whole words: a word belongs to the chunk where it starts and
+ * is only matched once complete. With a fixed fragment in the pattern,
+ * the SIMD literal search jumps to the words containing it and all the
+ * others are skipped. */
+static size_t wildcard_kernel(thread_data_t *data, const char *text, size_t len,
+                              size_t from, size_t limit, int eof) {
+        size_t pos = from;
+
+        /* The word in progress at the chunk start belongs to the previous chunk */
+        if (pos > 0 && IS_WORD_CHAR(text[pos - 1])) {
+                pos = word_end(text, len, pos);
+                if (pos == len && !eof) return len;
+        }
+
+        while (pos < limit) {
+                size_t start;
+
+                if (data->literal_len > 0) {
+                        const char *hit = find_substring(text + pos, len - pos,
+                                                         data->literal, data->literal_len);
+                        if (!hit) {
+                                /* Only the last word can still get the fragment */
+                                return eof ? limit : word_start(text, pos, len);
                         }
-                        goto cleanup;
+                        start = word_start(text, pos, hit - text);
+                } else {
+                        start = pos;
+                        while (start < len && !IS_WORD_CHAR(text[start]))
+                                start++;
+                        if (start == len) return eof ? limit : len;
                 }
+                if (start >= limit) return start;
+
+                size_t end = word_end(text, len, start);
+                if (end == len && !eof) return start;
+
+                if (wildcard_match(data->wildcard, text + start, end - start))
+                        data->occurrences++;
+                pos = end;
         }
+        return pos;
+}
 
-        for (int i = 0; i < threads; i++) {
-                /* wait other threads */
-                pthread_join(thread_list[i], NULL);
-                /* get occurrences */
-                res->occurrences += thread_data[i].occurrences;
-                free(thread_data[i].filename);
+/* --build-index kernel for words and bloom, and --histogram: collects
+ * every word starting in the chunk, with the same boundaries as
+ * SEARCH_WORD. Words longer than a query can be are left out. */
+static size_t index_kernel(thread_data_t *data, const char *text, size_t len,
+                           size_t from, size_t limit, int eof) {
+        size_t pos = from;
+
+        /* The word in progress at the chunk start belongs to the previous chunk */
+        if (pos > 0 && IS_WORD_CHAR(text[pos - 1])) {
+                pos = word_end(text, len, pos);
+                if (pos == len && !eof) return len;
         }
-        
-        /* stop timer */
-        clock_gettime(CLOCK_MONOTONIC, &end);
-        res->elapsed_time = elapsed_ms(start, end);
 
-       
-        free(thread_list);
-        free(thread_data);
-        return res;
+        while (pos < limit) {
+                size_t start = pos;
+                while (start < len && !IS_WORD_CHAR(text[start]))
+                        start++;
+                if (start == len) return eof ? limit : len;
+                if (start >= limit) return start;
 
-cleanup:
-        if (thread_list && thread_data) {
-                for (int i = 0; i < threads; i++) {
-                        pthread_join(thread_list[i], NULL);
-                        free(thread_data[i].filename);
+                size_t end = word_end(text, len, start);
+                if (end == len && !eof) return start;
+
+                int ret = 0;
+                if (end - start >= MAX_WORD_LENGTH)
+                        ret = 0;
+                else if (data->part)
+                        ret = index_part_add(data->part, text + start, end - start,
+                                             data->base + start);
+                else if (data->bloom)
+                        ret = bloom_part_add(data->bloom, text + start, end - start,
+                                             data->base + start);
+                else if (data->histogram)
+                        ret = histogram_add(data->histogram, text + start, end - start);
+                else
+                        sketch_add(data->sketch, text + start, end - start);
+                if (ret != 0) {
+                        ERR("Thread %d: Out of memory while counting words", data->thread_id);
+                        data->failed = 1;
+                        return limit;
                 }
-                free(thread_list);
-                free(thread_data);
+                pos = end;
         }
-        clock_gettime(CLOCK_MONOTONIC, &end);
-        res->elapsed_time = elapsed_ms(start, end);
-        return res;
+        return pos;
 }
 
+/* --build-index=trigrams kernel: a trigram needs its 3 bytes */
+static size_t trigram_kernel(thread_data_t *data, const char *text, size_t len,
+                             size_t from, size_t limit, int eof) {
+        size_t to = decidable(len, limit, 3, eof);
+        if (to <= from) return from;
 
-int main(int argc, char **argv) {
-#if defined(__unix__) 
-        /* Args checking */
-        if (argc != 4) {
-                ERR("You need to provide `./tsearch <filename> <word> <num_threads>`");
-                goto cleanup;
+        if (trigram_part_add(data->trigrams, text, len, from, to, data->base) != 0) {
+                ERR("Thread %d: Out of memory while indexing", data->thread_id);
+                data->failed = 1;
+                return limit;
         }
-        
-        /* Get the word to search */
-        char word[MAX_WORD_LENGTH];
-        strncpy(word, argv[2], sizeof(word) - 1);
-        word[sizeof(word) - 1] = '\0';
+        return to;
+}
 
-        uint8_t threads = (uint8_t) STR_TO_LONG(argv[3]);
+/* SEARCH_FUZZY kernel
+ *
+ * An approximate match is owned by the chunk where it ends, and an end
+ * needs the byte after it to be sure it's the end of a word. */
+static size_t fuzzy_kernel(thread_data_t *data, const char *text, size_t len,
+                           size_t from, size_t limit, int eof) {
+        size_t to = decidable(len, limit, 2, eof);
+        if (to <= from) return from;
 
-        LOG("Searching for word '%s' in '%s' using %d threads", 
-                        word, argv[1], threads);
+        data->occurrences += fuzzy_count(data->fuzzy, text, len, from, to,
+                                         data->base == 0);
+        return to;
+}
+
+/* Re-synchronization kernel for fix_chains().
+ *
+ * Feeds every occurrence to two greedy chains: `chain` starts at the chunk
+ * start, as the thread did, and `fix` starts where the previous chunk
+ * really left off. As soon as both take the same match they are the same
+ * chain, so the rest of the chunk doesn't need to be scanned again. */
+static size_t chain_fix_kernel(thread_data_t *data, const char *text, size_t len,
+                               size_t from, size_t limit, int eof) {
+        size_t to = decidable(len, limit, data->word_len, eof);
+
+        for (size_t i = from; i < to; i++) {
+                const char *p = memchr(text + i, data->word[0], to - i);
+                if (!p) break;
+                i = p - text;
+                if (i + data->word_len > len) break;
+                if (memcmp(p, data->word, data->word_len) != 0) continue;
+
+                long pos = data->base + i;
+                int taken = 0;
+                if (pos >= data->chain.next) {
+                        data->chain.next = pos + data->word_len;
+                        data->chain.count++;
+                        taken++;
+                }
+                if (pos >= data->fix.next) {
+                        data->fix.next = pos + data->word_len;
+                        data->fix.count++;
+                        taken++;
+                }
+                if (taken == 2) {
+                        data->converged = 1;
+                        return limit;
+                }
+        }
+        return MAX(to, from);
+}
+
+static scan_kernel_t select_kernel(const struct search_opts_t *opts) {
+        switch (opts->mode) {
+        case SEARCH_SUBSTRING:
+                return substring_kernel;
+        case SEARCH_REGEX:
+                return regex_kernel;
+        case SEARCH_FUZZY:
+                return fuzzy_kernel;
+        case SEARCH_WILDCARD:
+                return wildcard_kernel;
+        case SEARCH_WORD:
+        default:
+                return word_kernel;
+        }
+}
+
+
+/* Thread function to search in a chunk
+ *
+ * - Positions file pointer data->lookbehind bytes before the chunk start,
+ *   so that the first candidate has its left boundary.
+ * - Reads the chunk in BUFFER_SIZE blocks and hands them to data->kernel.
+ * - Stores total matches in data->occurrences.
+ *
+ * Issues fixed:
+ *      If a word is sliced between two chunks (or between two blocks of
+ *      the same chunk) we can lose it. A match belongs to the chunk where
+ *      it starts: the kernel tells where it stopped deciding and the
+ *      undecided tail is moved to the front of the buffer before the next
+ *      read, which also goes past end_pos when the last candidates need
+ *      more bytes.
+ */
+void *search_chunk(void *arg) {
+        thread_data_t* data = (thread_data_t*)arg;
+        size_t cap = BUFFER_SIZE + 2 * MAX_WORD_LENGTH;
+        char *buffer = malloc(cap);
+        size_t bytes_read;
+        size_t len = 0;
+        int timed = data->opts->thread_stats;
+
+        if (!buffer) {
+                ERR("Thread %d: Failed to allocate the buffer", data->thread_id);
+                data->failed = 1;
+                return NULL;
+        }
+    
+        FILE *file = fopen(data->filename, "r");
+        if (!file) {
+                ERR("Thread %d: Failed to open file", data->thread_id);
+                data->failed = 1;
+                free(buffer);
+                return NULL;
+        }
         
-        /* Initialize the search and get the result */
-        struct search_result_t *res = tsearch(argv[1], word, threads);
+        data->base = data->start_pos - MIN(data->start_pos, (long)data->lookbehind);
+        if (fseek(file, data->base, SEEK_SET) != 0) {
+                ERR("Thread %d: Seek failed", data->thread_id);
+                data->failed = 1;
+                fclose(file);
+                free(buffer);
+                return NULL;
+        }
 
-        if (res) {
-                LOG("Found %lu occurrences in %ld ms", 
-                res->occurrences, res->elapsed_time);
-        } else {
-                ERR("Failed to return a result");
-                goto cleanup;
+        size_t from = data->start_pos - data->base;
+        for (;;) {
+                /* A single candidate doesn't fit: make room */
+                if (len == cap) {
+                        char *bigger = realloc(buffer, cap * 2);
+                        if (!bigger) {
+                                ERR("Thread %d: Failed to grow the buffer", data->thread_id);
+                                data->failed = 1;
+                                break;
+                        }
+                        buffer = bigger;
+                        cap *= 2;
+                }
+
+                /* Don't read much further than what the chunk needs */
+                size_t want = cap - len;
+                long unread = data->end_pos + data->word_len - (data->base + (long)len);
+                if (unread > 0 && (size_t)unread < want)
+                        want = unread;
+
+                int64_t t0 = timed ? now_ns() : 0;
+                bytes_read = fread(buffer + len, 1, want, file);
+                len += bytes_read;
+                int eof = bytes_read < want;
+
+                int64_t t1 = timed ? now_ns() : 0;
+                size_t limit = data->end_pos - data->base;
+                size_t next = data->kernel(data, buffer, len, from, limit, eof);
+                data->stats.bytes += bytes_read;
+                if (data->progress)
+                        progress_add(data->progress, bytes_read);
+                if (timed) {
+                        int64_t t2 = now_ns();
+                        data->stats.io_ns += t1 - t0;
+                        data->stats.scan_ns += t2 - t1;
+                }
+                if (next >= limit || eof)
+                        break;
+
+                /* Keep the undecided tail and the context before it */
+                size_t drop = next > data->lookbehind ? next - data->lookbehind : 0;
+                memmove(buffer, buffer + drop, len - drop);
+                len -= drop;
+                data->base += drop;
+                from = next - drop;
+        }
+        if (ferror(file)) {
+                ERR("Thread %d: Read failed", data->thread_id);
+                data->failed = 1;
+        }
+    
+        fclose(file);
+        free(buffer);
+        return NULL;
+}
+
+/* Thread function: search_chunk() on each range given to the thread */
+static void *search_ranges(void *arg) {
+        thread_data_t *data = arg;
+        struct perf_t *perf = data->opts->perf_counters ? perf_open() : NULL;
+        struct profile_thread_t *profile = profile_thread_start();
+
+        data->stats.start_ns = now_ns();
+        for (int i = 0; i < data->nranges; i++) {
+                data->start_pos = data->ranges[i].start;
+                data->end_pos = data->ranges[i].end;
+                perf_enable(perf);
+                search_chunk(data);
+                perf_disable(perf);
         }
+        perf_read(perf, &data->perf);
+        perf_close(perf);
+        profile_thread_stop(profile);
+        data->stats.end_ns = now_ns();
+        return NULL;
+}
 
-        free(res);
+static int init_thread_data(thread_data_t *data, int thread_id, const char *filename,
+                            const char *word, const struct search_opts_t *opts,
+                            long start_pos, long end_pos) {
+        memset(data, 0, sizeof(*data));
+        data->thread_id = thread_id;
+        data->filename = strdup(filename);
+        if (!data->filename) return -1;
+        data->start_pos = start_pos;
+        data->end_pos = end_pos;
+        data->word_len = strlen(word);
+        strncpy(data->word, word, MAX_WORD_LENGTH - 1);
+        data->opts = opts;
+        data->kernel = select_kernel(opts);
+        data->lookbehind = 1;
+        data->chain.next = start_pos;
+        return 0;
+}
+
+static void release_thread_data(thread_data_t *data) {
+        free(data->filename);
+        regex_dfa_free(data->dfa);
+        fuzzy_free(data->fuzzy);
+        index_part_free(data->part);
+        trigram_part_free(data->trigrams);
+        bloom_part_free(data->bloom);
+        histogram_free(data->histogram);
+        sketch_free(data->sketch);
+}
+
+/* Give the thread its own lazy DFA, nothing is shared between threads
+ * but the compiled program. */
+static int init_thread_regex(thread_data_t *data, const struct regex_prog_t *prog) {
+        data->literal = regex_literal(prog, &data->literal_len);
+        data->dfa = regex_dfa_new(prog, REGEX_DFA_CACHE_SIZE);
+        return data->dfa ? 0 : -1;
+}
+
+/* Approximate matches need to look back a whole span */
+static int init_thread_fuzzy(thread_data_t *data) {
+        char err[128];
 
+        data->fuzzy = fuzzy_new(data->word, data->word_len, data->opts->max_errors,
+                                err, sizeof(err));
+        if (!data->fuzzy) return -1;
+        data->lookbehind = fuzzy_lookbehind(data->fuzzy);
+        return 0;
+}
+
+/* Compiled patterns shared by the threads */
+struct shared_t {
+        struct regex_prog_t *prog;
+        struct wildcard_t *wildcard;
+};
+
+/* Mode specific setup of a thread */
+static int init_thread_mode(thread_data_t *data, void *ctx) {
+        const struct shared_t *shared = ctx;
+
+        switch (data->opts->mode) {
+        case SEARCH_REGEX:
+                return init_thread_regex(data, shared->prog);
+        case SEARCH_FUZZY:
+                return init_thread_fuzzy(data);
+        case SEARCH_WILDCARD:
+                data->wildcard = shared->wildcard;
+                data->literal = wildcard_literal(shared->wildcard, &data->literal_len);
+                return 0;
+        default:
+                return 0;
+        }
+}
+
+/* Non-overlapping substrings: every thread started its greedy chain at the
+ * start of its chunk, but the last match of the previous chunk may end
+ * past it. Walk the chunks in order and, where that happens, rescan the
+ * head of the chunk until the two chains meet again (usually within the
+ * first match) and correct the count. */
+static void fix_chains(thread_data_t *thread_data, int threads) {
+        long carry = thread_data[0].chain.next;
+
+        for (int i = 1; i < threads; i++) {
+                thread_data_t *t = &thread_data[i];
+                long chunk_next = t->chain.next;
+
+                if (carry <= t->start_pos) {
+                        carry = chunk_next;
+                        continue;
+                }
+
+                t->chain = (struct chain_t){ .next = t->start_pos, .count = 0 };
+                t->fix = (struct chain_t){ .next = carry, .count = 0 };
+                t->converged = 0;
+                t->kernel = chain_fix_kernel;
+                search_chunk(t);
+
+                t->occurrences += t->fix.count;
+                t->occurrences -= t->chain.count;
+                carry = t->converged ? chunk_next : t->fix.next;
+        }
+}
+
+/* Compile what the threads share for opts->mode, logging any error */
+static int prepare_shared(struct shared_t *shared, const char *word,
+                          const struct search_opts_t *opts) {
+        char err[128];
+        int literal_len;
+        const char *literal;
+
+        memset(shared, 0, sizeof(*shared));
+
+        switch (opts->mode) {
+        case SEARCH_REGEX:
+                shared->prog = regex_compile(word, err, sizeof(err));
+                if (!shared->prog) {
+                        ERR("Invalid regex '%s': %s", word, err);
+                        return -1;
+                }
+                literal = regex_literal(shared->prog, &literal_len);
+                if (literal_len > 0)
+                        LOG("Prefiltering lines on literal '%.*s'", literal_len, literal);
+                return 0;
+        case SEARCH_FUZZY: {
+                /* Only a check, every thread builds its own matcher */
+                struct fuzzy_t *f = fuzzy_new(word, strlen(word), opts->max_errors,
+                                              err, sizeof(err));
+                if (!f) {
+                        ERR("Can't search '%s' with %d errors: %s", word, opts->max_errors, err);
+                        return -1;
+                }
+                if (fuzzy_pieces(f) > 0)
+                        LOG("Prefiltering on %d exact pieces of the word", fuzzy_pieces(f));
+                fuzzy_free(f);
+                return 0;
+        }
+        case SEARCH_WILDCARD:
+                shared->wildcard = wildcard_compile(word, err, sizeof(err));
+                if (!shared->wildcard) {
+                        ERR("Invalid pattern '%s': %s", word, err);
+                        return -1;
+                }
+                literal = wildcard_literal(shared->wildcard, &literal_len);
+                if (literal_len > 0)
+                        LOG("Prefiltering words on fragment '%.*s'", literal_len, literal);
+                return 0;
+        default:
+                return 0;
+        }
+}
+
+static void release_shared(struct shared_t *shared) {
+        regex_free(shared->prog);
+        wildcard_free(shared->wildcard);
+}
+
+/* Workers the scans run on instead of their own threads, see
+ * tsearch_set_pool() */
+static struct pool_t *search_pool;
+
+void tsearch_set_pool(struct pool_t *pool) {
+        search_pool = pool;
+}
+
+/* The kernel of a search run on buffers in memory instead of a file */
+struct tsearch_matcher_t {
+        struct shared_t shared;
+        thread_data_t data;
+};
+
+struct tsearch_matcher_t *tsearch_matcher_new(const char *word,
+                                              const struct search_opts_t *opts) {
+        struct tsearch_matcher_t *m = calloc(1, sizeof(*m));
+        if (!m) return NULL;
+
+        if (prepare_shared(&m->shared, word, opts) != 0) {
+                free(m);
+                return NULL;
+        }
+        if (init_thread_data(&m->data, 0, "", word, opts, 0, 0) != 0 ||
+            init_thread_mode(&m->data, &m->shared) != 0) {
+                tsearch_matcher_free(m);
+                return NULL;
+        }
+        return m;
+}
+
+uint64_t tsearch_matcher_count(struct tsearch_matcher_t *m, const char *text, size_t len) {
+        thread_data_t *data = &m->data;
+
+        /* The buffer is a whole file of its own */
+        data->occurrences = 0;
+        data->base = 0;
+        data->end_pos = len;
+        data->chain = (struct chain_t){ .next = 0, .count = 0 };
+        data->kernel(data, text, len, 0, len, 1);
+        return data->occurrences;
+}
+
+void tsearch_matcher_free(struct tsearch_matcher_t *m) {
+        if (!m) return;
+        release_thread_data(&m->data);
+        release_shared(&m->shared);
+        free(m);
+}
+
+/* Run search_chunk() on the ranges of the file, split among the threads
+ * by size, or in the calling thread if there is little to read or
+ * single-threaded is requested. Without ranges, the whole file is split
+ * in one chunk per thread. `setup` gives each thread its mode specific
+ * state before it starts.
+ *
+ * Returns the threads' data once they are all done (to be released by
+ * the caller), in file order, or NULL on error. */
+static thread_data_t *scan_file(const char *filename, const char *word,
+                                const struct search_opts_t *opts, uint8_t threads,
+                                const struct range_t *ranges, int nranges,
+                                int (*setup)(thread_data_t *, void *), void *ctx,
+                                int *nchunks) {
+        struct range_t chunks[256];
+        long total = 0;
+
+        if (!ranges) {
+                /* File opening for each threads to avoid race conditions */
+                FILE *fp = fopen(filename, "r");
+                if (!fp) {
+                        ERR("Failed to open file '%s'", filename);
+                        return NULL;
+                }
+
+                fseek(fp, 0, SEEK_END); /* Move cursor to the EOF */
+                total = ftell(fp); /* Get the position of the cursor (bytes) */
+                fclose(fp);
+        } else {
+                for (int i = 0; i < nranges; i++)
+                        total += ranges[i].end - ranges[i].start;
+        }
+        
+        /* If there is little to read or single-threaded is requested, use simple approch */
+        if (total < BUFFER_SIZE || threads <= 1) {
+                LOG("Using single threaded search");
+                threads = 1;
+        }
+
+        if (!ranges) {
+                /* Chunk size evaluation */
+                long chunk_size = total / threads; 
+
+                for (int i = 0; i < threads; i++) {
+                        chunks[i].start = i * chunk_size;
+                        chunks[i].end = (i == threads - 1) ? total : (i + 1) * chunk_size;
+                }
+                ranges = chunks;
+                nranges = threads;
+        } else if (nranges < threads) {
+                threads = nranges ? nranges : 1;
+        }
+
+        /* Thread allocation and error handling */
+        pthread_t *thread_list = malloc(threads * sizeof(pthread_t));
+        thread_data_t *thread_data = calloc(threads, sizeof(thread_data_t));
+        struct progress_t *progress = NULL;
+        int ready = 0, started = 0;
+
+        if (!thread_data || !thread_list) {
+                ERR("Memory allocation failed for threads");
+                goto cleanup;
+        }
+
+        /* Every thread gets consecutive ranges, about total / threads bytes */
+        long taken = 0;
+        int next = 0;
+
+        for (int i = 0; i < threads; i++) {
+                int first = next;
+                long share = total / threads * (i + 1);
+
+                while (next < nranges && (next == first || taken < share) &&
+                       nranges - next > threads - i - 1) {
+                        taken += ranges[next].end - ranges[next].start;
+                        next++;
+                }
+                if (i == threads - 1)
+                        next = nranges;
+
+                /* thread_data initialization */
+                if (init_thread_data(&thread_data[i], i, filename, word, opts,
+                                     next > first ? ranges[first].start : 0,
+                                     next > first ? ranges[next - 1].end : 0) != 0 ||
+                    setup(&thread_data[i], ctx) != 0) {
+                        ERR("Failed to initialize thread %d", i);
+                        release_thread_data(&thread_data[i]);
+                        goto cleanup;
+                }
+                thread_data[i].ranges = ranges + first;
+                thread_data[i].nranges = next - first;
+                ready++;
+        }
+
+        if (opts->progress) {
+                progress = progress_start(total, threads, opts->progress);
+                for (int i = 0; i < threads; i++)
+                        thread_data[i].progress = progress_slot(progress, i);
+        }
+
+        if (threads == 1) {
+                /* The single chunk is scanned by this thread */
+                search_ranges(&thread_data[0]);
+        } else if (search_pool) {
+                pool_run(search_pool, search_ranges, thread_data, sizeof(thread_data_t), threads);
+        } else {
+                for (int i = 0; i < threads; i++) {
+                        if (pthread_create(&thread_list[i], NULL, search_ranges, &thread_data[i]) != 0)  {
+                                ERR("Failed to create thread %d", i);
+                                goto cleanup;
+                        }
+                        started++;
+                }
+
+                /* wait other threads */
+                for (int i = 0; i < started; i++)
+                        pthread_join(thread_list[i], NULL);
+        }
+
+        progress_stop(progress);
+        for (int i = 0; i < threads; i++) {
+                thread_data[i].ranges = NULL;
+                thread_data[i].progress = NULL;
+        }
+        free(thread_list);
+        *nchunks = threads;
+        return thread_data;
+
+cleanup:
+        /* wait the threads already started before releasing their data */
+        for (int i = 0; i < started; i++)
+                pthread_join(thread_list[i], NULL);
+        progress_stop(progress);
+        for (int i = 0; i < ready; i++)
+                release_thread_data(&thread_data[i]);
+        free(thread_list);
+        free(thread_data);
+        return NULL;
+}
+
+/* 1 if a thread couldn't scan all of its chunks */
+static int chunks_failed(const thread_data_t *chunks, int nchunks) {
+        for (int i = 0; i < nchunks; i++)
+                if (chunks[i].failed) return 1;
+        return 0;
+}
+
+/* --perf-counters: the counts of every thread, then their sum */
+static void print_perf_counters(const thread_data_t *chunks, int nchunks) {
+        struct perf_counts_t total = { .valid = 0 };
+        char buf[512];
+
+        for (int i = 0; i < nchunks; i++) {
+                perf_format(&chunks[i].perf, buf, sizeof(buf));
+                LOG("Thread %d: %s", chunks[i].thread_id, buf);
+                perf_add(&total, &chunks[i].perf);
+        }
+        perf_format(&total, buf, sizeof(buf));
+        LOG("All threads: %s", buf);
+}
+
+static int cmp_int64(const void *a, const void *b) {
+        int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+        return (x > y) - (x < y);
+}
+
+/* --thread-stats: how evenly the work was spread, and with rows what
+ * every thread did. The counts are the ones of the threads' chunks. */
+static void print_thread_stats(const thread_data_t *chunks, int nchunks, int rows) {
+        int64_t times[256], bytes[256];
+        int64_t first_start = chunks[0].stats.start_ns, first_end = chunks[0].stats.end_ns;
+        int64_t last_end = first_end, total = 0, io = 0, scan = 0;
+
+        for (int i = 0; i < nchunks; i++) {
+                const struct thread_stats_t *st = &chunks[i].stats;
+
+                times[i] = st->end_ns - st->start_ns;
+                bytes[i] = st->bytes;
+                total += times[i];
+                io += st->io_ns;
+                scan += st->scan_ns;
+                first_start = MIN(first_start, st->start_ns);
+                first_end = MIN(first_end, st->end_ns);
+                last_end = MAX(last_end, st->end_ns);
+        }
+
+        if (rows) {
+                for (int i = 0; i < nchunks; i++) {
+                        const struct thread_stats_t *st = &chunks[i].stats;
+                        LOG("Thread %d: started at +%.3f ms, ran %.3f ms, read %lu bytes, "
+                            "%lu matches, %.3f ms in I/O, %.3f ms scanning",
+                            chunks[i].thread_id, (st->start_ns - first_start) / 1e6,
+                            times[i] / 1e6, st->bytes, chunks[i].occurrences,
+                            st->io_ns / 1e6, st->scan_ns / 1e6);
+                }
+        }
+
+        qsort(times, nchunks, sizeof(times[0]), cmp_int64);
+        qsort(bytes, nchunks, sizeof(bytes[0]), cmp_int64);
+        double mean = (double)total / nchunks;
+
+        LOG("Thread time: min %.3f, median %.3f, max %.3f ms, imbalance %.2f (max/mean), "
+            "last thread done %.3f ms after the first",
+            times[0] / 1e6, times[nchunks / 2] / 1e6, times[nchunks - 1] / 1e6,
+            mean > 0 ? times[nchunks - 1] / mean : 1.0, (last_end - first_end) / 1e6);
+        LOG("Thread bytes: min %lu, median %lu, max %lu; %.1f%% of the time in I/O, "
+            "%.1f%% scanning",
+            (uint64_t)bytes[0], (uint64_t)bytes[nchunks / 2], (uint64_t)bytes[nchunks - 1],
+            total > 0 ? 100.0 * io / total : 0.0, total > 0 ? 100.0 * scan / total : 0.0);
+}
+
+/* Is the word a single token for the word_chars rules? */
+static int is_single_word(const char *word) {
+        for (const char *p = word; *p; p++) {
+                if (!IS_WORD_CHAR(*p)) return 0;
+        }
+        return word[0] != '\0';
+}
+
+/* Start of the line containing the byte at pos */
+static long line_start_at(int fd, long pos) {
+        char buf[BUFFER_SIZE];
+
+        while (pos > 0) {
+                long from = pos > BUFFER_SIZE ? pos - BUFFER_SIZE : 0;
+                ssize_t n = pread(fd, buf, pos - from, from);
+                if (n != pos - from) return 0;
+
+                for (long i = n; i > 0; i--) {
+                        if (buf[i - 1] == '\n') return from + i;
+                }
+                pos = from;
+        }
+        return 0;
+}
+
+/* The ranges covering the candidate blocks, adjacent ones merged. For
+ * SEARCH_REGEX a line belongs to the range where it starts, so a range
+ * also takes the head of the line in progress at its start. */
+static struct range_t *candidate_ranges(const char *filename, const uint8_t *cand,
+                                        uint64_t nblocks, uint64_t block_size,
+                                        long file_size, int lines, int *nranges) {
+        struct range_t *ranges = malloc((nblocks ? nblocks : 1) * sizeof(*ranges));
+        int fd = lines ? open(filename, O_RDONLY) : -1;
+        int n = 0;
+
+        if (!ranges || (lines && fd < 0)) {
+                free(ranges);
+                if (fd >= 0) close(fd);
+                return NULL;
+        }
+
+        for (uint64_t b = 0; b < nblocks; b++) {
+                if (!cand[b]) continue;
+
+                long start = b * block_size;
+                long end = MIN((long)((b + 1) * block_size), file_size);
+                if (lines) start = line_start_at(fd, start);
+
+                if (n > 0 && start <= ranges[n - 1].end) {
+                        ranges[n - 1].end = end;
+                } else {
+                        ranges[n].start = start;
+                        ranges[n].end = end;
+                        n++;
+                }
+        }
+
+        if (fd >= 0) close(fd);
+        *nranges = n;
+        return ranges;
+}
+
+/* With usable Bloom filters, the ranges of the file where the word may
+ * be: the blocks whose filter has it and what was appended since the
+ * filters were built. NULL if the whole file has to be scanned. */
+static struct range_t *bloom_ranges(const char *filename, const char *word,
+                                    const struct search_opts_t *opts, int *nranges) {
+        struct file_id_t id;
+        int ret;
+
+        if (!opts->bloom_path || opts->mode != SEARCH_WORD || !is_single_word(word) ||
+            strlen(word) >= MAX_WORD_LENGTH - 1 || file_id_get(filename, &id) != 0)
+                return NULL;
+
+        struct bloom_t *b = bloom_open(opts->bloom_path, filename, &id, &ret);
+        if (!b) {
+                if (ret == INDEX_STALE) {
+                        LOG("Index '%s' is out of date, scanning the file", opts->bloom_path);
+                } else if (ret == INDEX_CORRUPT) {
+                        ERR("Index '%s' is damaged, scanning the file", opts->bloom_path);
+                }
+                return NULL;
+        }
+
+        uint64_t nblocks = (id.size + BLOOM_BLOCK_SIZE - 1) / BLOOM_BLOCK_SIZE;
+        uint8_t *cand = malloc(nblocks ? nblocks : 1);
+        struct range_t *ranges = NULL;
+
+        if (cand) {
+                uint64_t n = bloom_candidates(b, word, strlen(word), cand, id.size);
+                ranges = candidate_ranges(filename, cand, nblocks, BLOOM_BLOCK_SIZE,
+                                          id.size, 0, nranges);
+                if (ranges)
+                        LOG("Bloom filters: scanning %lu of %lu blocks", n, nblocks);
+        }
+        free(cand);
+        bloom_close(b);
+        return ranges;
+}
+
+/* With a fresh trigram index, the ranges of the file that can contain the
+ * matches of the word (or of the literal required by the regex). Returns
+ * NULL if the whole file has to be scanned. */
+static struct range_t *trigram_ranges(const char *filename, const char *word,
+                                      const struct search_opts_t *opts,
+                                      const struct shared_t *shared, int *nranges) {
+        const char *literal = word;
+        int literal_len = strlen(word);
+        struct file_id_t id;
+        int ret;
+
+        if (!opts->trigram_path)
+                return NULL;
+        if (opts->mode == SEARCH_REGEX)
+                literal = regex_literal(shared->prog, &literal_len);
+        else if (opts->mode != SEARCH_WORD && opts->mode != SEARCH_SUBSTRING)
+                return NULL;
+        if (literal_len < 3 || file_id_get(filename, &id) != 0)
+                return NULL;
+
+        struct trigram_index_t *idx = trigram_open(opts->trigram_path, &id, &ret);
+        if (!idx) {
+                if (ret == INDEX_STALE) {
+                        LOG("Index '%s' is out of date, scanning the file", opts->trigram_path);
+                } else if (ret == INDEX_CORRUPT) {
+                        ERR("Index '%s' is damaged, scanning the file", opts->trigram_path);
+                }
+                return NULL;
+        }
+
+        uint64_t nblocks = trigram_blocks(idx);
+        uint8_t *cand = malloc(nblocks ? nblocks : 1);
+        struct range_t *ranges = NULL;
+
+        if (cand) {
+                uint64_t n = trigram_candidates(idx, literal, literal_len, cand);
+                ranges = candidate_ranges(filename, cand, nblocks, TRIGRAM_BLOCK_SIZE,
+                                          id.size, opts->mode == SEARCH_REGEX, nranges);
+                if (ranges)
+                        LOG("Trigram index: scanning %lu of %lu blocks", n, nblocks);
+        }
+        free(cand);
+        trigram_close(idx);
+        return ranges;
+}
+
+/* Count the occurrences from an index up to date with the file, which
+ * is not read at all: the word index for single words, the FM-index for
+ * substrings. Returns INDEX_OK, or why no index can answer (path tells
+ * which one was tried). */
+static int count_from_index(const char *filename, const char *word,
+                            const struct search_opts_t *opts, const char **path,
+                            uint64_t *count) {
+        struct file_id_t id;
+        int ret;
+
+        if (opts->mode == SEARCH_WORD && opts->index_path && is_single_word(word))
+                *path = opts->index_path;
+        else if (opts->mode == SEARCH_SUBSTRING && opts->fm_path && *word)
+                *path = opts->fm_path;
+        else
+                return INDEX_MISSING;
+
+        if (file_id_get(filename, &id) != 0)
+                return INDEX_MISSING;
+        if (opts->mode == SEARCH_WORD)
+                return wordindex_count(*path, &id, word, strlen(word), count);
+
+        struct fm_index_t *idx = fm_open(*path, &id, &ret);
+        if (!idx) return ret;
+        if (fm_count(idx, word, strlen(word), opts->overlapping, count) != 0) {
+                LOG("Too many matches to locate in '%s', scanning the file", *path);
+                ret = INDEX_MISSING;
+        }
+        fm_close(idx);
+        return ret;
+}
+
+/* Search for a word occourrences by giving a file pointer */
+struct search_result_t *tsearch(char *filename, char word[MAX_WORD_LENGTH],
+                                const struct search_opts_t *opts, uint8_t threads) {
+        struct search_result_t *res = malloc(sizeof(struct search_result_t));
+        if (res == NULL) return NULL;
+        memset(res, 0, sizeof(*res));
+
+        strncpy(res->word, word, MAX_WORD_LENGTH - 1);
+        res->word[MAX_WORD_LENGTH - 1] = '\0';
+        
+        /* Start time counter */
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        /* The same question about the same file was answered before */
+        struct cache_key_t key;
+        struct file_id_t id, after;
+        uint64_t count;
+        int cacheable = opts->cache_dir && file_id_get(filename, &id) == 0;
+        if (cacheable) {
+                cache_key_init(&key, &id, word, opts);
+                if (cache_lookup(opts->cache_dir, &key, &count) == 0) {
+                        LOG("Answered from cache '%s'", opts->cache_dir);
+                        res->occurrences = count;
+                        clock_gettime(CLOCK_MONOTONIC, &end);
+                        res->elapsed_time = elapsed_ms(start, end);
+                        res->elapsed_ns = elapsed_ns(start, end);
+                        return res;
+                }
+        }
+
+        /* A fresh index answers without reading the file */
+        const char *index_path = NULL;
+        int ret = count_from_index(filename, word, opts, &index_path, &count);
+        if (ret == INDEX_OK) {
+                LOG("Answered from index '%s'", index_path);
+                res->occurrences = count;
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                res->elapsed_time = elapsed_ms(start, end);
+                res->elapsed_ns = elapsed_ns(start, end);
+                return res;
+        }
+        if (ret == INDEX_STALE) {
+                LOG("Index '%s' is out of date, scanning the file", index_path);
+        } else if (ret == INDEX_CORRUPT) {
+                ERR("Index '%s' is damaged, scanning the file", index_path);
+        }
+
+        /* Patterns are compiled once, the threads only share the result */
+        struct shared_t shared;
+        if (prepare_shared(&shared, word, opts) != 0) {
+                free(res);
+                return NULL;
+        }
+
+        /* Only the blocks where an index finds the word are read */
+        int nranges = 0;
+        struct range_t *ranges = bloom_ranges(filename, word, opts, &nranges);
+        if (!ranges)
+                ranges = trigram_ranges(filename, word, opts, &shared, &nranges);
+
+        int nchunks;
+        thread_data_t *chunks = scan_file(filename, word, opts, threads, ranges, nranges,
+                                          init_thread_mode, &shared, &nchunks);
+        free(ranges);
+        if (!chunks) {
+                release_shared(&shared);
+                free(res);
+                return NULL;
+        }
+
+        if (opts->mode == SEARCH_SUBSTRING && !opts->overlapping)
+                fix_chains(chunks, nchunks);
+        if (opts->perf_counters)
+                print_perf_counters(chunks, nchunks);
+        if (opts->thread_stats)
+                print_thread_stats(chunks, nchunks, opts->thread_stats > 1);
+
+        /* A partial count would be served from the cache until the file changes */
+        if (cacheable && chunks_failed(chunks, nchunks)) {
+                ERR("Part of '%s' wasn't scanned, the count isn't cached", filename);
+                cacheable = 0;
+        }
+
+        for (int i = 0; i < nchunks; i++) {
+                /* get occurrences */
+                res->occurrences += chunks[i].occurrences;
+                res->bytes += chunks[i].stats.bytes;
+                release_thread_data(&chunks[i]);
+        }
+        free(chunks);
+        release_shared(&shared);
+
+        /* Unless the file changed meanwhile, the count is the one of the key */
+        if (cacheable && file_id_get(filename, &after) == 0 &&
+            memcmp(&id, &after, sizeof(id)) == 0 &&
+            cache_store(opts->cache_dir, &key, res->occurrences, opts->cache_entries) != 0)
+                ERR("Failed to write to the cache '%s'", opts->cache_dir);
+        
+        /* stop timer */
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        res->elapsed_time = elapsed_ms(start, end);
+        res->elapsed_ns = elapsed_ns(start, end);
+        return res;
+}
+
+/* Every thread counts the words of its chunk, exactly or in sketches */
+static int init_thread_histogram(thread_data_t *data, void *ctx) {
+        const int *sketch = ctx;
+
+        data->kernel = index_kernel;
+        if (*sketch) {
+                data->sketch = sketch_new();
+                return data->sketch ? 0 : -1;
+        }
+        data->histogram = histogram_new();
+        return data->histogram ? 0 : -1;
+}
+
+/* Merge the sketches of the threads and print their estimates */
+static int print_sketches(thread_data_t *chunks, int nchunks, size_t k,
+                          struct timespec start) {
+        struct timespec end;
+
+        struct sketch_t **parts = malloc(nchunks * sizeof(*parts));
+        if (!parts) return -1;
+        for (int i = 0; i < nchunks; i++)
+                parts[i] = chunks[i].sketch;
+
+        struct sketch_result_t *res = sketch_top(parts, nchunks, k);
+        free(parts);
+        if (!res) return -1;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        LOG("Counted %lu words (about %.0f distinct) in %ld ms",
+            res->words, res->distinct, elapsed_ms(start, end));
+        for (size_t i = 0; i < res->n; i++)
+                LOG("%10lu %.*s (at least %lu)", res->entries[i].count,
+                    (int)res->entries[i].len, res->entries[i].word, res->entries[i].lower);
+        sketch_result_free(res);
+        return 0;
+}
+
+/* Print the k most frequent words of filename, see histogram.h, or their
+ * estimates in bounded memory with sketch (see sketch.h) */
+int tsearch_histogram(const char *filename, uint8_t threads, size_t k, int sketch) {
+        struct search_opts_t opts = { .mode = SEARCH_WORD };
+        struct timespec start, end;
+        int nchunks, ret = -1;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        thread_data_t *chunks = scan_file(filename, "", &opts, threads, NULL, 0,
+                                          init_thread_histogram, &sketch, &nchunks);
+        if (!chunks) return -1;
+
+        if (sketch) {
+                ret = print_sketches(chunks, nchunks, k, start);
+                if (ret != 0)
+                        ERR("Memory allocation failed for the sketches");
+                goto out;
+        }
+
+        struct histogram_t **parts = malloc(nchunks * sizeof(*parts));
+        if (!parts) {
+                ERR("Memory allocation failed for the histogram");
+                goto out;
+        }
+        for (int i = 0; i < nchunks; i++)
+                parts[i] = chunks[i].histogram;
+
+        struct histogram_top_t *top = histogram_top(parts, nchunks, threads, k);
+        free(parts);
+        if (!top) {
+                ERR("Memory allocation failed for the histogram");
+                goto out;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        LOG("Counted %lu words (%lu distinct) in %ld ms",
+            top->words, top->distinct, elapsed_ms(start, end));
+        for (size_t i = 0; i < top->n; i++)
+                LOG("%10lu %.*s", top->entries[i].count,
+                    (int)top->entries[i].len, top->entries[i].word);
+        histogram_top_free(top);
+        ret = 0;
+
+out:
+        for (int i = 0; i < nchunks; i++)
+                release_thread_data(&chunks[i]);
+        free(chunks);
+        return ret;
+}
+
+/* Run the indexing kernel set by `setup` on the whole file. The file
+ * must not change meanwhile: its identity, as seen before the scan, is
+ * returned in id. */
+static thread_data_t *scan_for_index(const char *filename, uint8_t threads,
+                                     int (*setup)(thread_data_t *, void *),
+                                     struct file_id_t *id, int *nchunks) {
+        struct search_opts_t opts = { .mode = SEARCH_WORD };
+        struct file_id_t after;
+
+        if (file_id_get(filename, id) != 0) {
+                ERR("Failed to stat '%s'", filename);
+                return NULL;
+        }
+
+        thread_data_t *chunks = scan_file(filename, "", &opts, threads, NULL, 0,
+                                          setup, NULL, nchunks);
+        if (!chunks) return NULL;
+
+        /* The index must describe exactly the file it claims to */
+        if (file_id_get(filename, &after) != 0 || memcmp(id, &after, sizeof(after)) != 0) {
+                ERR("'%s' changed while it was indexed", filename);
+                for (int i = 0; i < *nchunks; i++)
+                        release_thread_data(&chunks[i]);
+                free(chunks);
+                return NULL;
+        }
+        return chunks;
+}
+
+/* Every thread collects the words of its chunk */
+static int init_thread_index(thread_data_t *data, void *ctx) {
+        (void)ctx;
+        data->kernel = index_kernel;
+        data->part = index_part_new();
+        return data->part ? 0 : -1;
+}
+
+/* Cut [start, end) in n ranges of about the same size, none if it's empty */
+static int split_range(long start, long end, int n, struct range_t *ranges) {
+        long size = end - start;
+
+        if (size <= 0) return 0;
+        for (int i = 0; i < n; i++) {
+                ranges[i].start = start + size / n * i;
+                ranges[i].end = i == n - 1 ? end : start + size / n * (i + 1);
+        }
+        return n;
+}
+
+/* Where the index of a file of meta->source.size bytes stops: if the
+ * file ends in the middle of a word, the word may still grow and is
+ * kept apart as the tail. */
+static int index_end(const char *filename, struct index_meta_t *meta) {
+        char buf[MAX_WORD_LENGTH + 1];
+        uint64_t size = meta->source.size;
+        size_t n = size < sizeof(buf) ? size : sizeof(buf);
+
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) return -1;
+        ssize_t got = pread(fd, buf, n, size - n);
+        close(fd);
+        if (got != (ssize_t)n) return -1;
+
+        size_t i = n;
+        while (i > 0 && IS_WORD_CHAR(buf[i - 1])) i--;
+
+        meta->end = size;
+        meta->tail_len = 0;
+        /* No word at the end, or one too long to be ever indexed */
+        if (i == n || n - i >= MAX_WORD_LENGTH || (i == 0 && n < size))
+                return 0;
+
+        meta->end = size - (n - i);
+        meta->tail_len = n - i;
+        memcpy(meta->tail, buf + i, n - i);
+        return 0;
+}
+
+/* Index the words starting from offset `from` up to the end of the file
+ * into the segment number seg of the index */
+static int write_segment(const char *filename, const char *index_path, int seg,
+                         uint64_t from, uint8_t threads, struct index_stats_t *stats) {
+        struct search_opts_t opts = { .mode = SEARCH_WORD };
+        struct range_t ranges[256];
+        struct index_meta_t meta;
+        struct file_id_t after;
+        char path[4096];
+        int nchunks, ret = -1;
+
+        memset(&meta, 0, sizeof(meta));
+        if (file_id_get(filename, &meta.source) != 0 || index_end(filename, &meta) != 0 ||
+            file_guards(filename, meta.end, meta.guards) != 0) {
+                ERR("Failed to read '%s'", filename);
+                return -1;
+        }
+        if (meta.end < from) {
+                ERR("'%s' is not the file that was indexed", filename);
+                return -1;
+        }
+        meta.start = from;
+
+        /* The file may keep growing: index the bytes it has now */
+        int n = split_range(from, meta.end, threads ? threads : 1, ranges);
+        thread_data_t *data = scan_file(filename, "", &opts, threads, ranges, n,
+                                        init_thread_index, NULL, &nchunks);
+        if (!data) return -1;
+
+        /* A segment missing the words of a chunk would count them wrong forever */
+        if (chunks_failed(data, nchunks)) {
+                ERR("Failed to read all of '%s', the index is left unchanged", filename);
+                goto out;
+        }
+
+        /* Only appending to it is fine */
+        if (file_id_get(filename, &after) != 0 || after.dev != meta.source.dev ||
+            after.ino != meta.source.ino || after.size < meta.source.size) {
+                ERR("'%s' changed while it was indexed", filename);
+                goto out;
+        }
+
+        struct index_part_t **parts = malloc(nchunks * sizeof(*parts));
+        if (!parts) {
+                ERR("Memory allocation failed for the index");
+                goto out;
+        }
+        for (int i = 0; i < nchunks; i++)
+                parts[i] = data[i].part;
+
+        wordindex_segment_path(index_path, seg, path, sizeof(path));
+        ret = wordindex_write(path, parts, nchunks, &meta, stats);
+        free(parts);
+        if (ret != 0)
+                ERR("Failed to write the index '%s'", path);
+
+out:
+        for (int i = 0; i < nchunks; i++)
+                release_thread_data(&data[i]);
+        free(data);
+        return ret;
+}
+
+/* Writers of an index take turns on "<path>.lock", readers never wait */
+static int lock_index(const char *index_path) {
+        char path[4096];
+
+        snprintf(path, sizeof(path), "%s.lock", index_path);
+        int fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+                ERR("Failed to open '%s'", path);
+                return -1;
+        }
+        if (flock(fd, LOCK_EX) != 0) {
+                ERR("Failed to lock '%s'", path);
+                close(fd);
+                return -1;
+        }
+        return fd;
+}
+
+/* Build the word index of filename: the chunks are tokenized in parallel
+ * with the same rules as SEARCH_WORD, then merged and written to
+ * index_path as a single segment. */
+int tsearch_build_index(const char *filename, const char *index_path, uint8_t threads) {
+        struct index_stats_t stats;
+        struct timespec start, end;
+        char path[4096];
+
+        int lock = lock_index(index_path);
+        if (lock < 0) return -1;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int ret = write_segment(filename, index_path, 0, 0, threads, &stats);
+        if (ret == 0) {
+                /* The segments of the previous index don't follow this one */
+                for (int i = 1; i < INDEX_MAX_SEGMENTS; i++) {
+                        wordindex_segment_path(index_path, i, path, sizeof(path));
+                        if (unlink(path) != 0) break;
+                }
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                LOG("Indexed %lu words (%lu distinct) into '%s' in %ld ms",
+                    stats.words, stats.terms, index_path, elapsed_ms(start, end));
+        }
+        close(lock);
+        return ret;
+}
+
+/* Merge the segments of the index in a detached process, which keeps the
+ * writers' lock (inherited as an open file) until it's done */
+static void compact_in_background(const char *index_path, int nsegments) {
+        fflush(stdout);
+        fflush(stderr);
+
+        pid_t pid = fork();
+        if (pid < 0) return;    /* The next update will try again */
+        if (pid > 0) {
+                waitpid(pid, NULL, 0);
+                return;
+        }
+
+        /* The grandchild is adopted by init, nobody has to wait for it */
+        if (fork() != 0) _exit(0);
+        setsid();
+
+        struct index_set_t set;
+        struct index_stats_t stats;
+        if (wordindex_set_open(index_path, &set) == INDEX_OK) {
+                if (wordindex_compact(index_path, &set, &stats) != 0)
+                        ERR("Failed to compact the %d segments of '%s'", nsegments, index_path);
+                wordindex_set_close(&set);
+        }
+        _exit(0);
+}
+
+/* Bring the word index of an append-only file up to date: only the bytes
+ * appended since the last update are scanned, into a new segment. A file
+ * that was rewritten or truncated is indexed again from scratch. */
+int tsearch_update_index(const char *filename, const char *index_path, uint8_t threads) {
+        struct index_set_t set;
+        struct index_stats_t stats;
+        struct file_id_t id;
+        struct timespec start, end;
+        uint64_t guards[2];
+        int ret;
+
+        int lock = lock_index(index_path);
+        if (lock < 0) return -1;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (file_id_get(filename, &id) != 0) {
+                ERR("Failed to stat '%s'", filename);
+                close(lock);
+                return -1;
+        }
+
+        if (wordindex_set_open(index_path, &set) != INDEX_OK) {
+                LOG("No usable index '%s', building it", index_path);
+                goto rebuild;
+        }
+
+        const struct index_meta_t *last = wordindex_set_meta(&set);
+        if (memcmp(&last->source, &id, sizeof(id)) == 0) {
+                LOG("Index '%s' is up to date", index_path);
+                wordindex_set_close(&set);
+                close(lock);
+                return 0;
+        }
+        if (last->source.dev != id.dev || last->source.ino != id.ino ||
+            id.size < last->source.size || set.n >= INDEX_MAX_SEGMENTS ||
+            file_guards(filename, last->end, guards) != 0 ||
+            memcmp(guards, last->guards, sizeof(guards)) != 0) {
+                LOG("'%s' was not only appended to, indexing it again", filename);
+                wordindex_set_close(&set);
+                goto rebuild;
+        }
+
+        int seg = set.n;
+        uint64_t from = last->end;
+        wordindex_set_close(&set);
+
+        ret = write_segment(filename, index_path, seg, from, threads, &stats);
+        if (ret == 0) {
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                LOG("Indexed %lu new words (from offset %lu) into segment %d of '%s' in %ld ms",
+                    stats.words, from, seg, index_path, elapsed_ms(start, end));
+                if (seg + 1 >= INDEX_COMPACT_AT) {
+                        LOG("Compacting the %d segments of '%s' in the background",
+                            seg + 1, index_path);
+                        compact_in_background(index_path, seg + 1);
+                }
+        }
+        close(lock);
+        return ret;
+
+rebuild:
+        close(lock);
+        return tsearch_build_index(filename, index_path, threads);
+}
+
+/* Every thread collects the trigrams of the blocks in its chunk */
+static int init_thread_trigrams(thread_data_t *data, void *ctx) {
+        (void)ctx;
+        data->kernel = trigram_kernel;
+        data->trigrams = trigram_part_new();
+        return data->trigrams ? 0 : -1;
+}
+
+/* Build the trigram index of filename, see trigram.h */
+int tsearch_build_trigrams(const char *filename, const char *index_path, uint8_t threads) {
+        struct file_id_t id;
+        struct timespec start, end;
+        int nchunks, ret = -1;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        thread_data_t *chunks = scan_for_index(filename, threads, init_thread_trigrams,
+                                               &id, &nchunks);
+        if (!chunks) return -1;
+
+        /* Missing trigrams would skip blocks which have the word */
+        if (chunks_failed(chunks, nchunks)) {
+                ERR("Failed to read all of '%s', the index is left unchanged", filename);
+                goto out;
+        }
+
+        struct trigram_part_t **parts = malloc(nchunks * sizeof(*parts));
+        if (!parts) {
+                ERR("Memory allocation failed for the index");
+                goto out;
+        }
+        for (int i = 0; i < nchunks; i++)
+                parts[i] = chunks[i].trigrams;
+
+        long ntrigrams = trigram_write(index_path, parts, nchunks, &id);
+        free(parts);
+        if (ntrigrams < 0) {
+                ERR("Failed to write the index '%s'", index_path);
+                goto out;
+        }
+        ret = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        LOG("Indexed %ld distinct trigrams into '%s' in %ld ms",
+            ntrigrams, index_path, elapsed_ms(start, end));
+
+out:
+        for (int i = 0; i < nchunks; i++)
+                release_thread_data(&chunks[i]);
+        free(chunks);
+        return ret;
+}
+
+
+/* Build the FM-index of filename, see fmindex.h. Suffix sorting needs the
+ * whole file at once, it is mapped rather than read in chunks. */
+int tsearch_build_fm(const char *filename, const char *index_path, uint8_t threads) {
+        struct file_id_t id, after;
+        struct timespec start, end;
+        const uint8_t *text = NULL;
+        int ret = -1;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0 || file_id_get(filename, &id) != 0) {
+                ERR("Failed to open '%s'", filename);
+                if (fd >= 0) close(fd);
+                return -1;
+        }
+        if (id.size > 0) {
+                void *map = mmap(NULL, id.size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map == MAP_FAILED) {
+                        ERR("Failed to map '%s'", filename);
+                        close(fd);
+                        return -1;
+                }
+                text = map;
+        }
+        close(fd);
+
+        if (fm_write(index_path, text, id.size, &id, threads) != 0) {
+                ERR("Failed to write the index '%s'", index_path);
+                goto out;
+        }
+
+        /* The index must describe exactly the file it claims to */
+        if (file_id_get(filename, &after) != 0 || memcmp(&id, &after, sizeof(after)) != 0) {
+                ERR("'%s' changed while it was indexed", filename);
+                unlink(index_path);
+                goto out;
+        }
+        ret = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        LOG("Indexed %lu bytes into '%s' in %ld ms", id.size, index_path, elapsed_ms(start, end));
+
+out:
+        if (text) munmap((void *)text, id.size);
+        return ret;
+}
+
+
+/* Every thread fills the Bloom filters of the blocks in its chunk */
+static int init_thread_bloom(thread_data_t *data, void *ctx) {
+        (void)ctx;
+        data->kernel = index_kernel;
+        data->bloom = bloom_part_new();
+        return data->bloom ? 0 : -1;
+}
+
+/* Build the Bloom filters of filename, see bloom.h. If they already cover
+ * the beginning of the file, only what was appended since is indexed. */
+int tsearch_build_bloom(const char *filename, const char *index_path, uint8_t threads) {
+        struct search_opts_t opts = { .mode = SEARCH_WORD };
+        struct range_t chunks[256];
+        struct file_id_t id;
+        struct timespec start, end;
+        uint64_t from = 0;
+        int nchunks, ret = -1;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if (file_id_get(filename, &id) != 0) {
+                ERR("Failed to stat '%s'", filename);
+                return -1;
+        }
+
+        struct bloom_t *old = bloom_open(index_path, filename, &id, &ret);
+        if (old) {
+                if (bloom_indexed(old) == id.size) {
+                        LOG("Index '%s' is up to date", index_path);
+                        bloom_close(old);
+                        return 0;
+                }
+                from = bloom_resume(old);
+        }
+
+        /* The file may keep growing: index the bytes it has now */
+        int n = split_range(from, id.size, threads ? threads : 1, chunks);
+
+        ret = -1;
+        thread_data_t *data = scan_file(filename, "", &opts, threads, chunks, n,
+                                        init_thread_bloom, NULL, &nchunks);
+        if (!data) goto out;
+
+        /* Empty filters would skip blocks which have the word */
+        if (chunks_failed(data, nchunks)) {
+                ERR("Failed to read all of '%s', the index is left unchanged", filename);
+                goto release;
+        }
+
+        struct bloom_part_t **parts = malloc(nchunks * sizeof(*parts));
+        if (!parts) {
+                ERR("Memory allocation failed for the index");
+                goto release;
+        }
+        for (int i = 0; i < nchunks; i++)
+                parts[i] = data[i].bloom;
+
+        ret = bloom_write(index_path, filename, old, parts, nchunks, &id, from);
+        free(parts);
+        if (ret != 0) {
+                ERR("Failed to write the index '%s'", index_path);
+                goto release;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        LOG("Indexed %lu bytes (from offset %lu) into '%s' in %ld ms",
+            id.size - from, from, index_path, elapsed_ms(start, end));
+
+release:
+        for (int i = 0; i < nchunks; i++)
+                release_thread_data(&data[i]);
+        free(data);
+out:
+        bloom_close(old);
+        return ret;
+}
+
+
+/* The command line, left out of the programs linking the search engine
+ * with a main() of their own (see bench.c) */
+#ifndef TSEARCH_NO_MAIN
+
+/* Indexes built by --build-index */
+#define BUILD_WORDS    1
+#define BUILD_TRIGRAMS 2
+#define BUILD_BLOOM    4
+#define BUILD_FM       8
+
+/* Parse the comma separated list of --build-index, -1 if invalid */
+static int parse_index_kinds(const char *list) {
+        int kinds = 0;
+
+        if (!list) return BUILD_WORDS;
+        while (*list) {
+                size_t n = strcspn(list, ",");
+                if (n == 5 && strncmp(list, "words", n) == 0)
+                        kinds |= BUILD_WORDS;
+                else if (n == 8 && strncmp(list, "trigrams", n) == 0)
+                        kinds |= BUILD_TRIGRAMS;
+                else if (n == 5 && strncmp(list, "bloom", n) == 0)
+                        kinds |= BUILD_BLOOM;
+                else if (n == 2 && strncmp(list, "fm", n) == 0)
+                        kinds |= BUILD_FM;
+                else
+                        return -1;
+                list += n;
+                if (*list == ',') list++;
+        }
+        return kinds ? kinds : -1;
+}
+
+/* $XDG_CACHE_HOME/tsearch, or ~/.cache/tsearch */
+static const char *default_cache_dir(char *buf, size_t len) {
+        const char *xdg = getenv("XDG_CACHE_HOME");
+        const char *home = getenv("HOME");
+
+        if (xdg && *xdg)
+                snprintf(buf, len, "%s/tsearch", xdg);
+        else
+                snprintf(buf, len, "%s/.cache/tsearch", home ? home : ".");
+        return buf;
+}
+
+/* A JSON string: the bytes of s with quotes, backslashes and control
+ * characters escaped (other bytes are copied as they are) */
+static void print_json_string(FILE *out, const char *s) {
+        fputc('"', out);
+        for (; *s; s++) {
+                unsigned char c = *s;
+                if (c == '"' || c == '\\')
+                        fprintf(out, "\\%c", c);
+                else if (c < 0x20)
+                        fprintf(out, "\\u%04x", c);
+                else
+                        fputc(c, out);
+        }
+        fputc('"', out);
+}
+
+static int64_t timeval_ns(struct timeval tv) {
+        return (int64_t)tv.tv_sec * 1000000000 + (int64_t)tv.tv_usec * 1000;
+}
+
+/* --json: the result of the search as one object. No CPU time without
+ * before and after: the search ran in a server, with others at once */
+static void print_json(FILE *out, const char *filename, const struct search_opts_t *opts,
+                       int threads, const struct search_result_t *res,
+                       const struct rusage *before, const struct rusage *after) {
+        static const char *modes[] = {
+                [SEARCH_WORD] = "word", [SEARCH_SUBSTRING] = "substring",
+                [SEARCH_REGEX] = "regex", [SEARCH_FUZZY] = "fuzzy",
+                [SEARCH_WILDCARD] = "wildcard",
+        };
+
+        fprintf(out, "{\"file\": ");
+        print_json_string(out, filename);
+        fprintf(out, ", \"mode\": \"%s\", \"threads\": %d, \"patterns\": [{\"pattern\": ",
+                modes[opts->mode], threads);
+        print_json_string(out, res->word);
+        fprintf(out, ", \"count\": %lu}], \"occurrences\": %lu, \"wall_ns\": %ld, ",
+                res->occurrences, res->occurrences, (long)res->elapsed_ns);
+        if (before && after)
+                fprintf(out, "\"user_ns\": %ld, \"sys_ns\": %ld, ",
+                        (long)(timeval_ns(after->ru_utime) - timeval_ns(before->ru_utime)),
+                        (long)(timeval_ns(after->ru_stime) - timeval_ns(before->ru_stime)));
+        fprintf(out, "\"bytes\": %lu, \"throughput_gbps\": %.3f}\n",
+                res->bytes, res->elapsed_ns > 0 ? (double)res->bytes / res->elapsed_ns : 0.0);
+        fflush(out);
+}
+
+static void usage(void) {
+        ERR("You need to provide `./tsearch [options] <filename> <word> <num_threads>`");
+        ERR("Options:");
+        ERR("  --word-chars=<chars>   extra bytes that are part of a word (e.g. \"_-\")");
+        ERR("  --substring            count the word also inside other words");
+        ERR("  --overlapping          with --substring, count overlapping matches too");
+        ERR("  --regex                the word is a regular expression, matched per line");
+        ERR("  --max-errors=<k>       count the words within k edits of the word");
+        ERR("  --wildcard             the word is a pattern with *, ? and [...]");
+        ERR("  --build-index[=<kinds>] `./tsearch --build-index <filename> <num_threads>`");
+        ERR("                         builds the indexes in <kinds>: words (default), trigrams, bloom, fm");
+        ERR("  --histogram[=<k>]      `./tsearch --histogram <filename> <num_threads>`");
+        ERR("                         prints the k (default 10) most frequent words");
+        ERR("  --sketch               with --histogram, estimate them in bounded memory");
+        ERR("  --update-index         `./tsearch --update-index <filename> <num_threads>`");
+        ERR("                         indexes only what was appended to the file since");
+        ERR("  --index=<path>         word index (default <filename>.tsidx)");
+        ERR("  --trigram-index=<path> trigram index (default <filename>.tstri)");
+        ERR("  --bloom-index=<path>   Bloom filters (default <filename>.tsblm)");
+        ERR("  --fm-index=<path>      FM-index (default <filename>.tsfm)");
+        ERR("  --cache[=<dir>]        reuse the results of the same searches on unchanged files");
+        ERR("                         (default dir $XDG_CACHE_HOME/tsearch or ~/.cache/tsearch)");
+        ERR("  --cache-entries=<n>    results kept in the cache (default %d)", CACHE_MAX_ENTRIES);
+        ERR("  --no-index             always scan the whole file");
+        ERR("  --perf-counters        print the cycles, instructions, cache and branch misses");
+        ERR("                         and page faults of every thread's scan");
+        ERR("  --thread-stats[=all]   print how the time was spread among the threads,");
+        ERR("                         with `all` also what every thread did");
+        ERR("  --progress[=<ms>]      print the percent done, GB/s and time left every <ms>");
+        ERR("                         (default %d) on stderr", PROGRESS_INTERVAL_MS);
+        ERR("  --profile=<file>       write the sampled stacks of the scan for a flame graph");
+        ERR("  --json                 print the result as JSON on stdout, the logs on stderr");
+        ERR("  --serve=<socket>       `./tsearch --serve=<socket> [<num_workers>]`");
+        ERR("                         answers the searches of --client on a Unix socket");
+        ERR("  --client=<socket>      run the search on the server listening at <socket>");
+}
+
+int main(int argc, char **argv) {
+#if defined(__unix__) 
+        static const struct option long_options[] = {
+                { "word-chars", required_argument, NULL, 'w' },
+                { "substring", no_argument, NULL, 's' },
+                { "overlapping", no_argument, NULL, 'o' },
+                { "regex", no_argument, NULL, 'r' },
+                { "max-errors", required_argument, NULL, 'e' },
+                { "wildcard", no_argument, NULL, 'g' },
+                { "build-index", optional_argument, NULL, 'B' },
+                { "update-index", no_argument, NULL, 'U' },
+                { "index", required_argument, NULL, 'I' },
+                { "trigram-index", required_argument, NULL, 'T' },
+                { "bloom-index", required_argument, NULL, 'F' },
+                { "fm-index", required_argument, NULL, 'M' },
+                { "histogram", optional_argument, NULL, 'H' },
+                { "sketch", no_argument, NULL, 'K' },
+                { "cache", optional_argument, NULL, 'C' },
+                { "cache-entries", required_argument, NULL, 'L' },
+                { "no-index", no_argument, NULL, 'N' },
+                { "serve", required_argument, NULL, 'S' },
+                { "client", required_argument, NULL, 'R' },
+                { "perf-counters", no_argument, NULL, 'P' },
+                { "thread-stats", optional_argument, NULL, 'X' },
+                { "json", no_argument, NULL, 'J' },
+                { "profile", required_argument, NULL, 'p' },
+                { "progress", optional_argument, NULL, 'G' },
+                { NULL, 0, NULL, 0 }
+        };
+        struct search_opts_t opts = { .mode = SEARCH_WORD };
+        const char *extra_word_chars = NULL;
+        const char *index_path = NULL, *trigram_path = NULL, *bloom_path = NULL;
+        const char *fm_path = NULL, *cache_dir = NULL;
+        const char *serve_path = NULL, *client_path = NULL, *profile_path = NULL;
+        long cache_entries = CACHE_MAX_ENTRIES;
+        char default_cache[4096];
+        char default_index[4096], default_trigrams[4096], default_bloom[4096];
+        char default_fm[4096];
+        int build_index = 0, update_index = 0, no_index = 0, json = 0;
+        long histogram = 0;
+        int sketch = 0;
+        int modes = 0;
+        int opt;
+
+        while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+                switch (opt) {
+                case 'w':
+                        extra_word_chars = optarg;
+                        break;
+                case 's':
+                        opts.mode = SEARCH_SUBSTRING;
+                        modes++;
+                        break;
+                case 'o':
+                        opts.overlapping = 1;
+                        break;
+                case 'r':
+                        opts.mode = SEARCH_REGEX;
+                        modes++;
+                        break;
+                case 'e': {
+                        char *e;
+                        errno = 0;
+                        long k = strtol(optarg, &e, 10);
+                        if (errno || *e != '\0' || k < 0 || k >= FUZZY_MAX_WORD) {
+                                ERR("Invalid number of errors '%s'", optarg);
+                                goto cleanup;
+                        }
+                        opts.mode = SEARCH_FUZZY;
+                        opts.max_errors = k;
+                        modes++;
+                        break;
+                }
+                case 'g':
+                        opts.mode = SEARCH_WILDCARD;
+                        modes++;
+                        break;
+                case 'B':
+                        build_index = parse_index_kinds(optarg);
+                        if (build_index < 0) {
+                                ERR("Unknown index kinds '%s'", optarg);
+                                goto cleanup;
+                        }
+                        break;
+                case 'U':
+                        update_index = 1;
+                        break;
+                case 'K':
+                        sketch = 1;
+                        break;
+                case 'C':
+                        cache_dir = optarg ? optarg : default_cache_dir(default_cache,
+                                                                        sizeof(default_cache));
+                        break;
+                case 'L': {
+                        char *e;
+                        errno = 0;
+                        cache_entries = strtol(optarg, &e, 10);
+                        if (errno || *e != '\0' || cache_entries < 1) {
+                                ERR("Invalid number of cache entries '%s'", optarg);
+                                goto cleanup;
+                        }
+                        break;
+                }
+                case 'H': {
+                        char *e;
+                        errno = 0;
+                        histogram = optarg ? strtol(optarg, &e, 10) : 10;
+                        if (optarg && (errno || *e != '\0' || histogram < 1)) {
+                                ERR("Invalid number of words '%s'", optarg);
+                                goto cleanup;
+                        }
+                        break;
+                }
+                case 'I':
+                        index_path = optarg;
+                        break;
+                case 'T':
+                        trigram_path = optarg;
+                        break;
+                case 'F':
+                        bloom_path = optarg;
+                        break;
+                case 'M':
+                        fm_path = optarg;
+                        break;
+                case 'N':
+                        no_index = 1;
+                        break;
+                case 'S':
+                        serve_path = optarg;
+                        break;
+                case 'R':
+                        client_path = optarg;
+                        break;
+                case 'P':
+                        opts.perf_counters = 1;
+                        break;
+                case 'X':
+                        if (optarg && strcmp(optarg, "all") != 0) {
+                                ERR("Unknown --thread-stats '%s'", optarg);
+                                goto cleanup;
+                        }
+                        opts.thread_stats = optarg ? 2 : 1;
+                        break;
+                case 'J':
+                        json = 1;
+                        break;
+                case 'p':
+                        profile_path = optarg;
+                        break;
+                case 'G':
+                        opts.progress = optarg ? STR_TO_LONG(optarg) : PROGRESS_INTERVAL_MS;
+                        if (opts.progress <= 0) {
+                                ERR("Invalid --progress interval '%s'", optarg);
+                                goto cleanup;
+                        }
+                        break;
+                default:
+                        usage();
+                        goto cleanup;
+                }
+        }
+
+        if (sketch && !histogram) {
+                ERR("--sketch can only be used with --histogram");
+                goto cleanup;
+        }
+
+        /* The server searches with its own settings for these */
+        if (client_path) {
+                const char *local = serve_path ? "--serve" :
+                        build_index ? "--build-index" :
+                        update_index ? "--update-index" :
+                        histogram ? "--histogram" :
+                        index_path ? "--index" :
+                        trigram_path ? "--trigram-index" :
+                        bloom_path ? "--bloom-index" :
+                        fm_path ? "--fm-index" :
+                        cache_dir ? "--cache" :
+                        cache_entries != CACHE_MAX_ENTRIES ? "--cache-entries" :
+                        opts.perf_counters ? "--perf-counters" :
+                        opts.thread_stats ? "--thread-stats" :
+                        opts.progress ? "--progress" :
+                        profile_path ? "--profile" : NULL;
+                if (local) {
+                        ERR("%s can't be sent to the server, it can't be used with --client", local);
+                        goto cleanup;
+                }
+        }
+
+        if (serve_path) {
+                long workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+                if (argc - optind > 1) {
+                        usage();
+                        goto cleanup;
+                }
+                if (argc - optind == 1)
+                        workers = STR_TO_LONG(argv[optind]);
+                if (workers < 1) workers = 1;
+
+                word_chars_init(extra_word_chars);
+                opts.cache_dir = cache_dir;
+                opts.cache_entries = cache_entries;
+                if (profile_path && profile_start() != 0)
+                        goto cleanup;
+                if (tsearch_serve(serve_path, workers, &opts) != 0)
+                        goto cleanup;
+                if (profile_path && profile_write(profile_path) != 0)
+                        goto cleanup;
+                return 0;
+        }
+
+        /* Args checking */
+        if (argc - optind != (build_index || update_index || histogram ? 2 : 3)) {
+                usage();
+                goto cleanup;
+        }
+        /* Shift so that argv[1..3] are the positional arguments */
+        argv += optind - 1;
+
+        if (!index_path) {
+                snprintf(default_index, sizeof(default_index), "%s.tsidx", argv[1]);
+                index_path = default_index;
+        }
+        if (!trigram_path) {
+                snprintf(default_trigrams, sizeof(default_trigrams), "%s.tstri", argv[1]);
+                trigram_path = default_trigrams;
+        }
+        if (!bloom_path) {
+                snprintf(default_bloom, sizeof(default_bloom), "%s.tsblm", argv[1]);
+                bloom_path = default_bloom;
+        }
+        if (!fm_path) {
+                snprintf(default_fm, sizeof(default_fm), "%s.tsfm", argv[1]);
+                fm_path = default_fm;
+        }
+
+        word_chars_init(extra_word_chars);
+
+        if (build_index) {
+                uint8_t threads = (uint8_t) STR_TO_LONG(argv[2]);
+                if ((build_index & BUILD_WORDS) &&
+                    tsearch_build_index(argv[1], index_path, threads) != 0)
+                        goto cleanup;
+                if ((build_index & BUILD_TRIGRAMS) &&
+                    tsearch_build_trigrams(argv[1], trigram_path, threads) != 0)
+                        goto cleanup;
+                if ((build_index & BUILD_BLOOM) &&
+                    tsearch_build_bloom(argv[1], bloom_path, threads) != 0)
+                        goto cleanup;
+                if ((build_index & BUILD_FM) &&
+                    tsearch_build_fm(argv[1], fm_path, threads) != 0)
+                        goto cleanup;
+                return 0;
+        }
+        if (histogram) {
+                uint8_t threads = (uint8_t) STR_TO_LONG(argv[2]);
+                if (tsearch_histogram(argv[1], threads, histogram, sketch) != 0)
+                        goto cleanup;
+                return 0;
+        }
+        if (update_index) {
+                uint8_t threads = (uint8_t) STR_TO_LONG(argv[2]);
+                if (tsearch_update_index(argv[1], index_path, threads) != 0)
+                        goto cleanup;
+                /* The Bloom filters grow the same way, if the file has them */
+                if (access(bloom_path, F_OK) == 0 &&
+                    tsearch_build_bloom(argv[1], bloom_path, threads) != 0)
+                        goto cleanup;
+                return 0;
+        }
+        opts.index_path = no_index ? NULL : index_path;
+        opts.trigram_path = no_index ? NULL : trigram_path;
+        opts.bloom_path = no_index ? NULL : bloom_path;
+        opts.fm_path = no_index ? NULL : fm_path;
+        opts.cache_dir = cache_dir;
+        opts.cache_entries = cache_entries;
+
+        if (modes > 1) {
+                ERR("Only one of --substring, --regex, --max-errors and --wildcard can be used");
+                goto cleanup;
+        }
+
+        if (opts.overlapping && opts.mode != SEARCH_SUBSTRING) {
+                ERR("--overlapping can only be used with --substring");
+                goto cleanup;
+        }
+
+        if (argv[2][0] == '\0') {
+                ERR("The word to search can't be empty");
+                goto cleanup;
+        }
+
+        /* Get the word to search */
+        char word[MAX_WORD_LENGTH];
+        strncpy(word, argv[2], sizeof(word) - 1);
+        word[sizeof(word) - 1] = '\0';
+
+        uint8_t threads = (uint8_t) STR_TO_LONG(argv[3]);
+
+        /* The result alone on stdout, the logs go to stderr */
+        FILE *json_out = NULL;
+        if (json) {
+                fflush(stdout);
+                json_out = fdopen(dup(STDOUT_FILENO), "w");
+                if (!json_out || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+                        ERR("Failed to redirect the logs");
+                        goto cleanup;
+                }
+        }
+
+        if (profile_path && profile_start() != 0)
+                goto cleanup;
+
+        LOG("Searching for word '%s' in '%s' using %d threads", 
+                        word, argv[1], threads);
+        
+        /* Initialize the search and get the result */
+        struct rusage usage_before, usage_after;
+        getrusage(RUSAGE_SELF, &usage_before);
+        struct search_result_t *res = client_path ?
+                tsearch_remote(client_path, argv[1], word, &opts, threads) :
+                tsearch(argv[1], word, &opts, threads);
+        getrusage(RUSAGE_SELF, &usage_after);
+
+        if (res) {
+                LOG("Found %lu occurrences in %ld ms", 
+                res->occurrences, res->elapsed_time);
+                if (json_out)
+                        print_json(json_out, argv[1], &opts, threads, res,
+                                   client_path ? NULL : &usage_before,
+                                   client_path ? NULL : &usage_after);
+        } else {
+                ERR("Failed to return a result");
+                goto cleanup;
+        }
+
+        free(res);
+
+        if (profile_path && profile_write(profile_path) != 0)
+                goto cleanup;
         return 0;
 
 cleanup:
@@ -343,3 +2668,4 @@ cleanup:
         return 1;
 #endif
 }
+#endif /* TSEARCH_NO_MAIN */
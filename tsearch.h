@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Definitions shared by tsearch.c and the matching engines living in
+ * their own files.
+ */
+#ifndef TSEARCH_H
+#define TSEARCH_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define LOG(str, ...) printf("LOG: " str "\n", ##__VA_ARGS__);
+#define ERR(str, ...) fprintf(stderr, "ERR: " str "\n", ##__VA_ARGS__);
+
+#define MAX_WORD_LENGTH 128
+/* Bytes read at a time by a chunk; small values only for testing (see fuzz.c) */
+#ifndef BUFFER_SIZE
+#define BUFFER_SIZE 4096
+#endif
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* What a match is */
+enum search_mode_t {
+        SEARCH_WORD,        /* The word surrounded by non-word characters */
+        SEARCH_SUBSTRING,   /* Any occurrence of the bytes, no boundaries */
+        SEARCH_REGEX,       /* The word is a regular expression, see regex_dfa.h */
+        SEARCH_FUZZY,       /* Words within max_errors edits, see fuzzy.h */
+        SEARCH_WILDCARD,    /* The word is a glob pattern, see wildcard.h */
+};
+
+/* Options of a search, read-only while the threads are running */
+struct search_opts_t {
+        enum search_mode_t mode;
+        int overlapping;    /* SEARCH_SUBSTRING: "aa" is found 2 times in "aaa" */
+        int max_errors;     /* SEARCH_FUZZY: edit distance allowed */
+        const char *index_path; /* SEARCH_WORD: index answering while fresh, or NULL */
+        const char *trigram_path; /* Trigram index telling the blocks to scan, or NULL */
+        const char *bloom_path; /* SEARCH_WORD: Bloom filters of the blocks, or NULL */
+        const char *fm_path;    /* SEARCH_SUBSTRING: FM-index answering while fresh, or NULL */
+        const char *cache_dir;  /* Results of previous searches, or NULL */
+        long cache_entries;     /* Results kept in cache_dir */
+        int perf_counters;      /* Count the hardware events of the scans, see perf.h */
+        int thread_stats;       /* Time the threads: 1 summary, 2 also every thread */
+        long progress;          /* Report the progress of the scans every ms, 0 never */
+};
+
+/* Structure given at the end of the search as result */
+struct search_result_t {
+        time_t    elapsed_time;           /* The runtime of the search */
+        char      word[MAX_WORD_LENGTH];  /* Word to search */
+        uint64_t  occurrences;            /* Occurrence founds */
+        int64_t   elapsed_ns;             /* The runtime, in ns */
+        uint64_t  bytes;                  /* Read from the file (0 if answered by an index) */
+};
+
+/* Word characters classification, filled by word_chars_init() before
+ * any search and read-only afterwards. */
+extern uint8_t word_chars[256];
+#define IS_WORD_CHAR(c) (word_chars[(unsigned char)(c)])
+
+void word_chars_init(const char *extra);
+
+/* Identity of a file's content: an index or a cached answer built for it
+ * is valid as long as none of these change. */
+struct file_id_t {
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t size;
+        int64_t  mtime_sec;
+        int64_t  mtime_nsec;
+};
+
+int file_id_get(const char *filename, struct file_id_t *id);
+
+/* Hashes of the first and of the last 4 KB of [0, end) of the file. An
+ * index covering [0, end) of a file which then only grows is still
+ * valid if they match: a cheap way to tell an append from a rewrite. */
+int file_guards(const char *filename, uint64_t end, uint64_t guards[2]);
+
+/* Write the buffers to path, replacing it atomically: the data goes to
+ * a temporary file in the same directory which is synced and renamed, so
+ * a reader sees either the old file or the whole new one. */
+struct iovec;
+int replace_file(const char *path, const struct iovec *iov, int iovcnt);
+
+/* Results of opening an index and of its lookups */
+#define INDEX_OK       0
+#define INDEX_MISSING -1    /* No index, or not readable */
+#define INDEX_STALE   -2    /* Built for another version of the file */
+#define INDEX_CORRUPT -3
+
+/* A part of the file to scan: the matches starting in [start, end) */
+struct range_t {
+        long start;
+        long end;
+};
+
+/* First occurrence of word in text, or NULL */
+const char *find_substring(const char *text, size_t text_len,
+                           const char *word, int word_len);
+
+uint64_t count_word_occurrences(const char *text, size_t text_len,
+                                const char *word, int word_len);
+
+struct search_result_t *tsearch(char *filename, char word[MAX_WORD_LENGTH],
+                                const struct search_opts_t *opts, uint8_t threads);
+
+/* The matching kernel of a search, run on buffers in memory: each buffer
+ * is searched as if it were a whole file. For measuring the kernels (see
+ * kbench.c), not thread-safe: one matcher per thread. */
+struct tsearch_matcher_t;
+struct tsearch_matcher_t *tsearch_matcher_new(const char *word,
+                                              const struct search_opts_t *opts);
+uint64_t tsearch_matcher_count(struct tsearch_matcher_t *m, const char *text, size_t len);
+void tsearch_matcher_free(struct tsearch_matcher_t *m);
+
+/* Run the chunks of the following searches on the workers of pool (see
+ * pool.h) instead of threads of their own, or again on their own threads
+ * with NULL. Set before any search is running. */
+struct pool_t;
+void tsearch_set_pool(struct pool_t *pool);
+
+/* Write the word index of filename to index_path, see wordindex.h */
+int tsearch_build_index(const char *filename, const char *index_path, uint8_t threads);
+
+/* Add what was appended to filename since the last update to its word
+ * index, building it if it's missing or the file was rewritten */
+int tsearch_update_index(const char *filename, const char *index_path, uint8_t threads);
+
+/* Write the trigram index of filename to index_path, see trigram.h */
+int tsearch_build_trigrams(const char *filename, const char *index_path, uint8_t threads);
+
+/* Build or extend the Bloom filters of filename, see bloom.h */
+int tsearch_build_bloom(const char *filename, const char *index_path, uint8_t threads);
+
+/* Write the FM-index of filename to index_path, see fmindex.h */
+int tsearch_build_fm(const char *filename, const char *index_path, uint8_t threads);
+
+/* Print the k most frequent words of filename, see histogram.h, or
+ * their estimates with sketch (see sketch.h) */
+int tsearch_histogram(const char *filename, uint8_t threads, size_t k, int sketch);
+
+#endif /* TSEARCH_H */
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ========================= Wildcard patterns ===========================
+ *
+ * Every step of the compiled pattern is either a set of bytes (a literal
+ * is a set of one byte, `?` the set of word characters) or a star. The
+ * matcher is the usual one for globs: walk the word and, on a mismatch,
+ * go back to the last star and let it eat one more byte. Words are short,
+ * so this is cheap, and patterns without stars are rejected on length
+ * before looking at a single byte.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "tsearch.h"
+#include "wildcard.h"
+
+#define SET_HAS(set, c) ((set)[(uint8_t)(c) >> 3] & (1 << ((uint8_t)(c) & 7)))
+#define SET_ADD(set, c) ((set)[(uint8_t)(c) >> 3] |= (1 << ((uint8_t)(c) & 7)))
+
+struct step {
+        int star;
+        uint8_t set[32];
+};
+
+struct wildcard_t {
+        int nsteps;
+        int fixed;                      /* Steps that are not stars */
+        int stars;
+        char literal[MAX_WORD_LENGTH];
+        int literal_len;
+        struct step steps[];
+};
+
+struct wildcard_t *wildcard_compile(const char *pattern, char *err, size_t err_len) {
+        size_t n = strlen(pattern);
+        struct wildcard_t *w = calloc(1, sizeof(*w) + n * sizeof(struct step));
+        char run[MAX_WORD_LENGTH];
+        int run_len = 0;
+
+        if (!w) {
+                snprintf(err, err_len, "out of memory");
+                return NULL;
+        }
+
+        for (const char *p = pattern; *p; p++) {
+                struct step *st = &w->steps[w->nsteps];
+                int literal = -1;
+
+                if (*p == '*') {
+                        /* "**" is the same as "*" */
+                        if (w->nsteps == 0 || !w->steps[w->nsteps - 1].star) {
+                                st->star = 1;
+                                w->nsteps++;
+                                w->stars++;
+                        }
+                } else if (*p == '?') {
+                        for (int c = 0; c < 256; c++)
+                                if (IS_WORD_CHAR(c)) SET_ADD(st->set, c);
+                        w->nsteps++;
+                } else if (*p == '[') {
+                        const char *q = p + 1;
+                        int negate = (*q == '!' || *q == '^');
+                        if (negate) q++;
+                        /* A ']' right after the '[' is part of the set */
+                        for (int first = 1; *q && (*q != ']' || first); first = 0) {
+                                uint8_t lo = *q++;
+                                if (lo == '\\' && *q) lo = *q++;
+                                if (q[0] == '-' && q[1] && q[1] != ']') {
+                                        uint8_t hi = q[1];
+                                        q += 2;
+                                        if (hi == '\\' && *q) hi = *q++;
+                                        for (int c = lo; c <= hi; c++) SET_ADD(st->set, c);
+                                } else {
+                                        SET_ADD(st->set, lo);
+                                }
+                        }
+                        if (*q != ']') {
+                                snprintf(err, err_len, "missing ]");
+                                goto error;
+                        }
+                        /* Only word characters can be in a word */
+                        for (int c = 0; c < 256; c++) {
+                                int in = SET_HAS(st->set, c) ? !negate : negate;
+                                st->set[c >> 3] &= ~(1 << (c & 7));
+                                if (in && IS_WORD_CHAR(c)) SET_ADD(st->set, c);
+                        }
+                        w->nsteps++;
+                        p = q;
+                } else {
+                        if (*p == '\\' && p[1]) p++;
+                        if (!IS_WORD_CHAR(*p)) {
+                                snprintf(err, err_len, "'%c' is not a word character, "
+                                         "a pattern matches a single word", *p);
+                                goto error;
+                        }
+                        SET_ADD(st->set, *p);
+                        literal = (uint8_t)*p;
+                        w->nsteps++;
+                }
+
+                /* Track the longest run of literal bytes */
+                if (literal >= 0) {
+                        run[run_len++] = literal;
+                } else {
+                        run_len = 0;
+                }
+                if (run_len > w->literal_len) {
+                        memcpy(w->literal, run, run_len);
+                        w->literal_len = run_len;
+                }
+        }
+
+        w->fixed = w->nsteps - w->stars;
+        if (w->nsteps == 0) {
+                snprintf(err, err_len, "empty pattern");
+                goto error;
+        }
+        return w;
+
+error:
+        free(w);
+        return NULL;
+}
+
+void wildcard_free(struct wildcard_t *w) {
+        free(w);
+}
+
+int wildcard_match(const struct wildcard_t *w, const char *s, size_t len) {
+        if (w->stars == 0 ? len != (size_t)w->fixed : len < (size_t)w->fixed)
+                return 0;
+
+        int si = 0, pi = 0;
+        int star_pi = -1, star_si = 0;
+
+        while ((size_t)si < len) {
+                if (pi < w->nsteps && !w->steps[pi].star &&
+                    SET_HAS(w->steps[pi].set, s[si])) {
+                        si++;
+                        pi++;
+                } else if (pi < w->nsteps && w->steps[pi].star) {
+                        star_pi = pi++;
+                        star_si = si;
+                } else if (star_pi >= 0) {
+                        /* Backtrack: the last star takes one more byte */
+                        pi = star_pi + 1;
+                        si = ++star_si;
+                } else {
+                        return 0;
+                }
+        }
+        while (pi < w->nsteps && w->steps[pi].star)
+                pi++;
+        return pi == w->nsteps;
+}
+
+const char *wildcard_literal(const struct wildcard_t *w, int *len) {
+        *len = w->literal_len;
+        return w->literal;
+}
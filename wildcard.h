@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ========================= Wildcard patterns ===========================
+ *
+ * Glob-style patterns matched against whole words:
+ *
+ *   *        any sequence of word characters (also none)
+ *   ?        a single word character
+ *   [abc]    one of the listed bytes, ranges like [a-z] are allowed and
+ *            [!abc] or [^abc] negate the set
+ *   \c       the byte c
+ *
+ * So `timeout*` counts the words starting with "timeout" and
+ * `conn*refused` (with --word-chars=_) finds "conn_refused" and
+ * "connection_refused". The pattern is compiled once into a list of
+ * steps, shared read-only by the threads.
+ */
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#include <stddef.h>
+
+struct wildcard_t;
+
+/* On error returns NULL and writes a message to err. word_chars must be
+ * initialized, a literal non-word byte can never match. */
+struct wildcard_t *wildcard_compile(const char *pattern, char *err, size_t err_len);
+void wildcard_free(struct wildcard_t *w);
+
+/* Does the whole word s[0, len) match? */
+int wildcard_match(const struct wildcard_t *w, const char *s, size_t len);
+
+/* Longest run of literal bytes of the pattern (may be empty), every
+ * matching word contains it. */
+const char *wildcard_literal(const struct wildcard_t *w, int *len);
+
+#endif /* WILDCARD_H */
@@ -0,0 +1,630 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ============================ Word index ===============================
+ *
+ * A part is an open addressing hash table of the words seen so far (the
+ * bytes live in one arena, no allocation per word) and the list of
+ * (word, offset) occurrences in file order. Merging sorts the occurrences
+ * of each part by word with a counting sort, which keeps the offsets of
+ * a word sorted, and the distinct words of all the parts by their bytes.
+ *
+ * The file is made to be mmap()ed and used as it is, nothing is parsed
+ * when it's opened. Layout (native byte order, offsets from the start of
+ * the file):
+ *
+ *   struct index_header
+ *   terms        nterms struct index_term sorted by word, 8 bytes aligned
+ *   strings      the bytes of the words, referenced by the terms
+ *   postings     page aligned, for each term the offsets of its
+ *                occurrences as varint deltas from the previous one (the
+ *                first from 0), every term starting 8 bytes aligned
+ *
+ * A lookup is a binary search on the terms: the count is in the term, so
+ * only a few pages of the term table and of the strings are touched.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "tsearch.h"
+#include "wordindex.h"
+
+#define INDEX_MAGIC   "TSIDX\0\0\0"
+#define INDEX_VERSION 3
+#define INDEX_PAGE    4096
+
+struct index_header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t header_size;
+        uint8_t  word_chars[256];
+        struct index_meta_t meta;
+        uint64_t file_size;
+        uint64_t nterms;
+        uint64_t terms;         /* Offsets of the sections */
+        uint64_t strings;
+        uint64_t strings_size;
+        uint64_t postings;
+        uint64_t postings_size;
+};
+
+struct index_term {
+        uint64_t str;           /* From the start of the strings */
+        uint64_t len;
+        uint64_t count;
+        uint64_t postings;      /* From the start of the postings */
+        uint64_t postings_size;
+};
+
+struct wordindex_t {
+        const uint8_t *map;
+        size_t size;
+        const struct index_header *hdr;
+        const struct index_term *terms;
+        const char *strings;
+};
+
+struct part_term {
+        size_t   str;       /* Offset in the arena */
+        uint32_t len;
+        uint32_t count;
+        uint64_t hash;
+};
+
+struct index_part_t {
+        uint32_t *slots;    /* Term id + 1, 0 if empty */
+        uint32_t nslots;
+        struct part_term *terms;
+        uint32_t nterms, terms_cap;
+        char *arena;
+        size_t arena_len, arena_cap;
+        uint32_t *occ_term;
+        uint64_t *occ_off;
+        size_t nocc, occ_cap;
+};
+
+/* Growable byte buffer for the sections of the file */
+struct buf {
+        uint8_t *data;
+        size_t len, cap;
+};
+
+static uint64_t hash_word(const char *s, size_t len) {
+        uint64_t h = 0xcbf29ce484222325ULL;     /* FNV-1a */
+
+        for (size_t i = 0; i < len; i++) {
+                h ^= (uint8_t)s[i];
+                h *= 0x100000001b3ULL;
+        }
+        return h;
+}
+
+static int grow(void **p, size_t *cap, size_t need, size_t size) {
+        if (need <= *cap) return 0;
+
+        size_t n = *cap ? *cap : 64;
+        while (n < need) n *= 2;
+        void *q = realloc(*p, n * size);
+        if (!q) return -1;
+        *p = q;
+        *cap = n;
+        return 0;
+}
+
+struct index_part_t *index_part_new(void) {
+        struct index_part_t *part = calloc(1, sizeof(*part));
+        if (!part) return NULL;
+
+        part->nslots = 1024;
+        part->slots = calloc(part->nslots, sizeof(uint32_t));
+        if (!part->slots) {
+                free(part);
+                return NULL;
+        }
+        return part;
+}
+
+void index_part_free(struct index_part_t *part) {
+        if (!part) return;
+        free(part->slots);
+        free(part->terms);
+        free(part->arena);
+        free(part->occ_term);
+        free(part->occ_off);
+        free(part);
+}
+
+/* Double the table once it's half full */
+static int rehash(struct index_part_t *part) {
+        uint32_t n = part->nslots * 2;
+        uint32_t *slots = calloc(n, sizeof(uint32_t));
+        if (!slots) return -1;
+
+        for (uint32_t t = 0; t < part->nterms; t++) {
+                uint32_t i = part->terms[t].hash & (n - 1);
+                while (slots[i]) i = (i + 1) & (n - 1);
+                slots[i] = t + 1;
+        }
+        free(part->slots);
+        part->slots = slots;
+        part->nslots = n;
+        return 0;
+}
+
+int index_part_add(struct index_part_t *part, const char *word, size_t len,
+                   uint64_t offset) {
+        uint64_t h = hash_word(word, len);
+        uint32_t i = h & (part->nslots - 1);
+        uint32_t t;
+
+        for (;;) {
+                if (!part->slots[i]) break;
+                t = part->slots[i] - 1;
+                if (part->terms[t].hash == h && part->terms[t].len == len &&
+                    memcmp(part->arena + part->terms[t].str, word, len) == 0)
+                        goto found;
+                i = (i + 1) & (part->nslots - 1);
+        }
+
+        /* New word */
+        size_t cap = part->terms_cap;
+        if (grow((void **)&part->terms, &cap, part->nterms + 1, sizeof(struct part_term)) != 0 ||
+            grow((void **)&part->arena, &part->arena_cap, part->arena_len + len, 1) != 0)
+                return -1;
+        part->terms_cap = cap;
+
+        t = part->nterms++;
+        part->terms[t] = (struct part_term) {
+                .str = part->arena_len, .len = len, .count = 0, .hash = h,
+        };
+        memcpy(part->arena + part->arena_len, word, len);
+        part->arena_len += len;
+        part->slots[i] = t + 1;
+
+        if (part->nterms * 2 > part->nslots && rehash(part) != 0)
+                return -1;
+
+found:
+        cap = part->occ_cap;
+        if (grow((void **)&part->occ_term, &cap, part->nocc + 1, sizeof(uint32_t)) != 0 ||
+            grow((void **)&part->occ_off, &part->occ_cap, part->nocc + 1, sizeof(uint64_t)) != 0)
+                return -1;
+
+        part->terms[t].count++;
+        part->occ_term[part->nocc] = t;
+        part->occ_off[part->nocc] = offset;
+        part->nocc++;
+        return 0;
+}
+
+static int buf_put(struct buf *b, const void *data, size_t len) {
+        if (grow((void **)&b->data, &b->cap, b->len + len, 1) != 0)
+                return -1;
+        memcpy(b->data + b->len, data, len);
+        b->len += len;
+        return 0;
+}
+
+static int buf_varint(struct buf *b, uint64_t v) {
+        uint8_t tmp[10];
+        int n = 0;
+
+        do {
+                tmp[n] = v & 0x7f;
+                v >>= 7;
+                if (v) tmp[n] |= 0x80;
+                n++;
+        } while (v);
+        return buf_put(b, tmp, n);
+}
+
+/* A distinct word of a part, sorted by bytes then by part */
+struct term_ref {
+        const char *str;
+        uint32_t len;
+        int part;
+        uint32_t id;
+};
+
+static int cmp_ref(const void *a, const void *b) {
+        const struct term_ref *x = a, *y = b;
+        int c = memcmp(x->str, y->str, MIN(x->len, y->len));
+
+        if (c) return c;
+        if (x->len != y->len) return x->len < y->len ? -1 : 1;
+        return x->part - y->part;
+}
+
+/* Offsets of the part grouped by term: the ones of term t are
+ * post[first[t] .. first[t + 1]), still in file order. */
+static int group_part(const struct index_part_t *part, size_t **first, uint64_t **post) {
+        *first = calloc(part->nterms + 1, sizeof(size_t));
+        *post = malloc((part->nocc ? part->nocc : 1) * sizeof(uint64_t));
+        if (!*first || !*post) return -1;
+
+        for (uint32_t t = 0; t < part->nterms; t++)
+                (*first)[t + 1] = (*first)[t] + part->terms[t].count;
+
+        size_t *fill = malloc((part->nterms ? part->nterms : 1) * sizeof(size_t));
+        if (!fill) return -1;
+        memcpy(fill, *first, part->nterms * sizeof(size_t));
+        for (size_t i = 0; i < part->nocc; i++)
+                (*post)[fill[part->occ_term[i]]++] = part->occ_off[i];
+        free(fill);
+        return 0;
+}
+
+static int buf_pad(struct buf *b, size_t align) {
+        static const uint8_t zero[INDEX_PAGE];
+
+        return buf_put(b, zero, (align - b->len % align) % align);
+}
+
+int wordindex_write(const char *path, struct index_part_t **parts, int nparts,
+                    const struct index_meta_t *meta, struct index_stats_t *stats) {
+        size_t **first = calloc(nparts, sizeof(size_t *));
+        uint64_t **post = calloc(nparts, sizeof(uint64_t *));
+        struct term_ref *refs = NULL;
+        struct buf terms = {0}, strings = {0}, postings = {0}, head = {0};
+        size_t nrefs = 0;
+        int ret = -1;
+
+        memset(stats, 0, sizeof(*stats));
+        if (!first || !post) goto out;
+
+        for (int p = 0; p < nparts; p++) {
+                if (group_part(parts[p], &first[p], &post[p]) != 0)
+                        goto out;
+                nrefs += parts[p]->nterms;
+        }
+
+        refs = malloc((nrefs ? nrefs : 1) * sizeof(*refs));
+        if (!refs) goto out;
+
+        nrefs = 0;
+        for (int p = 0; p < nparts; p++) {
+                for (uint32_t t = 0; t < parts[p]->nterms; t++) {
+                        refs[nrefs++] = (struct term_ref) {
+                                .str = parts[p]->arena + parts[p]->terms[t].str,
+                                .len = parts[p]->terms[t].len,
+                                .part = p, .id = t,
+                        };
+                }
+        }
+        qsort(refs, nrefs, sizeof(*refs), cmp_ref);
+
+        /* Each run of equal words becomes one term, its offsets are the
+         * ones of the parts in file order. */
+        for (size_t i = 0, j; i < nrefs; i = j) {
+                struct index_term term = {
+                        .str = strings.len, .len = refs[i].len,
+                        .postings = postings.len,
+                };
+                uint64_t prev = 0;
+
+                for (j = i; j < nrefs && refs[j].len == refs[i].len &&
+                            memcmp(refs[j].str, refs[i].str, refs[i].len) == 0; j++) {
+                        const struct term_ref *r = &refs[j];
+
+                        for (size_t k = first[r->part][r->id]; k < first[r->part][r->id + 1]; k++) {
+                                if (buf_varint(&postings, post[r->part][k] - prev) != 0)
+                                        goto out;
+                                prev = post[r->part][k];
+                                term.count++;
+                        }
+                }
+                term.postings_size = postings.len - term.postings;
+
+                if (buf_pad(&postings, 8) != 0 ||
+                    buf_put(&strings, refs[i].str, refs[i].len) != 0 ||
+                    buf_put(&terms, &term, sizeof(term)) != 0)
+                        goto out;
+
+                stats->terms++;
+                stats->words += term.count;
+        }
+
+        struct index_header hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+        hdr.version = INDEX_VERSION;
+        hdr.header_size = sizeof(hdr);
+        hdr.meta = *meta;
+        memcpy(hdr.word_chars, word_chars, sizeof(hdr.word_chars));
+        hdr.nterms = stats->terms;
+
+        /* Header, terms and strings are built in memory, then the postings
+         * are appended on the next page. */
+        if (buf_put(&head, &hdr, sizeof(hdr)) != 0 || buf_pad(&head, 8) != 0)
+                goto out;
+        hdr.terms = head.len;
+        if (buf_put(&head, terms.data, terms.len) != 0)
+                goto out;
+        hdr.strings = head.len;
+        hdr.strings_size = strings.len;
+        if (buf_put(&head, strings.data, strings.len) != 0 || buf_pad(&head, INDEX_PAGE) != 0)
+                goto out;
+        hdr.postings = head.len;
+        hdr.postings_size = postings.len;
+        hdr.file_size = head.len + postings.len;
+        memcpy(head.data, &hdr, sizeof(hdr));
+
+        struct iovec iov[] = {
+                { head.data, head.len },
+                { postings.data, postings.len },
+        };
+        ret = replace_file(path, iov, 2);
+
+out:
+        for (int p = 0; first && post && p < nparts; p++) {
+                free(first[p]);
+                free(post[p]);
+        }
+        free(first);
+        free(post);
+        free(refs);
+        free(terms.data);
+        free(strings.data);
+        free(postings.data);
+        free(head.data);
+        return ret;
+}
+
+/* Are the sections of the header inside the mapped file? */
+static int check_layout(const struct index_header *hdr, size_t size) {
+        if (hdr->file_size != size || hdr->header_size != sizeof(*hdr))
+                return -1;
+        if (hdr->terms % 8 || hdr->terms > size ||
+            hdr->nterms > (size - hdr->terms) / sizeof(struct index_term))
+                return -1;
+        if (hdr->strings > size || hdr->strings_size > size - hdr->strings)
+                return -1;
+        if (hdr->postings > size || hdr->postings_size > size - hdr->postings)
+                return -1;
+        if (hdr->meta.start > hdr->meta.end || hdr->meta.tail_len >= MAX_WORD_LENGTH)
+                return -1;
+        return 0;
+}
+
+struct wordindex_t *wordindex_open(const char *path, int *ret) {
+        struct wordindex_t *idx = NULL;
+        struct stat st;
+        void *map;
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                *ret = INDEX_MISSING;
+                return NULL;
+        }
+
+        *ret = INDEX_CORRUPT;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct index_header)) {
+                close(fd);
+                return NULL;
+        }
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+                return NULL;
+
+        const struct index_header *hdr = map;
+        if (memcmp(hdr->magic, INDEX_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != INDEX_VERSION || check_layout(hdr, st.st_size) != 0)
+                goto fail;
+
+        if (memcmp(hdr->word_chars, word_chars, sizeof(hdr->word_chars)) != 0) {
+                *ret = INDEX_STALE;
+                goto fail;
+        }
+
+        idx = malloc(sizeof(*idx));
+        if (!idx) goto fail;
+
+        idx->map = map;
+        idx->size = st.st_size;
+        idx->hdr = hdr;
+        idx->terms = (const struct index_term *)(idx->map + hdr->terms);
+        idx->strings = (const char *)idx->map + hdr->strings;
+        *ret = INDEX_OK;
+        return idx;
+
+fail:
+        munmap(map, st.st_size);
+        return NULL;
+}
+
+void wordindex_close(struct wordindex_t *idx) {
+        if (!idx) return;
+        munmap((void *)idx->map, idx->size);
+        free(idx);
+}
+
+const struct index_meta_t *wordindex_meta(const struct wordindex_t *idx) {
+        return &idx->hdr->meta;
+}
+
+int wordindex_lookup(const struct wordindex_t *idx, const char *word, size_t len,
+                     uint64_t *count) {
+        size_t lo = 0, hi = idx->hdr->nterms;
+
+        *count = 0;
+        while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                const struct index_term *t = &idx->terms[mid];
+
+                if (t->str > idx->hdr->strings_size || t->len > idx->hdr->strings_size - t->str)
+                        return INDEX_CORRUPT;
+
+                int c = memcmp(idx->strings + t->str, word, MIN(t->len, len));
+                if (c == 0 && t->len != len) c = t->len < len ? -1 : 1;
+                if (c == 0) {
+                        *count = t->count;
+                        break;
+                }
+                if (c < 0) lo = mid + 1;
+                else hi = mid;
+        }
+        return INDEX_OK;
+}
+
+void wordindex_segment_path(const char *path, int seg, char *buf, size_t len) {
+        if (seg == 0)
+                snprintf(buf, len, "%s", path);
+        else
+                snprintf(buf, len, "%s.%d", path, seg);
+}
+
+int wordindex_set_open(const char *path, struct index_set_t *set) {
+        char name[4096];
+        int ret;
+
+        set->n = 0;
+        set->seg[0] = wordindex_open(path, &ret);
+        if (!set->seg[0]) return ret;
+        if (wordindex_meta(set->seg[0])->start != 0) {
+                wordindex_close(set->seg[0]);
+                return INDEX_CORRUPT;
+        }
+        set->n = 1;
+
+        /* The chain stops at the first segment not following the previous
+         * one, e.g. left behind by a compaction */
+        while (set->n < INDEX_MAX_SEGMENTS) {
+                wordindex_segment_path(path, set->n, name, sizeof(name));
+                struct wordindex_t *seg = wordindex_open(name, &ret);
+                if (!seg) break;
+                if (wordindex_meta(seg)->start != wordindex_meta(set->seg[set->n - 1])->end) {
+                        wordindex_close(seg);
+                        break;
+                }
+                set->seg[set->n++] = seg;
+        }
+        return INDEX_OK;
+}
+
+void wordindex_set_close(struct index_set_t *set) {
+        for (int i = 0; i < set->n; i++)
+                wordindex_close(set->seg[i]);
+        set->n = 0;
+}
+
+const struct index_meta_t *wordindex_set_meta(const struct index_set_t *set) {
+        return wordindex_meta(set->seg[set->n - 1]);
+}
+
+int wordindex_set_count(const struct index_set_t *set, const char *word, size_t len,
+                        uint64_t *count) {
+        const struct index_meta_t *last = wordindex_set_meta(set);
+
+        *count = 0;
+        for (int i = 0; i < set->n; i++) {
+                uint64_t n;
+                int ret = wordindex_lookup(set->seg[i], word, len, &n);
+                if (ret != INDEX_OK) return ret;
+                *count += n;
+        }
+
+        /* The word at the end of the file, only counted by the last segment */
+        if (last->tail_len == len && memcmp(last->tail, word, len) == 0)
+                (*count)++;
+        return INDEX_OK;
+}
+
+/* Give back the occurrences of a segment as a part, in file order */
+static struct index_part_t *segment_part(const struct wordindex_t *idx) {
+        struct index_part_t *part = index_part_new();
+        if (!part) return NULL;
+
+        for (uint64_t t = 0; t < idx->hdr->nterms; t++) {
+                const struct index_term *term = &idx->terms[t];
+                const uint8_t *p = idx->map + idx->hdr->postings + term->postings;
+                const uint8_t *end = p + term->postings_size;
+                uint64_t offset = 0;
+
+                if (term->str > idx->hdr->strings_size ||
+                    term->len > idx->hdr->strings_size - term->str ||
+                    term->postings > idx->hdr->postings_size ||
+                    term->postings_size > idx->hdr->postings_size - term->postings)
+                        goto fail;
+
+                for (uint64_t i = 0; i < term->count; i++) {
+                        uint64_t delta = 0;
+                        int shift = 0;
+
+                        do {
+                                if (p == end || shift > 63) goto fail;
+                                delta |= (uint64_t)(*p & 0x7f) << shift;
+                                shift += 7;
+                        } while (*p++ & 0x80);
+
+                        offset += delta;
+                        if (index_part_add(part, idx->strings + term->str, term->len, offset) != 0)
+                                goto fail;
+                }
+        }
+        return part;
+
+fail:
+        index_part_free(part);
+        return NULL;
+}
+
+int wordindex_compact(const char *path, const struct index_set_t *set,
+                      struct index_stats_t *stats) {
+        struct index_part_t *parts[INDEX_MAX_SEGMENTS];
+        struct index_meta_t meta = *wordindex_set_meta(set);
+        char name[4096];
+        int n, ret = -1;
+
+        for (n = 0; n < set->n; n++) {
+                parts[n] = segment_part(set->seg[n]);
+                if (!parts[n]) goto out;
+        }
+
+        meta.start = 0;
+        ret = wordindex_write(path, parts, n, &meta, stats);
+
+        /* The new base covers them: readers now stop the chain before them */
+        for (int i = 1; ret == 0 && i < set->n; i++) {
+                wordindex_segment_path(path, i, name, sizeof(name));
+                unlink(name);
+        }
+
+out:
+        while (n-- > 0)
+                index_part_free(parts[n]);
+        return ret;
+}
+
+int wordindex_count(const char *path, const struct file_id_t *source,
+                    const char *word, size_t len, uint64_t *count) {
+        struct index_set_t set;
+        int ret = wordindex_set_open(path, &set);
+
+        if (ret != INDEX_OK) return ret;
+        if (memcmp(&wordindex_set_meta(&set)->source, source, sizeof(*source)) != 0)
+                ret = INDEX_STALE;
+        else
+                ret = wordindex_set_count(&set, word, len, count);
+        wordindex_set_close(&set);
+        return ret;
+}
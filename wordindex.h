@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2025 Davide Usberti <usbertibox@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ============================ Word index ===============================
+ *
+ * An inverted index of the words of a file: for every distinct word the
+ * number of times it appears and the offsets where it starts. Words are
+ * split exactly as SEARCH_WORD does, so the count read from the index is
+ * the one a scan would give.
+ *
+ * Each thread collects the words of its chunk in a struct index_part_t,
+ * then the parts are merged into a sorted dictionary and the offsets are
+ * written delta + varint encoded (see replace_file() for how it's
+ * written). It is used through mmap() without being loaded: answering a
+ * count is a binary search touching a handful of pages.
+ *
+ * The index remembers the device, inode, size and mtime of the file it
+ * was built from and the word characters in use: if any differs it is
+ * not used and the file is scanned.
+ *
+ * Append-only files don't need to be indexed again from scratch: an index
+ * is a chain of segments, each covering the words starting in a range of
+ * the file, and an update adds a segment for what was appended (see
+ * tsearch_update_index()). The base segment lives at the index path, the
+ * next ones at "<path>.1", "<path>.2"... and they are merged back into
+ * the base from time to time. The last word of the file may still grow,
+ * so a segment keeps it apart (the tail) and the next segment starts from
+ * it.
+ */
+#ifndef WORDINDEX_H
+#define WORDINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tsearch.h"
+
+/* Segments beyond this are ignored, compaction happens well before */
+#define INDEX_MAX_SEGMENTS 64
+/* An update making this many segments merges them */
+#define INDEX_COMPACT_AT   8
+
+struct index_part_t;
+struct wordindex_t;
+
+/* What a segment covers */
+struct index_meta_t {
+        struct file_id_t source;    /* The file when the segment was written */
+        uint64_t start;             /* Words starting in [start, end) */
+        uint64_t end;
+        uint64_t guards[2];         /* See file_guards(), for [0, end) */
+        uint32_t tail_len;          /* The word at [end, source.size), if any */
+        char     tail[MAX_WORD_LENGTH];
+};
+
+/* The segments of an index, in file order */
+struct index_set_t {
+        int n;
+        struct wordindex_t *seg[INDEX_MAX_SEGMENTS];
+};
+
+struct index_stats_t {
+        uint64_t words;     /* Occurrences indexed */
+        uint64_t terms;     /* Distinct words */
+};
+
+/* Words of a single chunk, filled by a single thread */
+struct index_part_t *index_part_new(void);
+void index_part_free(struct index_part_t *part);
+int index_part_add(struct index_part_t *part, const char *word, size_t len,
+                   uint64_t offset);
+
+/* Merge the parts (given in file order) and write the segment to path */
+int wordindex_write(const char *path, struct index_part_t **parts, int nparts,
+                    const struct index_meta_t *meta, struct index_stats_t *stats);
+
+/* Map the segment at path. Returns NULL and the reason (INDEX_*) in ret
+ * if it's not usable. */
+struct wordindex_t *wordindex_open(const char *path, int *ret);
+void wordindex_close(struct wordindex_t *idx);
+const struct index_meta_t *wordindex_meta(const struct wordindex_t *idx);
+
+/* Occurrences of the word in the segment (0 if it's not there), the
+ * tail excluded */
+int wordindex_lookup(const struct wordindex_t *idx, const char *word, size_t len,
+                     uint64_t *count);
+
+/* Path of the segment number seg of the index at path */
+void wordindex_segment_path(const char *path, int seg, char *buf, size_t len);
+
+/* Open every segment of the index at path */
+int wordindex_set_open(const char *path, struct index_set_t *set);
+void wordindex_set_close(struct index_set_t *set);
+
+/* The last segment, telling what the whole index covers */
+const struct index_meta_t *wordindex_set_meta(const struct index_set_t *set);
+
+/* Occurrences of the word in the file the index covers */
+int wordindex_set_count(const struct index_set_t *set, const char *word, size_t len,
+                        uint64_t *count);
+
+/* Merge the segments into a single base segment at path */
+int wordindex_compact(const char *path, const struct index_set_t *set,
+                      struct index_stats_t *stats);
+
+/* Occurrences of the word, if the index at path is up to date with the
+ * file identified by source */
+int wordindex_count(const char *path, const struct file_id_t *source,
+                    const char *word, size_t len, uint64_t *count);
+
+#endif /* WORDINDEX_H */